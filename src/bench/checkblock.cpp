@@ -5,10 +5,13 @@
 #include <bench/bench.h>
 
 #include <chainparams.h>
+#include <consensus/merkle.h>
 #include <validation.h>
 #include <streams.h>
 #include <consensus/validation.h>
 
+#include <boost/thread.hpp>
+
 namespace block_bench {
 #include <bench/data/block413567.raw.h>
 } // namespace block_bench
@@ -55,5 +58,75 @@ static void DeserializeAndCheckBlockTest(benchmark::State& state)
     }
 }
 
+// Transaction hashes are computed on first use, these include that
+static void DeserializeAndHashBlockTest(benchmark::State& state)
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    char a = '\0';
+    stream.write(&a, 1); // Prevent compaction
+
+    while (state.KeepRunning()) {
+        CBlock block;
+        stream >> block;
+        assert(stream.Rewind(sizeof(block_bench::block413567)));
+
+        for (const auto& tx : block.vtx)
+            tx->GetHash();
+    }
+}
+
+static void DeserializeAndMerkleRootsBlockTest(benchmark::State& state)
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    char a = '\0';
+    stream.write(&a, 1); // Prevent compaction
+
+    while (state.KeepRunning()) {
+        CBlock block;
+        stream >> block;
+        assert(stream.Rewind(sizeof(block_bench::block413567)));
+
+        assert(BlockMerkleRoot(block) == block.hashMerkleRoot);
+        BlockWitnessMerkleRoot(block);
+    }
+}
+
+// The same, with the transactions checked on three threads
+static void DeserializeAndCheckBlockParallelTest(benchmark::State& state)
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    char a = '\0';
+    stream.write(&a, 1); // Prevent compaction
+
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+
+    boost::thread_group threadGroup;
+    nScriptCheckThreads = 3;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadGroup.create_thread(&ThreadBlockCheck);
+
+    while (state.KeepRunning()) {
+        CBlock block;
+        stream >> block;
+        assert(stream.Rewind(sizeof(block_bench::block413567)));
+
+        CValidationState validationState;
+        assert(CheckBlock(block, validationState, chainParams->GetConsensus()));
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    nScriptCheckThreads = 0;
+}
+
 BENCHMARK(DeserializeBlockTest, 130);
+BENCHMARK(DeserializeAndHashBlockTest, 130);
+BENCHMARK(DeserializeAndMerkleRootsBlockTest, 130);
 BENCHMARK(DeserializeAndCheckBlockTest, 160);
+BENCHMARK(DeserializeAndCheckBlockParallelTest, 160);
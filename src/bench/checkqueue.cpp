@@ -6,6 +6,7 @@
 #include <util.h>
 #include <validation.h>
 #include <checkqueue.h>
+#include <crypto/sha256.h>
 #include <prevector.h>
 #include <vector>
 #include <boost/thread/thread.hpp>
@@ -21,31 +22,52 @@ static const unsigned int QUEUE_BATCH_SIZE = 128;
 // This Benchmark tests the CheckQueue with a slightly realistic workload,
 // where checks all contain a prevector that is indirect 50% of the time
 // and there is a little bit of work done between calls to Add.
-static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
+struct PrevectorJob {
+    prevector<PREVECTOR_SIZE, uint8_t> p;
+    PrevectorJob(){
+    }
+    explicit PrevectorJob(FastRandomContext& insecure_rand){
+        p.resize(insecure_rand.randrange(PREVECTOR_SIZE*2));
+    }
+    bool operator()()
+    {
+        return true;
+    }
+    void swap(PrevectorJob& x){p.swap(x.p);};
+};
+
+// A check that takes about as long as a signature verification would,
+// to show how the queue scales with the number of threads.
+struct HashJob {
+    unsigned char data[32]{};
+    HashJob(){
+    }
+    explicit HashJob(FastRandomContext& insecure_rand){
+        uint256 seed = insecure_rand.rand256();
+        memcpy(data, seed.begin(), sizeof(data));
+    }
+    bool operator()()
+    {
+        for (int i = 0; i < 256; i++)
+            CSHA256().Write(data, sizeof(data)).Finalize(data);
+        return true;
+    }
+    void swap(HashJob& x){std::swap(data, x.data);};
+};
+
+template <typename Job>
+static void CCheckQueueSpeed(benchmark::State& state, int nThreads)
 {
-    struct PrevectorJob {
-        prevector<PREVECTOR_SIZE, uint8_t> p;
-        PrevectorJob(){
-        }
-        explicit PrevectorJob(FastRandomContext& insecure_rand){
-            p.resize(insecure_rand.randrange(PREVECTOR_SIZE*2));
-        }
-        bool operator()()
-        {
-            return true;
-        }
-        void swap(PrevectorJob& x){p.swap(x.p);};
-    };
-    CCheckQueue<PrevectorJob> queue {QUEUE_BATCH_SIZE};
+    CCheckQueue<Job> queue {QUEUE_BATCH_SIZE};
     boost::thread_group tg;
-    for (auto x = 0; x < std::max(MIN_CORES, GetNumCores()); ++x) {
+    for (auto x = 0; x < nThreads; ++x) {
        tg.create_thread([&]{queue.Thread();});
     }
     while (state.KeepRunning()) {
         // Make insecure_rand here so that each iteration is identical.
         FastRandomContext insecure_rand(true);
-        CCheckQueueControl<PrevectorJob> control(&queue);
-        std::vector<std::vector<PrevectorJob>> vBatches(BATCHES);
+        CCheckQueueControl<Job> control(&queue);
+        std::vector<std::vector<Job>> vBatches(BATCHES);
         for (auto& vChecks : vBatches) {
             vChecks.reserve(BATCH_SIZE);
             for (size_t x = 0; x < BATCH_SIZE; ++x)
@@ -59,4 +81,26 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.interrupt_all();
     tg.join_all();
 }
+
+static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
+{
+    CCheckQueueSpeed<PrevectorJob>(state, std::max(MIN_CORES, GetNumCores()));
+}
+
+// Scaling curve: the master thread plus N-1 workers.
+static void CCheckQueueScaling_1(benchmark::State& state) { CCheckQueueSpeed<HashJob>(state, 0); }
+static void CCheckQueueScaling_2(benchmark::State& state) { CCheckQueueSpeed<HashJob>(state, 1); }
+static void CCheckQueueScaling_4(benchmark::State& state) { CCheckQueueSpeed<HashJob>(state, 3); }
+static void CCheckQueueScaling_8(benchmark::State& state) { CCheckQueueSpeed<HashJob>(state, 7); }
+static void CCheckQueueScaling_16(benchmark::State& state) { CCheckQueueSpeed<HashJob>(state, 15); }
+static void CCheckQueueScaling_32(benchmark::State& state) { CCheckQueueSpeed<HashJob>(state, 31); }
+static void CCheckQueueScaling_64(benchmark::State& state) { CCheckQueueSpeed<HashJob>(state, 63); }
+
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+BENCHMARK(CCheckQueueScaling_1, 4);
+BENCHMARK(CCheckQueueScaling_2, 4);
+BENCHMARK(CCheckQueueScaling_4, 4);
+BENCHMARK(CCheckQueueScaling_8, 4);
+BENCHMARK(CCheckQueueScaling_16, 4);
+BENCHMARK(CCheckQueueScaling_32, 4);
+BENCHMARK(CCheckQueueScaling_64, 4);
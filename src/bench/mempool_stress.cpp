@@ -0,0 +1,307 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <arith_uint256.h>
+#include <chainparams.h>
+#include <consensus/consensus.h>
+#include <consensus/validation.h>
+#include <fs.h>
+#include <miner.h>
+#include <policy/policy.h>
+#include <random.h>
+#include <rpc/blockchain.h>
+#include <scheduler.h>
+#include <script/sigcache.h>
+#include <txdb.h>
+#include <txmempool.h>
+#include <util.h>
+#include <validation.h>
+#include <validationinterface.h>
+
+#include <univalue.h>
+
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+// Benchmarks for the mempool paths that get expensive once the pool is full,
+// run against a deterministic pool of MEMPOOL_TX_COUNT transactions. Most
+// transactions are unrelated, the rest come in packages (chains and trees)
+// of up to the default ancestor/descendant limit.
+
+static const size_t MEMPOOL_TX_COUNT = 100000;
+static const size_t MAX_PACKAGE_SIZE = 25;
+static const CAmount CONFIRMED_INPUT_VALUE = COIN;
+
+namespace {
+
+struct MempoolPopulation
+{
+    std::vector<CTransactionRef> vTx;        //!< All transactions, parents before children
+    std::vector<CAmount> vFee;               //!< Fee of each transaction in vTx
+    std::vector<size_t> vPackageStart;       //!< Index in vTx of the first transaction of each package
+    std::vector<COutPoint> vConfirmedInputs; //!< The (not in mempool) outpoints spent by the first transaction of each package
+    std::map<uint256, size_t> mapIndex;      //!< Index in vTx by txid
+};
+
+} // namespace
+
+static MempoolPopulation CreatePopulation()
+{
+    FastRandomContext rand(true);
+    const CScript scriptOpTrue = CScript() << OP_TRUE;
+    MempoolPopulation pop;
+
+    while (pop.vTx.size() < MEMPOOL_TX_COUNT) {
+        size_t nPackageSize = rand.randrange(4) ? 1 : 2 + rand.randrange(MAX_PACKAGE_SIZE - 1);
+        nPackageSize = std::min(nPackageSize, MEMPOOL_TX_COUNT - pop.vTx.size());
+        pop.vPackageStart.push_back(pop.vTx.size());
+
+        // Every transaction spends outputs that are still unspent within its
+        // own package, so the package stays within the ancestor/descendant limits.
+        const COutPoint confirmed(ArithToUint256(arith_uint256(pop.vConfirmedInputs.size() + 1)), 0);
+        pop.vConfirmedInputs.push_back(confirmed);
+        std::vector<std::pair<COutPoint, CAmount>> vUnspent{{confirmed, CONFIRMED_INPUT_VALUE}};
+
+        for (size_t i = 0; i < nPackageSize; i++) {
+            CMutableTransaction tx;
+            CAmount nValueIn = 0;
+            const size_t nInputs = (vUnspent.size() > 1 && rand.randrange(5) == 0) ? 2 : 1;
+            for (size_t j = 0; j < nInputs; j++) {
+                const size_t pos = rand.randrange(vUnspent.size());
+                tx.vin.emplace_back(vUnspent[pos].first);
+                nValueIn += vUnspent[pos].second;
+                vUnspent[pos] = vUnspent.back();
+                vUnspent.pop_back();
+            }
+            tx.vout.resize(2);
+            for (CTxOut& txout : tx.vout) {
+                txout.scriptPubKey = scriptOpTrue;
+            }
+            const CAmount nFee = GetVirtualTransactionSize(tx) * (1 + rand.randrange(500));
+            tx.vout[0].nValue = (nValueIn - nFee) / 2;
+            tx.vout[1].nValue = nValueIn - nFee - tx.vout[0].nValue;
+
+            CTransactionRef txRef = MakeTransactionRef(std::move(tx));
+            for (uint32_t n = 0; n < txRef->vout.size(); n++) {
+                vUnspent.emplace_back(COutPoint(txRef->GetHash(), n), txRef->vout[n].nValue);
+            }
+            pop.mapIndex.emplace(txRef->GetHash(), pop.vTx.size());
+            pop.vTx.push_back(std::move(txRef));
+            pop.vFee.push_back(nFee);
+        }
+    }
+    return pop;
+}
+
+static const MempoolPopulation& GetPopulation()
+{
+    static const MempoolPopulation pop = CreatePopulation();
+    return pop;
+}
+
+static void AddTx(CTxMemPool& pool, const MempoolPopulation& pop, size_t i)
+{
+    LockPoints lp;
+    pool.addUnchecked(pop.vTx[i]->GetHash(), CTxMemPoolEntry(pop.vTx[i], pop.vFee[i], /* nTime */ i, /* entryHeight */ 1,
+                                                             /* spendsCoinbase */ false, /* sigOpCost */ 0, lp));
+}
+
+static void FillPool(CTxMemPool& pool, const MempoolPopulation& pop)
+{
+    for (size_t i = 0; i < pop.vTx.size(); i++) {
+        AddTx(pool, pop, i);
+    }
+}
+
+// Adding every transaction of the population to an empty pool, including
+// the ancestor calculation addUnchecked does for each of them.
+static void MempoolAddUnchecked(benchmark::State& state)
+{
+    const MempoolPopulation& pop = GetPopulation();
+    CTxMemPool pool;
+
+    while (state.KeepRunning()) {
+        FillPool(pool, pop);
+        pool.clear();
+    }
+}
+
+// Connecting a full block of whole packages. Each iteration puts the block's
+// transactions back afterwards, so that share of the time is what
+// MempoolAddUnchecked measures for one block's worth of transactions.
+static void MempoolRemoveForBlock(benchmark::State& state)
+{
+    const MempoolPopulation& pop = GetPopulation();
+    CTxMemPool pool;
+    FillPool(pool, pop);
+
+    std::vector<CTransactionRef> vBlockTx;
+    int64_t nBlockWeight = 4000;
+    for (size_t i = 0; i < pop.vTx.size(); i++) {
+        nBlockWeight += GetTransactionWeight(*pop.vTx[i]);
+        if (nBlockWeight > MAX_BLOCK_WEIGHT && std::binary_search(pop.vPackageStart.begin(), pop.vPackageStart.end(), i)) {
+            break;
+        }
+        vBlockTx.push_back(pop.vTx[i]);
+    }
+
+    while (state.KeepRunning()) {
+        pool.removeForBlock(vBlockTx, 2);
+        for (size_t i = 0; i < vBlockTx.size(); i++) {
+            AddTx(pool, pop, i);
+        }
+    }
+}
+
+// A reorg that disconnects a block confirming the first transaction of
+// thousands of packages, whose descendants stayed in the pool: the
+// transactions are added back and UpdateTransactionsFromBlock has to find
+// and account for their in-mempool descendants, as UpdateMempoolForReorg
+// does. Each iteration connects the block first.
+static void MempoolUpdateTransactionsFromBlock(benchmark::State& state)
+{
+    const MempoolPopulation& pop = GetPopulation();
+    CTxMemPool pool;
+    FillPool(pool, pop);
+
+    std::vector<CTransactionRef> vBlockTx;
+    std::vector<size_t> vBlockIndex;
+    std::vector<uint256> vHashUpdate;
+    int64_t nBlockWeight = 4000;
+    for (size_t i : pop.vPackageStart) {
+        nBlockWeight += GetTransactionWeight(*pop.vTx[i]);
+        if (nBlockWeight > MAX_BLOCK_WEIGHT) break;
+        vBlockTx.push_back(pop.vTx[i]);
+        vBlockIndex.push_back(i);
+        vHashUpdate.push_back(pop.vTx[i]->GetHash());
+    }
+
+    while (state.KeepRunning()) {
+        pool.removeForBlock(vBlockTx, 2);
+        for (size_t i : vBlockIndex) {
+            AddTx(pool, pop, i);
+        }
+        pool.UpdateTransactionsFromBlock(vHashUpdate);
+    }
+}
+
+// Evicting the lowest descendant score packages until 10% of the pool's
+// memory is freed. The evicted transactions are added back after each round.
+static void MempoolTrimToSize(benchmark::State& state)
+{
+    const MempoolPopulation& pop = GetPopulation();
+    CTxMemPool pool;
+    FillPool(pool, pop);
+    const size_t nSizeLimit = pool.DynamicMemoryUsage() * 9 / 10;
+
+    std::vector<size_t> vRemoved;
+    boost::signals2::scoped_connection conn = pool.NotifyEntryRemoved.connect([&](CTransactionRef tx, MemPoolRemovalReason reason) {
+        vRemoved.push_back(pop.mapIndex.at(tx->GetHash()));
+    });
+
+    while (state.KeepRunning()) {
+        pool.TrimToSize(nSizeLimit);
+        std::sort(vRemoved.begin(), vRemoved.end());
+        for (size_t i : vRemoved) {
+            AddTx(pool, pop, i);
+        }
+        vRemoved.clear();
+    }
+}
+
+static void MempoolToJSON(benchmark::State& state)
+{
+    FillPool(::mempool, GetPopulation());
+
+    while (state.KeepRunning()) {
+        UniValue result = mempoolToJSON(false);
+        assert(result.size() == MEMPOOL_TX_COUNT);
+    }
+    ::mempool.clear();
+}
+
+static void MempoolToJSONVerbose(benchmark::State& state)
+{
+    FillPool(::mempool, GetPopulation());
+
+    while (state.KeepRunning()) {
+        UniValue result = mempoolToJSON(true);
+        assert(result.size() == MEMPOOL_TX_COUNT);
+    }
+    ::mempool.clear();
+}
+
+// Block template creation from the full pool on top of a regtest genesis
+// block. The outputs the packages spend are added to the UTXO set, so
+// the template passes TestBlockValidity like a real one has to.
+static void MempoolCreateNewBlock(benchmark::State& state)
+{
+    const MempoolPopulation& pop = GetPopulation();
+    const CScript scriptOpTrue = CScript() << OP_TRUE;
+
+    SelectParams(CBaseChainParams::REGTEST);
+    const CChainParams& chainparams = Params();
+    InitSignatureCache();
+    InitScriptExecutionCache();
+    ClearDatadirCache();
+    const fs::path pathTemp = fs::temp_directory_path() / strprintf("bench_litecoin_%lu_%i", (unsigned long)GetTime(), (int)GetRandInt(100000));
+    fs::create_directories(pathTemp);
+    const std::string strDataDirOld = gArgs.GetArg("-datadir", "");
+    gArgs.ForceSetArg("-datadir", pathTemp.string());
+
+    boost::thread_group threadGroup;
+    CScheduler scheduler;
+    threadGroup.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+    pblocktree.reset(new CBlockTreeDB(1 << 20, true));
+    pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
+    pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
+    if (!LoadGenesisBlock(chainparams)) {
+        throw std::runtime_error("LoadGenesisBlock failed.");
+    }
+    {
+        CValidationState validationState;
+        if (!ActivateBestChain(validationState, chainparams)) {
+            throw std::runtime_error("ActivateBestChain failed.");
+        }
+    }
+    {
+        LOCK(cs_main);
+        for (const COutPoint& outpoint : pop.vConfirmedInputs) {
+            pcoinsTip->AddCoin(outpoint, Coin(CTxOut(CONFIRMED_INPUT_VALUE, scriptOpTrue), 1, false), false);
+        }
+    }
+    FillPool(::mempool, pop);
+
+    while (state.KeepRunning()) {
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptOpTrue);
+        assert(pblocktemplate->block.vtx.size() > 1);
+    }
+
+    ::mempool.clear();
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    GetMainSignals().FlushBackgroundCallbacks();
+    GetMainSignals().UnregisterBackgroundSignalScheduler();
+    UnloadBlockIndex();
+    pcoinsTip.reset();
+    pcoinsdbview.reset();
+    pblocktree.reset();
+    fs::remove_all(pathTemp);
+    gArgs.ForceSetArg("-datadir", strDataDirOld);
+    ClearDatadirCache();
+    SelectParams(ChainNameFromCommandLine());
+}
+
+BENCHMARK(MempoolAddUnchecked, 1);
+BENCHMARK(MempoolRemoveForBlock, 2);
+BENCHMARK(MempoolUpdateTransactionsFromBlock, 1);
+BENCHMARK(MempoolTrimToSize, 2);
+BENCHMARK(MempoolToJSON, 5);
+BENCHMARK(MempoolToJSONVerbose, 1);
+BENCHMARK(MempoolCreateNewBlock, 3);
@@ -6,10 +6,13 @@
 
 #include <bench/bench.h>
 #include <bloom.h>
+#include <crypto/common.h>
+#include <uint256.h>
 
-static void RollingBloom(benchmark::State& state)
+template <typename RollingBloomFilter>
+static void RunRollingBloom(benchmark::State& state)
 {
-    CRollingBloomFilter filter(120000, 0.000001);
+    RollingBloomFilter filter(120000, 0.000001);
     std::vector<unsigned char> data(32);
     uint32_t count = 0;
     uint64_t match = 0;
@@ -29,4 +32,45 @@ static void RollingBloom(benchmark::State& state)
     }
 }
 
+/* Like the relay filters, which are mostly fed txids */
+template <typename RollingBloomFilter>
+static void RunRollingBloomHash(benchmark::State& state)
+{
+    RollingBloomFilter filter(50000, 0.000001);
+    uint256 hash;
+    uint32_t count = 0;
+    uint64_t match = 0;
+    while (state.KeepRunning()) {
+        count++;
+        WriteLE32(hash.begin(), count);
+        filter.insert(hash);
+
+        WriteBE32(hash.begin(), count);
+        match += filter.contains(hash);
+    }
+}
+
+static void RollingBloom(benchmark::State& state)
+{
+    RunRollingBloom<CRollingBloomFilter>(state);
+}
+
+static void BlockedRollingBloom(benchmark::State& state)
+{
+    RunRollingBloom<CBlockedRollingBloomFilter>(state);
+}
+
+static void RollingBloomHash(benchmark::State& state)
+{
+    RunRollingBloomHash<CRollingBloomFilter>(state);
+}
+
+static void BlockedRollingBloomHash(benchmark::State& state)
+{
+    RunRollingBloomHash<CBlockedRollingBloomFilter>(state);
+}
+
 BENCHMARK(RollingBloom, 1500 * 1000);
+BENCHMARK(BlockedRollingBloom, 1500 * 1000);
+BENCHMARK(RollingBloomHash, 1500 * 1000);
+BENCHMARK(BlockedRollingBloomHash, 1500 * 1000);
@@ -0,0 +1,41 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <arith_uint256.h>
+#include <primitives/transaction.h>
+#include <pubkey.h>
+#include <script/interpreter.h>
+#include <script/standard.h>
+#include <uint256.h>
+
+// Legacy signature hashes of all the inputs of a big consolidation
+// transaction, with and without the precomputed transaction data.
+static void SignatureHashLegacy(benchmark::State& state, bool fCache)
+{
+    CScript scriptCode = GetScriptForDestination(CKeyID(uint160()));
+    CMutableTransaction txMut;
+    txMut.vin.resize(500);
+    for (size_t i = 0; i < txMut.vin.size(); i++) {
+        txMut.vin[i].prevout = COutPoint(ArithToUint256(arith_uint256(i)), 0);
+        txMut.vin[i].scriptSig = CScript() << std::vector<unsigned char>(72) << std::vector<unsigned char>(33);
+    }
+    txMut.vout.resize(2);
+    txMut.vout[0].scriptPubKey = scriptCode;
+    txMut.vout[1].scriptPubKey = scriptCode;
+    CTransaction tx(txMut);
+
+    while (state.KeepRunning()) {
+        PrecomputedTransactionData txdata(tx);
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++) {
+            SignatureHash(scriptCode, tx, nIn, SIGHASH_ALL, 0, SIGVERSION_BASE, fCache ? &txdata : nullptr);
+        }
+    }
+}
+
+static void SignatureHashLegacyUncached(benchmark::State& state) { SignatureHashLegacy(state, false); }
+static void SignatureHashLegacyCached(benchmark::State& state) { SignatureHashLegacy(state, true); }
+
+BENCHMARK(SignatureHashLegacyUncached, 10);
+BENCHMARK(SignatureHashLegacyCached, 10);
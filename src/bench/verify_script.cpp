@@ -3,12 +3,14 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <bench/bench.h>
+#include <crypto/sha256.h>
 #include <key.h>
 #if defined(HAVE_CONSENSUS_LIB)
 #include <script/bitcoinconsensus.h>
 #endif
 #include <script/script.h>
 #include <script/sign.h>
+#include <script/standard.h>
 #include <streams.h>
 
 #include <array>
@@ -105,4 +107,81 @@ static void VerifyScriptBench(benchmark::State& state)
     }
 }
 
+// Signature checker that accepts any signature, to measure the cost of
+// evaluating the scripts apart from the signature checks themselves.
+class AcceptingSignatureChecker : public BaseSignatureChecker
+{
+public:
+    bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const override
+    {
+        return true;
+    }
+};
+
+enum class ScriptType { P2PKH, P2WPKH, P2SH_MULTISIG, P2WSH_MULTISIG };
+
+template <ScriptType type, bool fStandard = false>
+static void VerifyScriptEval(benchmark::State& state)
+{
+    const int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_STRICTENC |
+                      SCRIPT_VERIFY_LOW_S | SCRIPT_VERIFY_NULLDUMMY | SCRIPT_VERIFY_NULLFAIL | SCRIPT_VERIFY_CLEANSTACK;
+    std::vector<CKey> keys(3);
+    std::vector<std::vector<unsigned char>> vchSigs(3);
+    for (size_t i = 0; i < keys.size(); i++) {
+        std::array<unsigned char, 32> vchKey{};
+        vchKey[31] = i + 1;
+        keys[i].Set(vchKey.begin(), vchKey.end(), true);
+        keys[i].Sign(uint256S("1"), vchSigs[i]);
+        vchSigs[i].push_back(static_cast<unsigned char>(SIGHASH_ALL));
+    }
+    CScript scriptPubKey, scriptSig;
+    CScriptWitness witness;
+    if (type == ScriptType::P2PKH) {
+        scriptPubKey = GetScriptForDestination(keys[0].GetPubKey().GetID());
+        scriptSig << vchSigs[0] << ToByteVector(keys[0].GetPubKey());
+    } else if (type == ScriptType::P2WPKH) {
+        scriptPubKey = GetScriptForDestination(WitnessV0KeyHash(keys[0].GetPubKey().GetID()));
+        witness.stack = {vchSigs[0], ToByteVector(keys[0].GetPubKey())};
+    } else if (type == ScriptType::P2SH_MULTISIG) {
+        CScript redeemScript = GetScriptForMultisig(2, {keys[0].GetPubKey(), keys[1].GetPubKey(), keys[2].GetPubKey()});
+        scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+        scriptSig << OP_0 << vchSigs[0] << vchSigs[1] << ToByteVector(redeemScript);
+    } else {
+        CScript witnessScript = GetScriptForMultisig(2, {keys[0].GetPubKey(), keys[1].GetPubKey(), keys[2].GetPubKey()});
+        uint256 hash;
+        CSHA256().Write(witnessScript.data(), witnessScript.size()).Finalize(hash.begin());
+        scriptPubKey = GetScriptForDestination(WitnessV0ScriptHash(hash));
+        witness.stack = {{}, vchSigs[0], vchSigs[1], ToByteVector(witnessScript)};
+    }
+
+    AcceptingSignatureChecker checker;
+    while (state.KeepRunning()) {
+        ScriptError err;
+        bool success;
+        if (fStandard) {
+            bool fHandled = VerifyStandardScript(scriptSig, scriptPubKey, &witness, flags, checker, success, &err);
+            assert(fHandled);
+        } else {
+            success = VerifyScript(scriptSig, scriptPubKey, &witness, flags, checker, &err);
+        }
+        assert(err == SCRIPT_ERR_OK);
+        assert(success);
+    }
+}
+
+static void VerifyScriptP2PKH(benchmark::State& state) { VerifyScriptEval<ScriptType::P2PKH>(state); }
+static void VerifyScriptP2WPKH(benchmark::State& state) { VerifyScriptEval<ScriptType::P2WPKH>(state); }
+static void VerifyScriptP2SHMultisig(benchmark::State& state) { VerifyScriptEval<ScriptType::P2SH_MULTISIG>(state); }
+static void VerifyScriptP2WSHMultisig(benchmark::State& state) { VerifyScriptEval<ScriptType::P2WSH_MULTISIG>(state); }
+static void VerifyStandardScriptP2PKH(benchmark::State& state) { VerifyScriptEval<ScriptType::P2PKH, true>(state); }
+static void VerifyStandardScriptP2WPKH(benchmark::State& state) { VerifyScriptEval<ScriptType::P2WPKH, true>(state); }
+static void VerifyStandardScriptP2WSHMultisig(benchmark::State& state) { VerifyScriptEval<ScriptType::P2WSH_MULTISIG, true>(state); }
+
 BENCHMARK(VerifyScriptBench, 6300);
+BENCHMARK(VerifyScriptP2PKH, 300 * 1000);
+BENCHMARK(VerifyScriptP2WPKH, 300 * 1000);
+BENCHMARK(VerifyScriptP2SHMultisig, 100 * 1000);
+BENCHMARK(VerifyScriptP2WSHMultisig, 100 * 1000);
+BENCHMARK(VerifyStandardScriptP2PKH, 300 * 1000);
+BENCHMARK(VerifyStandardScriptP2WPKH, 300 * 1000);
+BENCHMARK(VerifyStandardScriptP2WSHMultisig, 100 * 1000);
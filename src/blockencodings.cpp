@@ -13,8 +13,6 @@
 #include <validation.h>
 #include <util.h>
 
-#include <unordered_map>
-
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
         shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
@@ -43,6 +41,75 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
     return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
 }
 
+void CBlockHeaderAndShortTxIDs::GetShortIDs(const uint256* const* txhashes, size_t n, uint64_t* shortids) const {
+    SipHashUint256Batch(shorttxidk0, shorttxidk1, txhashes, n, shortids);
+    for (size_t i = 0; i < n; i++) {
+        shortids[i] &= 0xffffffffffffL;
+    }
+}
+
+namespace {
+const uint64_t EMPTY_SHORTID = ~(uint64_t)0; // Short IDs are 48 bits
+
+/**
+ * Open addressing map from the short IDs of a compact block to their position
+ * in the block, kept at most a quarter full. The short IDs are chosen by the
+ * peer, so slots are picked with a random salt, and like an std::unordered_map
+ * bucket growing too large, a short ID that takes too many probes to place
+ * fails the whole map.
+ */
+class ShortIdMap
+{
+    static const int MAX_PROBES = 64;
+
+    std::vector<uint64_t> keys;
+    std::vector<uint16_t> values;
+    size_t mask;
+    int shift;
+    uint64_t salt;
+
+    size_t Slot(uint64_t shortid) const { return ((shortid ^ salt) * 0x9E3779B97F4A7C15ULL) >> shift; }
+
+public:
+    explicit ShortIdMap(size_t count) : salt(GetRand(std::numeric_limits<uint64_t>::max())) {
+        int bits = 4;
+        while (((size_t)1 << bits) < count * 4)
+            bits++;
+        keys.assign((size_t)1 << bits, EMPTY_SHORTID);
+        values.resize(keys.size());
+        mask = keys.size() - 1;
+        shift = 64 - bits;
+    }
+
+    //! Returns false if shortid was added before, or is too far from its slot
+    bool Insert(uint64_t shortid, uint16_t value) {
+        size_t slot = Slot(shortid);
+        for (int i = 0; i < MAX_PROBES; i++, slot = (slot + 1) & mask) {
+            if (keys[slot] == EMPTY_SHORTID) {
+                keys[slot] = shortid;
+                values[slot] = value;
+                return true;
+            }
+            if (keys[slot] == shortid)
+                return false;
+        }
+        return false;
+    }
+
+    //! Returns the value of shortid, or -1
+    int Find(uint64_t shortid) const {
+        size_t slot = Slot(shortid);
+        for (int i = 0; i < MAX_PROBES; i++, slot = (slot + 1) & mask) {
+            if (keys[slot] == shortid)
+                return values[slot];
+            if (keys[slot] == EMPTY_SHORTID)
+                return -1;
+        }
+        return -1;
+    }
+};
+} // namespace
+
 
 
 ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
@@ -77,67 +144,66 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     // Because well-formed cmpctblock messages will have a (relatively) uniform distribution
     // of short IDs, any highly-uneven distribution of elements can be safely treated as a
     // READ_STATUS_FAILED.
-    std::unordered_map<uint64_t, uint16_t> shorttxids(cmpctblock.shorttxids.size());
+    ShortIdMap shorttxids(cmpctblock.shorttxids.size());
     uint16_t index_offset = 0;
     for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
         while (txn_available[i + index_offset])
             index_offset++;
-        shorttxids[cmpctblock.shorttxids[i]] = i + index_offset;
-        // To determine the chance that the number of entries in a bucket exceeds N,
-        // we use the fact that the number of elements in a single bucket is
-        // binomially distributed (with n = the number of shorttxids S, and p =
-        // 1 / the number of buckets), that in the worst case the number of buckets is
-        // equal to S (due to std::unordered_map having a default load factor of 1.0),
-        // and that the chance for any bucket to exceed N elements is at most
-        // buckets * (the chance that any given bucket is above N elements).
-        // Thus: P(max_elements_per_bucket > N) <= S * (1 - cdf(binomial(n=S,p=1/S), N)).
-        // If we assume blocks of up to 16000, allowing 12 elements per bucket should
-        // only fail once per ~1 million block transfers (per peer and connection).
-        if (shorttxids.bucket_size(shorttxids.bucket(cmpctblock.shorttxids[i])) > 12)
+        // With the map at most a quarter full, a short ID ends up more than 64
+        // slots away from its own with negligible probability, so this fails on
+        // short ID collisions, or on a distribution uneven enough to be made up.
+        // TODO: in the shortid-collision case, we should instead request both transactions
+        // which collided. Falling back to full-block-request here is overkill.
+        if (!shorttxids.Insert(cmpctblock.shorttxids[i], i + index_offset))
             return READ_STATUS_FAILED;
     }
-    // TODO: in the shortid-collision case, we should instead request both transactions
-    // which collided. Falling back to full-block-request here is overkill.
-    if (shorttxids.size() != cmpctblock.shorttxids.size())
-        return READ_STATUS_FAILED; // Short ID collision
 
     std::vector<bool> have_txn(txn_available.size());
     {
     LOCK(pool->cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
-    for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = vTxHashes[i].second->GetSharedTx();
-                have_txn[idit->second]  = true;
-                mempool_count++;
-            } else {
-                // If we find two mempool txn that match the short id, just request it.
-                // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                if (txn_available[idit->second]) {
-                    txn_available[idit->second].reset();
-                    mempool_count--;
+    // Short IDs are computed for a batch of mempool transactions at a time
+    static const size_t BATCH_SIZE = 64;
+    const uint256* batch_hashes[BATCH_SIZE];
+    uint64_t batch_shortids[BATCH_SIZE];
+    for (size_t batch_start = 0; batch_start < vTxHashes.size() && mempool_count < cmpctblock.shorttxids.size(); batch_start += BATCH_SIZE) {
+        size_t batch_count = std::min(BATCH_SIZE, vTxHashes.size() - batch_start);
+        for (size_t j = 0; j < batch_count; j++) {
+            batch_hashes[j] = &vTxHashes[batch_start + j].first;
+        }
+        cmpctblock.GetShortIDs(batch_hashes, batch_count, batch_shortids);
+        for (size_t j = 0; j < batch_count; j++) {
+            int idx = shorttxids.Find(batch_shortids[j]);
+            if (idx >= 0) {
+                if (!have_txn[idx]) {
+                    txn_available[idx] = vTxHashes[batch_start + j].second->GetSharedTx();
+                    have_txn[idx]  = true;
+                    mempool_count++;
+                } else {
+                    // If we find two mempool txn that match the short id, just request it.
+                    // This should be rare enough that the extra bandwidth doesn't matter,
+                    // but eating a round-trip due to FillBlock failure would be annoying
+                    if (txn_available[idx]) {
+                        txn_available[idx].reset();
+                        mempool_count--;
+                    }
                 }
             }
+            // Though ideally we'd continue scanning for the two-txn-match-shortid case,
+            // the performance win of an early exit here is too good to pass up and worth
+            // the extra risk.
+            if (mempool_count == cmpctblock.shorttxids.size())
+                break;
         }
-        // Though ideally we'd continue scanning for the two-txn-match-shortid case,
-        // the performance win of an early exit here is too good to pass up and worth
-        // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
     }
     }
 
     for (size_t i = 0; i < extra_txn.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = extra_txn[i].second;
-                have_txn[idit->second]  = true;
+        int idx = shorttxids.Find(cmpctblock.GetShortID(extra_txn[i].first));
+        if (idx >= 0) {
+            if (!have_txn[idx]) {
+                txn_available[idx] = extra_txn[i].second;
+                have_txn[idx]  = true;
                 mempool_count++;
                 extra_count++;
             } else {
@@ -147,9 +213,9 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
                 // but eating a round-trip due to FillBlock failure would be annoying
                 // Note that we don't want duplication between extra_txn and mempool to
                 // trigger this case, so we compare witness hashes first
-                if (txn_available[idit->second] &&
-                        txn_available[idit->second]->GetWitnessHash() != extra_txn[i].second->GetWitnessHash()) {
-                    txn_available[idit->second].reset();
+                if (txn_available[idx] &&
+                        txn_available[idx]->GetWitnessHash() != extra_txn[i].second->GetWitnessHash()) {
+                    txn_available[idx].reset();
                     mempool_count--;
                     extra_count--;
                 }
@@ -158,7 +224,7 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
         // Though ideally we'd continue scanning for the two-txn-match-shortid case,
         // the performance win of an early exit here is too good to pass up and worth
         // the extra risk.
-        if (mempool_count == shorttxids.size())
+        if (mempool_count == cmpctblock.shorttxids.size())
             break;
     }
 
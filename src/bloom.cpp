@@ -310,3 +310,166 @@ void CRollingBloomFilter::reset()
         *it = 0;
     }
 }
+
+/**
+ * The false positive rate of a bloom filter made of nBlockBits-bit blocks,
+ * holding on average nElementsPerBlock elements per block. The number of
+ * elements in the block a lookup hits is Poisson distributed, and each of them
+ * sets nHashFuncs bits of it.
+ */
+static double BlockedBloomFPRate(double nElementsPerBlock, int nHashFuncs, int nBlockBits)
+{
+    double dev = 12 * sqrt(nElementsPerBlock) + 20;
+    int nMin = std::max(0, (int)floor(nElementsPerBlock - dev));
+    int nMax = (int)ceil(nElementsPerBlock + dev);
+    double logBitUnset = nHashFuncs * log1p(-1.0 / nBlockBits);
+    double fpRate = 0;
+    for (int j = nMin; j <= nMax; j++) {
+        double logProb = -nElementsPerBlock + j * log(nElementsPerBlock) - lgamma(j + 1.0);
+        fpRate += exp(logProb) * pow(1.0 - exp(logBitUnset * j), nHashFuncs);
+    }
+    return fpRate;
+}
+
+CBlockedRollingBloomFilter::CBlockedRollingBloomFilter(const unsigned int nElements, const double fpRate)
+{
+    /* Like CRollingBloomFilter, keep between 2 and 3 generations of nElements / 2
+     * entries. A lookup may hit in any of them, so each generation gets a third
+     * of the false positive rate. */
+    nEntriesPerGeneration = (nElements + 1) / 2;
+    double fpRateGeneration = fpRate / GENERATIONS;
+    double logFpRate = log(fpRateGeneration);
+    /* The optimal number of hash functions of an unblocked filter, and the
+     * number of blocks it would need. Blocking makes it worth using a few less,
+     * so find the number that needs the fewest blocks. */
+    int nHashFuncsMax = std::max(1, std::min((int)round(logFpRate / log(0.5)), 50));
+    nBlocks = 0;
+    for (int k = std::max(1, nHashFuncsMax * 2 / 3); k <= nHashFuncsMax; k++) {
+        double nFilterBits = ceil(-1.0 * k * nEntriesPerGeneration / log(1.0 - exp(logFpRate / k)));
+        uint32_t nLow = std::max<uint32_t>(1, nFilterBits / BLOCK_BITS);
+        uint32_t nHigh = nLow;
+        while (BlockedBloomFPRate((double)nEntriesPerGeneration / nHigh, k, BLOCK_BITS) > fpRateGeneration) {
+            nLow = nHigh + 1;
+            nHigh *= 2;
+        }
+        while (nLow < nHigh) {
+            uint32_t nMid = nLow + (nHigh - nLow) / 2;
+            if (BlockedBloomFPRate((double)nEntriesPerGeneration / nMid, k, BLOCK_BITS) > fpRateGeneration) {
+                nLow = nMid + 1;
+            } else {
+                nHigh = nMid;
+            }
+        }
+        if (nBlocks == 0 || nHigh < nBlocks) {
+            nBlocks = nHigh;
+            nHashFuncs = k;
+        }
+    }
+    data.clear();
+    /* Leave room to align the first block to a cache line. */
+    data.resize((size_t)nBlocks * GENERATIONS * BLOCK_WORDS + BLOCK_WORDS - 1);
+    reset();
+}
+
+uint64_t* CBlockedRollingBloomFilter::GetBlocks() const
+{
+    return (uint64_t*)(((uintptr_t)data.data() + BLOCK_WORDS * 8 - 1) & ~(uintptr_t)(BLOCK_WORDS * 8 - 1));
+}
+
+uint32_t CBlockedRollingBloomFilter::GetPositions(uint64_t nHash, uint64_t vMasks[BLOCK_WORDS]) const
+{
+    /* The upper half of the hash picks the block. Each 9 bits of a splitmix64
+     * sequence seeded with the hash pick a position within it. (Double hashing
+     * within a block this small clusters the positions of the elements whose
+     * step happens to be small.) */
+    uint32_t nBlock = ((uint64_t)(uint32_t)(nHash >> 32) * nBlocks) >> 32;
+    for (int w = 0; w < BLOCK_WORDS; w++) {
+        vMasks[w] = 0;
+    }
+    uint64_t nState = nHash;
+    uint64_t nBits = 0;
+    int nBitsLeft = 0;
+    for (int n = 0; n < nHashFuncs; n++) {
+        if (nBitsLeft < 9) {
+            nBits = (nState += 0x9E3779B97F4A7C15ULL);
+            nBits = (nBits ^ (nBits >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            nBits = (nBits ^ (nBits >> 27)) * 0x94D049BB133111EBULL;
+            nBits ^= nBits >> 31;
+            nBitsLeft = 64;
+        }
+        uint32_t pos = nBits & (BLOCK_BITS - 1);
+        vMasks[pos >> 6] |= ((uint64_t)1) << (pos & 0x3F);
+        nBits >>= 9;
+        nBitsLeft -= 9;
+    }
+    return nBlock;
+}
+
+void CBlockedRollingBloomFilter::insert(uint64_t nHash)
+{
+    uint64_t* pBlocks = GetBlocks();
+    if (nEntriesThisGeneration == nEntriesPerGeneration) {
+        nEntriesThisGeneration = 0;
+        nGeneration = (nGeneration + 1) % GENERATIONS;
+        /* Wipe the oldest generation, to reuse it. */
+        for (uint32_t i = 0; i < nBlocks; i++) {
+            uint64_t* pBlock = pBlocks + ((size_t)i * GENERATIONS + nGeneration) * BLOCK_WORDS;
+            std::fill(pBlock, pBlock + BLOCK_WORDS, 0);
+        }
+    }
+    nEntriesThisGeneration++;
+
+    uint64_t vMasks[BLOCK_WORDS];
+    uint32_t nBlock = GetPositions(nHash, vMasks);
+    uint64_t* pBlock = pBlocks + ((size_t)nBlock * GENERATIONS + nGeneration) * BLOCK_WORDS;
+    for (int w = 0; w < BLOCK_WORDS; w++) {
+        pBlock[w] |= vMasks[w];
+    }
+}
+
+bool CBlockedRollingBloomFilter::contains(uint64_t nHash) const
+{
+    uint64_t vMasks[BLOCK_WORDS];
+    uint32_t nBlock = GetPositions(nHash, vMasks);
+    const uint64_t* pBlock = GetBlocks() + (size_t)nBlock * GENERATIONS * BLOCK_WORDS;
+    /* Look at all generations without branching, and count bits that are
+     * missing from a generation's block against that generation. */
+    bool fFound = false;
+    for (int g = 0; g < GENERATIONS; g++) {
+        uint64_t nMissing = 0;
+        for (int w = 0; w < BLOCK_WORDS; w++) {
+            nMissing |= vMasks[w] & ~pBlock[g * BLOCK_WORDS + w];
+        }
+        fFound |= nMissing == 0;
+    }
+    return fFound;
+}
+
+void CBlockedRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    insert(CSipHasher(k0, k1).Write(vKey.data(), vKey.size()).Finalize());
+}
+
+void CBlockedRollingBloomFilter::insert(const uint256& hash)
+{
+    insert(SipHashUint256(k0, k1, hash));
+}
+
+bool CBlockedRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+{
+    return contains(CSipHasher(k0, k1).Write(vKey.data(), vKey.size()).Finalize());
+}
+
+bool CBlockedRollingBloomFilter::contains(const uint256& hash) const
+{
+    return contains(SipHashUint256(k0, k1, hash));
+}
+
+void CBlockedRollingBloomFilter::reset()
+{
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
+    nEntriesThisGeneration = 0;
+    nGeneration = 0;
+    std::fill(data.begin(), data.end(), 0);
+}
@@ -8,10 +8,12 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <atomic>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 template <typename T>
 class CCheckQueueControl;
@@ -25,12 +27,51 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Each worker has a queue of its own, which the master spreads the
+  * verifications over. A worker takes them from its own queue first, and
+  * steals from the others when that is empty, so that the workers rarely
+  * contend for the same lock. Workers that run out of work spin for a while
+  * before they go to sleep, as the master is usually about to add more. Once
+  * a verification fails, the remaining ones are skipped.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Maximum number of queues, workers beyond that share them
+    static const int MAX_QUEUES = 64;
+
+    //! Number of times to look for work before going to sleep
+    static const int SPIN_ROUNDS = 4096;
+
+    struct WorkerQueue {
+        boost::mutex mutex;
+        //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
+        std::vector<T> checks;
+        //! checks.size(), to skip empty queues without taking their lock
+        std::atomic<size_t> nSize{0};
+    };
+
+    WorkerQueue queues[MAX_QUEUES];
+
+    //! Number of worker threads that have started, not including the master
+    std::atomic<int> nWorkers{0};
+
+    //! Number of verifications in the queues
+    std::atomic<size_t> nQueued{0};
+
+    /**
+     * Number of verifications that haven't completed yet.
+     * This includes elements that are no longer queued, but still in the
+     * worker's own batches.
+     */
+    std::atomic<unsigned int> nTodo{0};
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk{true};
+
+    //! Mutex for workers and the master to go to sleep on
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,88 +80,91 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The number of workers (not including the master) that are asleep.
+    std::atomic<int> nIdle{0};
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! Whether the master is asleep
+    std::atomic<bool> fMasterIdle{false};
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The maximum number of elements to be processed in one batch
+    unsigned int nBatchSize;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Queue to add the next verifications to, only used by the master
+    unsigned int nNextQueue;
+
+    int GetQueueCount() const
+    {
+        int nQueues = nWorkers.load(std::memory_order_relaxed);
+        return nQueues < 1 ? 1 : nQueues > MAX_QUEUES ? MAX_QUEUES : nQueues;
+    }
 
     /**
-     * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * Take a batch of verifications from a queue. Take half of what's there,
+     * so that its owner, or others stealing from it, are left with the rest.
      */
-    unsigned int nTodo;
+    bool Take(WorkerQueue& queue, std::vector<T>& vChecks)
+    {
+        if (queue.nSize.load(std::memory_order_relaxed) == 0)
+            return false;
+        boost::unique_lock<boost::mutex> lock(queue.mutex);
+        size_t nSize = queue.checks.size();
+        if (nSize == 0)
+            return false;
+        size_t nNow = std::max<size_t>(1, std::min<size_t>(nBatchSize, nSize / 2));
+        vChecks.resize(nNow);
+        for (size_t i = 0; i < nNow; i++) {
+            // We want the lock on the mutex to be as short as possible, so swap jobs from the
+            // queue to the local batch vector instead of copying.
+            vChecks[i].swap(queue.checks.back());
+            queue.checks.pop_back();
+        }
+        queue.nSize.store(queue.checks.size(), std::memory_order_relaxed);
+        nQueued.fetch_sub(nNow);
+        return true;
+    }
 
-    //! The maximum number of elements to be processed in one batch
-    unsigned int nBatchSize;
+    //! Take a batch from queue nFirst, or else from the next one that has work
+    bool GetWork(int nFirst, std::vector<T>& vChecks)
+    {
+        int nQueues = GetQueueCount();
+        for (int i = 0; i < nQueues; i++) {
+            if (Take(queues[(nFirst + i) % nQueues], vChecks))
+                return true;
+        }
+        return false;
+    }
 
-    /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    //! Run a batch, unless a verification failed already, and destroy it
+    void Execute(std::vector<T>& vChecks)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+        if (fAllOk.load(std::memory_order_relaxed)) {
+            for (T& check : vChecks) {
+                if (!check()) {
+                    fAllOk.store(false, std::memory_order_relaxed);
+                    break;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+        }
+        unsigned int nNow = vChecks.size();
+        vChecks.clear();
+        if (nTodo.fetch_sub(nNow) == nNow && fMasterIdle.load()) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
+
+    //! Spin until fDone returns true, or SPIN_ROUNDS are over
+    template <typename Callable>
+    static bool Spin(Callable fDone)
+    {
+        for (int i = 0; i < SPIN_ROUNDS; i++) {
+            if (fDone())
+                return true;
+            if ((i & 63) == 63)
+                boost::this_thread::yield();
+        }
+        return false;
     }
 
 public:
@@ -128,33 +172,92 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) : nBatchSize(nBatchSizeIn), nNextQueue(0) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        int nQueue = nWorkers.fetch_add(1) % MAX_QUEUES;
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (true) {
+            if (GetWork(nQueue, vChecks)) {
+                Execute(vChecks);
+                continue;
+            }
+            if (Spin([this]{ return nQueued.load(std::memory_order_relaxed) > 0; }))
+                continue;
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nIdle++;
+            try {
+                while (nQueued.load() == 0)
+                    condWorker.wait(lock); // wait
+            } catch (...) {
+                nIdle--;
+                throw;
+            }
+            nIdle--;
+        }
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (true) {
+            if (GetWork(0, vChecks)) {
+                Execute(vChecks);
+                continue;
+            }
+            // The workers are busy with the last batches
+            if (Spin([this]{ return nTodo.load() == 0; }))
+                break;
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fMasterIdle = true;
+            while (nTodo.load() != 0 && nQueued.load() == 0)
+                condMaster.wait(lock); // wait
+            fMasterIdle = false;
+            if (nTodo.load() == 0)
+                break;
+        }
+        // return the current status, and reset it for new work later
+        return fAllOk.exchange(true);
     }
 
-    //! Add a batch of checks to the queue
+    //! Add a batch of checks to the queue, swapping them out of vChecks
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (vChecks.empty())
+            return;
+        // Don't bother queueing more work once a check failed, they would be
+        // skipped; still take the checks, as a queued batch would have been
+        if (!fAllOk.load(std::memory_order_relaxed)) {
+            for (T& check : vChecks)
+                T().swap(check);
+            return;
+        }
+        nTodo.fetch_add(vChecks.size());
+        // Spread large batches over the queues
+        int nQueues = GetQueueCount();
+        size_t nChunk = (vChecks.size() + nQueues - 1) / nQueues;
+        for (size_t i = 0; i < vChecks.size();) {
+            WorkerQueue& queue = queues[nNextQueue++ % nQueues];
+            size_t nEnd = std::min(vChecks.size(), i + nChunk);
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            nQueued.fetch_add(nEnd - i);
+            for (; i < nEnd; i++) {
+                queue.checks.push_back(T());
+                vChecks[i].swap(queue.checks.back());
+            }
+            queue.nSize.store(queue.checks.size(), std::memory_order_relaxed);
+        }
+        int nSleeping = nIdle.load();
+        if (nSleeping > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            for (size_t i = 0; i < std::min<size_t>(nSleeping, vChecks.size()); i++)
+                condWorker.notify_one();
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
     }
 
     ~CCheckQueue()
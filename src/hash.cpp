@@ -205,6 +205,79 @@ uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val)
     return v0 ^ v1 ^ v2 ^ v3;
 }
 
+/* SIPROUND on two independent states, so their rounds can execute in parallel */
+#define SIPROUND2 do { \
+    v0 += v1; w0 += w1; v1 = ROTL(v1, 13); w1 = ROTL(w1, 13); v1 ^= v0; w1 ^= w0; \
+    v0 = ROTL(v0, 32); w0 = ROTL(w0, 32); \
+    v2 += v3; w2 += w3; v3 = ROTL(v3, 16); w3 = ROTL(w3, 16); v3 ^= v2; w3 ^= w2; \
+    v0 += v3; w0 += w3; v3 = ROTL(v3, 21); w3 = ROTL(w3, 21); v3 ^= v0; w3 ^= w0; \
+    v2 += v1; w2 += w1; v1 = ROTL(v1, 17); w1 = ROTL(w1, 17); v1 ^= v2; w1 ^= w2; \
+    v2 = ROTL(v2, 32); w2 = ROTL(w2, 32); \
+} while (0)
+
+void SipHashUint256Batch(uint64_t k0, uint64_t k1, const uint256* const* vals, size_t n, uint64_t* out)
+{
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        const uint256& val = *vals[i];
+        const uint256& wal = *vals[i + 1];
+        uint64_t d = val.GetUint64(0), e = wal.GetUint64(0);
+
+        uint64_t v0 = 0x736f6d6570736575ULL ^ k0, w0 = v0;
+        uint64_t v1 = 0x646f72616e646f6dULL ^ k1, w1 = v1;
+        uint64_t v2 = 0x6c7967656e657261ULL ^ k0, w2 = v2;
+        uint64_t v3 = 0x7465646279746573ULL ^ k1, w3 = v3;
+        v3 ^= d;
+        w3 ^= e;
+
+        SIPROUND2;
+        SIPROUND2;
+        v0 ^= d;
+        w0 ^= e;
+        d = val.GetUint64(1);
+        e = wal.GetUint64(1);
+        v3 ^= d;
+        w3 ^= e;
+        SIPROUND2;
+        SIPROUND2;
+        v0 ^= d;
+        w0 ^= e;
+        d = val.GetUint64(2);
+        e = wal.GetUint64(2);
+        v3 ^= d;
+        w3 ^= e;
+        SIPROUND2;
+        SIPROUND2;
+        v0 ^= d;
+        w0 ^= e;
+        d = val.GetUint64(3);
+        e = wal.GetUint64(3);
+        v3 ^= d;
+        w3 ^= e;
+        SIPROUND2;
+        SIPROUND2;
+        v0 ^= d;
+        w0 ^= e;
+        v3 ^= ((uint64_t)4) << 59;
+        w3 ^= ((uint64_t)4) << 59;
+        SIPROUND2;
+        SIPROUND2;
+        v0 ^= ((uint64_t)4) << 59;
+        w0 ^= ((uint64_t)4) << 59;
+        v2 ^= 0xFF;
+        w2 ^= 0xFF;
+        SIPROUND2;
+        SIPROUND2;
+        SIPROUND2;
+        SIPROUND2;
+        out[i] = v0 ^ v1 ^ v2 ^ v3;
+        out[i + 1] = w0 ^ w1 ^ w2 ^ w3;
+    }
+    for (; i < n; i++) {
+        out[i] = SipHashUint256(k0, k1, *vals[i]);
+    }
+}
+
 uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra)
 {
     /* Specialized implementation for efficiency */
@@ -228,5 +228,8 @@ public:
  */
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
 uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
+/** SipHashUint256 of each of vals[0..n), into out[0..n). Hashes several values
+ *  at a time, interleaved, which is faster than hashing them one by one. */
+void SipHashUint256Batch(uint64_t k0, uint64_t k1, const uint256* const* vals, size_t n, uint64_t* out);
 
 #endif // BITCOIN_HASH_H
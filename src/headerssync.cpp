@@ -0,0 +1,273 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <headerssync.h>
+
+#include <pow.h>
+#include <protocol.h>
+
+void CHeadersRangeSync::Init(const MapCheckpoints& checkpoints, int nHeight, size_t nMaxBufferedIn, size_t nMaxBufferedPerPeerIn)
+{
+    vRanges.clear();
+    nBuffered = 0;
+    nMaxBuffered = nMaxBufferedIn;
+    nMaxBufferedPerPeer = nMaxBufferedPerPeerIn;
+
+    auto it = checkpoints.upper_bound(nHeight);
+    if (it == checkpoints.end())
+        return;
+    for (auto itNext = std::next(it); itNext != checkpoints.end(); it = itNext++) {
+        Range range;
+        range.nHeightStart = it->first;
+        range.hashEnd = itNext->second;
+        range.nHeightEnd = itNext->first;
+        range.hashLast = range.hashPopped = it->second;
+        range.nHeightLast = range.nHeightPopped = it->first;
+        range.nBitsLast = range.nBitsPopped = 0;
+        range.fStartChecked = false;
+        range.nodeAssigned = -1;
+        range.nTimeRequested = 0;
+        vRanges.push_back(std::move(range));
+    }
+}
+
+CHeadersRangeSync::Range* CHeadersRangeSync::FindAssigned(NodeId node)
+{
+    for (Range& range : vRanges) {
+        if (range.nodeAssigned == node)
+            return &range;
+    }
+    return nullptr;
+}
+
+bool CHeadersRangeSync::IsAssigned(NodeId node) const
+{
+    for (const Range& range : vRanges) {
+        if (range.nodeAssigned == node)
+            return true;
+    }
+    return false;
+}
+
+void CHeadersRangeSync::Unassign(Range& range, bool fFailed)
+{
+    if (fFailed)
+        range.setFailed.insert(range.nodeAssigned);
+    range.nodeAssigned = -1;
+}
+
+bool CHeadersRangeSync::HaveRoomForRequest(NodeId node) const
+{
+    size_t nRequested = 0;
+    size_t nBufferedFromPeer = 0;
+    for (const Range& range : vRanges) {
+        if (range.nodeAssigned != -1)
+            nRequested += MAX_HEADERS_RESULTS;
+        for (const HeadersChunk& chunk : range.chunks) {
+            if (chunk.node == node)
+                nBufferedFromPeer += chunk.headers.size();
+        }
+    }
+    return nBuffered + nRequested + MAX_HEADERS_RESULTS <= nMaxBuffered &&
+           nBufferedFromPeer + MAX_HEADERS_RESULTS <= nMaxBufferedPerPeer;
+}
+
+bool CHeadersRangeSync::AssignRange(NodeId node, int nPeerHeight, int nMaxHeight, int64_t nNow, uint256& hashFrom, uint256& hashStop)
+{
+    if (IsAssigned(node) || !HaveRoomForRequest(node))
+        return false;
+    for (Range& range : vRanges) {
+        if (range.nHeightStart > nMaxHeight)
+            break;
+        if (range.nodeAssigned != -1 || range.IsComplete() || range.nHeightEnd > nPeerHeight || range.setFailed.count(node))
+            continue;
+        if (!range.fStartChecked && range.nHeightLast != range.nHeightStart) {
+            // Already holds the one response allowed before its start was checked
+            continue;
+        }
+        range.nodeAssigned = node;
+        range.nTimeRequested = nNow;
+        hashFrom = range.hashLast;
+        hashStop = range.hashEnd;
+        return true;
+    }
+    return false;
+}
+
+CHeadersRangeSync::Result CHeadersRangeSync::ProcessHeaders(NodeId node, const std::vector<CBlockHeader>& headers, const Consensus::Params& consensusParams, int64_t nNow, uint256& hashFrom, uint256& hashStop)
+{
+    Range* range = FindAssigned(node);
+    if (range == nullptr)
+        return Result::NOT_IN_RANGE;
+    if (headers.empty()) {
+        // The peer doesn't have any of the range
+        Unassign(*range, true);
+        return Result::DONE;
+    }
+    if (headers[0].hashPrevBlock != range->hashLast)
+        return Result::NOT_IN_RANGE;
+
+    HeadersChunk chunk;
+    chunk.node = node;
+    chunk.nHeightPrev = range->nHeightLast;
+    chunk.nBitsPrev = range->nBitsLast;
+    uint256 hashPrev = range->hashLast;
+    int nHeight = range->nHeightLast;
+    uint32_t nBitsPrev = range->nBitsLast;
+    for (const CBlockHeader& header : headers) {
+        // Check each header as it arrives, rather than buffering a range of
+        // headers without proof of work
+        if (header.hashPrevBlock != hashPrev ||
+                !CheckProofOfWork(header.GetPoWHash(), header.nBits, consensusParams) ||
+                (nBitsPrev != 0 && !PermittedDifficultyTransition(consensusParams, nHeight + 1, nBitsPrev, header.nBits))) {
+            Unassign(*range, true);
+            return Result::INVALID;
+        }
+        hashPrev = header.GetHash();
+        nBitsPrev = header.nBits;
+        nHeight++;
+        chunk.headers.push_back(header);
+        if (nHeight == range->nHeightEnd) {
+            if (hashPrev != range->hashEnd) {
+                // Not the chain the range ends with
+                Unassign(*range, true);
+                return Result::INVALID;
+            }
+            break;
+        }
+    }
+    range->hashLast = hashPrev;
+    range->nHeightLast = nHeight;
+    range->nBitsLast = nBitsPrev;
+    nBuffered += chunk.headers.size();
+    range->chunks.push_back(std::move(chunk));
+
+    if (range->IsComplete()) {
+        // The headers chain up to the checkpoint at its end, which tells the
+        // difficulty the next range starts with
+        range->fStartChecked = true;
+        Unassign(*range, false);
+        CheckRangeStart(range->nHeightEnd, nBitsPrev, consensusParams);
+        return Result::DONE;
+    }
+    if (headers.size() < MAX_HEADERS_RESULTS) {
+        // The peer doesn't have the rest of the range, leave it to another one
+        Unassign(*range, true);
+        return Result::DONE;
+    }
+    Unassign(*range, false);
+    if (!range->fStartChecked) {
+        // Headers after a checkpoint of unknown difficulty may have any
+        // difficulty, don't buffer more of them until that is known
+        return Result::DONE;
+    }
+    if (!HaveRoomForRequest(node)) {
+        // Leave the rest of the range for when the buffered headers were handed out
+        return Result::DONE;
+    }
+    range->nodeAssigned = node;
+    range->nTimeRequested = nNow;
+    hashFrom = range->hashLast;
+    hashStop = range->hashEnd;
+    return Result::REQUEST_MORE;
+}
+
+bool CHeadersRangeSync::PopHeaders(const std::function<bool(const uint256&)>& fHaveHeader, std::vector<CBlockHeader>& headers, NodeId& node, int& nRange)
+{
+    for (auto it = vRanges.begin(); it != vRanges.end();) {
+        Range& range = *it;
+        if (fHaveHeader(range.hashEnd)) {
+            // Everything up to the end of the range is known already
+            for (const HeadersChunk& chunk : range.chunks) {
+                nBuffered -= chunk.headers.size();
+            }
+            it = vRanges.erase(it);
+            continue;
+        }
+        if (!range.chunks.empty() && fHaveHeader(range.chunks.front().headers.front().hashPrevBlock)) {
+            HeadersChunk& chunk = range.chunks.front();
+            range.hashPopped = chunk.headers.front().hashPrevBlock;
+            range.nHeightPopped = chunk.nHeightPrev;
+            range.nBitsPopped = chunk.nBitsPrev;
+            // The caller validates the headers after the checkpoint
+            range.fStartChecked = true;
+            headers = std::move(chunk.headers);
+            node = chunk.node;
+            nRange = range.nHeightStart;
+            nBuffered -= headers.size();
+            range.chunks.pop_front();
+            return true;
+        }
+        ++it;
+    }
+    return false;
+}
+
+void CHeadersRangeSync::RejectHeaders(int nRange, NodeId node)
+{
+    for (Range& range : vRanges) {
+        if (range.nHeightStart != nRange)
+            continue;
+        for (const HeadersChunk& chunk : range.chunks) {
+            nBuffered -= chunk.headers.size();
+        }
+        range.chunks.clear();
+        range.hashLast = range.hashPopped;
+        range.nHeightLast = range.nHeightPopped;
+        range.nBitsLast = range.nBitsPopped;
+        if (range.nHeightPopped == range.nHeightStart && range.nBitsPopped == 0)
+            range.fStartChecked = false;
+        range.setFailed.insert(node);
+        if (range.nodeAssigned != -1)
+            Unassign(range, false);
+        return;
+    }
+}
+
+void CHeadersRangeSync::CheckRangeStart(int nHeight, uint32_t nBits, const Consensus::Params& consensusParams)
+{
+    for (Range& range : vRanges) {
+        if (range.nHeightStart != nHeight)
+            continue;
+        if (range.fStartChecked)
+            return;
+        range.fStartChecked = true;
+        if (range.nHeightPopped == range.nHeightStart)
+            range.nBitsPopped = nBits;
+        if (range.nHeightLast == range.nHeightStart) {
+            range.nBitsLast = nBits;
+            return;
+        }
+        HeadersChunk& chunk = range.chunks.front();
+        if (PermittedDifficultyTransition(consensusParams, nHeight + 1, nBits, chunk.headers.front().nBits)) {
+            chunk.nBitsPrev = nBits;
+            return;
+        }
+        // The peer sent headers that can't follow the checkpoint
+        range.setFailed.insert(chunk.node);
+        for (const HeadersChunk& chunkDropped : range.chunks) {
+            nBuffered -= chunkDropped.headers.size();
+        }
+        range.chunks.clear();
+        range.hashLast = range.hashPopped;
+        range.nHeightLast = range.nHeightPopped;
+        range.nBitsLast = nBits;
+        return;
+    }
+}
+
+void CHeadersRangeSync::ExpireRequests(int64_t nTimeCutoff)
+{
+    for (Range& range : vRanges) {
+        if (range.nodeAssigned != -1 && range.nTimeRequested < nTimeCutoff)
+            Unassign(range, true);
+    }
+}
+
+void CHeadersRangeSync::NodeDisconnected(NodeId node)
+{
+    Range* range = FindAssigned(node);
+    if (range != nullptr)
+        Unassign(*range, false);
+}
@@ -0,0 +1,126 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_HEADERSSYNC_H
+#define BITCOIN_HEADERSSYNC_H
+
+#include <chainparams.h>
+#include <consensus/params.h>
+#include <net.h>
+#include <primitives/block.h>
+#include <uint256.h>
+
+#include <deque>
+#include <functional>
+#include <set>
+#include <vector>
+
+/**
+ * Splits the initial headers download into ranges between consecutive
+ * checkpoints, so that while headers are fetched from the sync peer one
+ * getheaders round trip after the other, other peers can each fetch a range
+ * further ahead at the same time.
+ *
+ * Headers received for a range are checked to form a chain from the
+ * checkpoint it starts at, each with valid proof of work and a difficulty
+ * that could follow the one before it, and are buffered until the headers
+ * before them are known. They are then handed out in chain order, to be
+ * validated like any other headers. The difficulty of a checkpoint is only
+ * known once the range ending at it was received, or the headers after it
+ * were handed out and validated; until then only one response is buffered
+ * for the range starting at it. The headers buffered and requested are
+ * bounded across all peers, and for each peer. Not thread safe, the caller
+ * must serialize access.
+ */
+class CHeadersRangeSync
+{
+public:
+    enum class Result {
+        NOT_IN_RANGE,   //!< The headers don't continue the range requested from this peer
+        INVALID,        //!< The headers continue the range, but one of them is invalid or they don't form a chain to its end
+        REQUEST_MORE,   //!< The headers were added, request the next ones of the range
+        DONE,           //!< The headers were added, nothing more to request from this peer
+    };
+
+    /**
+     * Set up a range between each pair of consecutive checkpoints above
+     * nHeight. At most nMaxBuffered headers are buffered and requested at
+     * any time, and at most nMaxBufferedPerPeer from any one peer.
+     */
+    void Init(const MapCheckpoints& checkpoints, int nHeight, size_t nMaxBuffered, size_t nMaxBufferedPerPeer);
+
+    /**
+     * Assign the lowest range that nothing is requested for yet to a peer,
+     * that claims to have nPeerHeight headers and did not fail to send the
+     * range before. Only ranges starting at most nMaxHeight are assigned,
+     * and only while the headers buffered and requested, in total and from
+     * this peer, leave room for the response.
+     * @param[out]  hashFrom    The locator to request headers from
+     * @param[out]  hashStop    The last header to request
+     */
+    bool AssignRange(NodeId node, int nPeerHeight, int nMaxHeight, int64_t nNow, uint256& hashFrom, uint256& hashStop);
+
+    //! Add headers a peer sent for the range assigned to it, see Result
+    Result ProcessHeaders(NodeId node, const std::vector<CBlockHeader>& headers, const Consensus::Params& consensusParams, int64_t nNow, uint256& hashFrom, uint256& hashStop);
+
+    /**
+     * Take the next buffered headers whose predecessor fHaveHeader knows,
+     * along with the peer they came from.
+     * @param[out]  nRange      Identifies the range for RejectHeaders
+     */
+    bool PopHeaders(const std::function<bool(const uint256&)>& fHaveHeader, std::vector<CBlockHeader>& headers, NodeId& node, int& nRange);
+
+    //! Drop the headers buffered for a range after the ones taken from it, sent by node, were invalid
+    void RejectHeaders(int nRange, NodeId node);
+
+    //! Stop waiting for requests older than nTimeCutoff, and don't retry them with the same peers
+    void ExpireRequests(int64_t nTimeCutoff);
+
+    void NodeDisconnected(NodeId node);
+
+    bool IsAssigned(NodeId node) const;
+    size_t GetRangeCount() const { return vRanges.size(); }
+    size_t GetBufferedCount() const { return nBuffered; }
+
+private:
+    struct HeadersChunk {
+        NodeId node;
+        int nHeightPrev;
+        uint32_t nBitsPrev;
+        std::vector<CBlockHeader> headers;
+    };
+
+    struct Range {
+        int nHeightStart;
+        uint256 hashEnd;
+        int nHeightEnd;
+        uint256 hashLast;       //!< Last header received, or the starting checkpoint
+        int nHeightLast;
+        uint32_t nBitsLast;     //!< Difficulty of the last header received, 0 for the checkpoint while unknown
+        uint256 hashPopped;     //!< Predecessor of the last headers handed out
+        int nHeightPopped;
+        uint32_t nBitsPopped;
+        bool fStartChecked;     //!< Whether the first header after the checkpoint is known to follow its difficulty
+        std::deque<HeadersChunk> chunks;
+        NodeId nodeAssigned;
+        int64_t nTimeRequested;
+        std::set<NodeId> setFailed;
+
+        bool IsComplete() const { return hashLast == hashEnd; }
+    };
+
+    Range* FindAssigned(NodeId node);
+    void Unassign(Range& range, bool fFailed);
+    //! Whether another response of MAX_HEADERS_RESULTS headers from node fits, on top of the buffered and requested ones
+    bool HaveRoomForRequest(NodeId node) const;
+    //! Check the headers of the range starting at nHeight against the difficulty of its checkpoint, once that is known
+    void CheckRangeStart(int nHeight, uint32_t nBits, const Consensus::Params& consensusParams);
+
+    std::vector<Range> vRanges;
+    size_t nBuffered = 0;
+    size_t nMaxBuffered = 0;
+    size_t nMaxBufferedPerPeer = 0;
+};
+
+#endif // BITCOIN_HEADERSSYNC_H
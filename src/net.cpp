@@ -24,6 +24,11 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
 #endif
 
 #ifdef USE_UPNP
@@ -42,6 +47,9 @@
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent synchronization.
 #define FEELER_SLEEP_WINDOW 1
 
+// Maximum number of queued buffers handed to a single sendmsg() call.
+#define MAX_SEND_IOVECS 64
+
 #if !defined(HAVE_MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -746,16 +754,22 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
 
         CNetMessage& msg = vRecvMsg.back();
 
         // absorb network data
         int handled;
-        if (!msg.in_data)
+        if (!msg.in_data) {
             handled = msg.readHeader(pch, nBytes);
-        else
+            // The receive version is final once the handshake is done
+            if (msg.in_data && fSuccessfullyConnected)
+                msg.StartParse(GetRecvVersion());
+        } else {
             handled = msg.readData(pch, nBytes);
+            // Bound the work done here, this thread serves all sockets
+            msg.Parse(MAX_RECV_PARSE_BYTES);
+        }
 
         if (handled < 0)
             return false;
@@ -813,6 +827,93 @@ int CNode::GetSendVersion() const
 }
 
 
+namespace {
+
+/**
+ * Receive buffers of processed messages, kept for reuse by the messages
+ * received next so that busy connections don't allocate, and cleanse
+ * when freeing, a buffer for every message.
+ */
+class CRecvBufferPool
+{
+public:
+    void Get(CDataStream& stream)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!vBuffers.empty()) {
+            nBytes -= vBuffers.back().capacity();
+            stream.swap(vBuffers.back());
+            vBuffers.pop_back();
+        }
+    }
+
+    void Put(CDataStream& stream)
+    {
+        CSerializeData buffer;
+        stream.swap(buffer);
+        if (buffer.capacity() == 0 || buffer.capacity() > MAX_BUFFER_SIZE)
+            return;
+        buffer.clear();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (nBytes + buffer.capacity() > MAX_POOL_SIZE)
+            return;
+        nBytes += buffer.capacity();
+        vBuffers.push_back(std::move(buffer));
+    }
+
+private:
+    //! Larger buffers are freed; only messages that aren't deserialized while received need them
+    static const size_t MAX_BUFFER_SIZE = 1024 * 1024;
+    static const size_t MAX_POOL_SIZE = 16 * 1024 * 1024;
+
+    std::mutex mutex;
+    std::vector<CSerializeData> vBuffers;
+    size_t nBytes = 0;
+};
+
+CRecvBufferPool g_recv_buffer_pool;
+
+/** Stream over the part of a message that has been received so far. */
+class CPartialReader
+{
+public:
+    CPartialReader(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn) :
+        pbegin(pbeginIn), pcur(pbeginIn), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+    size_t GetPos() const { return pcur - pbegin; }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pcur))
+            throw std::ios_base::failure("CPartialReader::read(): end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+    }
+
+    template<typename T>
+    CPartialReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj);
+        return *this;
+    }
+
+private:
+    const char* const pbegin;
+    const char* pcur;
+    const char* const pend;
+    const int nType;
+    const int nVersion;
+};
+
+} // namespace
+
+CNetMessage::~CNetMessage()
+{
+    g_recv_buffer_pool.Put(vRecv);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -840,6 +941,8 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 
     // switch state to reading message data
     in_data = true;
+    if (hdr.nMessageSize > 0)
+        g_recv_buffer_pool.Get(vRecv);
 
     return nCopy;
 }
@@ -849,18 +952,154 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+    hasher.Write((const unsigned char*)pch, nCopy);
+    if (fParseDone) {
+        // trailing bytes after the deserialized payload, nobody reads them
+        nDataPos += nCopy;
+        nParsePos += nCopy;
+        return nCopy;
     }
 
-    hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    unsigned int nBufferPos = nDataPos - nParsePos;
+    if (vRecv.size() < nBufferPos + nCopy) {
+        if (nParseType != PARSE_NONE) {
+            // Only holds the bytes not deserialized yet
+            vRecv.resize(nBufferPos + nCopy);
+        } else {
+            // Allocate up to 256 KiB ahead, but never more than the total message size.
+            vRecv.resize(std::min(hdr.nMessageSize, nBufferPos + nCopy + 256 * 1024));
+        }
+    }
+
+    memcpy(&vRecv[nBufferPos], pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+void CNetMessage::StartParse(int nVersion)
+{
+    const std::string strCommand = hdr.GetCommand();
+    if (strCommand == NetMsgType::BLOCK) {
+        nParseType = PARSE_BLOCK;
+    } else if (strCommand == NetMsgType::HEADERS) {
+        nParseType = PARSE_HEADERS;
+    } else {
+        return;
+    }
+    nParseVersion = nVersion;
+}
+
+void CNetMessage::Parse(unsigned int nMaxBytes)
+{
+    if (nParseType == PARSE_NONE || fParseDone)
+        return;
+    if (nDataPos < nParseRetryPos && !complete())
+        return;
+
+    const unsigned int nAvailable = nDataPos - nParsePos;
+    const bool fLimited = nAvailable > nMaxBytes;
+    CPartialReader s(vRecv.data(), vRecv.data() + std::min(nAvailable, nMaxBytes), SER_NETWORK, nParseVersion);
+    size_t nParsed = 0;
+    try {
+        while (nParseItemsLeft > 0 || !fParsePrefix) {
+            if (!fParsePrefix) {
+                if (nParseType == PARSE_BLOCK) {
+                    CBlockHeader header;
+                    s >> header;
+                    nParseItemsLeft = ReadCompactSize(s);
+                    pblockParsed = std::make_shared<CBlock>(header);
+                } else {
+                    nParseItemsLeft = ReadCompactSize(s);
+                    if (nParseItemsLeft > MAX_HEADERS_RESULTS) {
+                        // Leave oversized headers messages to the message handler
+                        nParseType = PARSE_NONE;
+                        return;
+                    }
+                    vHeadersParsed.reserve(nParseItemsLeft);
+                }
+                fParsePrefix = true;
+            } else if (nParseType == PARSE_BLOCK) {
+                CTransactionRef tx;
+                s >> tx;
+                pblockParsed->vtx.push_back(std::move(tx));
+                nParseItemsLeft--;
+            } else {
+                CBlockHeader header;
+                s >> header;
+                ReadCompactSize(s); // ignore tx count; assume it is 0.
+                vHeadersParsed.push_back(header);
+                nParseItemsLeft--;
+            }
+            nParsed = s.GetPos();
+        }
+        fParseDone = true;
+    } catch (const std::ios_base::failure& e) {
+        if (fLimited && strstr(e.what(), "end of data")) {
+            // Out of budget. Continue with the next bytes received, unless
+            // this object alone exceeds the budget; then leave it and the
+            // rest of the message to TakeParsed.
+            if (nParsed == 0)
+                nParseRetryPos = hdr.nMessageSize;
+        } else if (!complete() && strstr(e.what(), "end of data")) {
+            // Wait for the rest of this object. Retrying only once the
+            // unparsed bytes doubled keeps the work linear in its size.
+            nParseRetryPos = nDataPos + (nAvailable - nParsed);
+        } else {
+            strParseError = e.what();
+            fParseErrorIO = true;
+            fParseDone = true;
+        }
+    } catch (const std::exception& e) {
+        strParseError = e.what();
+        fParseDone = true;
+    }
+
+    // Drop the bytes that were deserialized
+    nParsePos += nParsed;
+    if (fParseDone) {
+        nParsePos = nDataPos;
+        vRecv.clear();
+    } else if (nParsed > 0) {
+        vRecv.erase(vRecv.begin(), vRecv.begin() + nParsed);
+        vRecv.Compact();
+    }
+}
+
+bool CNetMessage::TakeParsed(std::shared_ptr<CBlock>& pblock)
+{
+    if (nParseType != PARSE_BLOCK)
+        return false;
+    Parse(std::numeric_limits<unsigned int>::max());
+    if (!strParseError.empty()) {
+        if (fParseErrorIO)
+            throw std::ios_base::failure(strParseError);
+        throw std::runtime_error(strParseError);
+    }
+    assert(fParseDone);
+    pblock = std::move(pblockParsed);
+    return true;
+}
+
+bool CNetMessage::TakeParsed(std::vector<CBlockHeader>& headers)
+{
+    if (nParseType != PARSE_HEADERS)
+        return false;
+    Parse(std::numeric_limits<unsigned int>::max());
+    if (nParseType != PARSE_HEADERS) {
+        // Too many headers, left in vRecv
+        return false;
+    }
+    if (!strParseError.empty()) {
+        if (fParseErrorIO)
+            throw std::ios_base::failure(strParseError);
+        throw std::runtime_error(strParseError);
+    }
+    assert(fParseDone);
+    headers = std::move(vHeadersParsed);
+    return true;
+}
+
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
@@ -884,27 +1123,55 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        assert((*it)->size() > pnode->nSendOffset);
+        size_t nRequested = 0;
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            const auto &data = **it;
+            nRequested = data.size() - pnode->nSendOffset;
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, nRequested, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            // Gather the queued buffers, so that headers and payloads of
+            // several messages go out with a single system call
+            struct iovec iov[MAX_SEND_IOVECS];
+            int nIov = 0;
+            size_t nOffset = pnode->nSendOffset;
+            for (auto itIov = it; itIov != pnode->vSendMsg.end() && nIov < MAX_SEND_IOVECS; ++itIov, ++nIov) {
+                iov[nIov].iov_base = const_cast<unsigned char*>((*itIov)->data()) + nOffset;
+                iov[nIov].iov_len = (*itIov)->size() - nOffset;
+                nRequested += iov[nIov].iov_len;
+                nOffset = 0;
+            }
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = nIov;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Drop the buffers that were sent completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                const size_t nRemaining = (*it)->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                pnode->nSendSize -= (*it)->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nRequested) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -1103,7 +1370,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1148,6 +1415,188 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+void CConnman::SocketEventsSelect()
+{
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes)
+        {
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer, select() for
+            //   receiving data.
+            // * Hand off all complete messages to the processor, to be handled without
+            //   blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
+            {
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
+
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            if (!IsSelectableSocket(pnode->hSocket)) {
+                // Only possible for outbound sockets when connection setup
+                // does not use select() itself
+                LogPrintf("disconnecting peer=%d: non-selectable socket\n", pnode->GetId());
+                pnode->fDisconnect = true;
+                continue;
+            }
+
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = std::max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+
+            if (select_send) {
+                FD_SET(pnode->hSocket, &fdsetSend);
+                continue;
+            }
+            if (select_recv) {
+                FD_SET(pnode->hSocket, &fdsetRecv);
+            }
+        }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet)
+        return;
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
+            return;
+    }
+
+    for (ListenSocket& hListenSocket : vhListenSocket) {
+        hListenSocket.fAcceptReady = hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv);
+    }
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes)
+        {
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET || !IsSelectableSocket(pnode->hSocket))
+                continue;
+            pnode->fRecvReady = FD_ISSET(pnode->hSocket, &fdsetRecv);
+            pnode->fSendReady = FD_ISSET(pnode->hSocket, &fdsetSend);
+            pnode->fErrorReady = FD_ISSET(pnode->hSocket, &fdsetError);
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+void CConnman::SocketEventsEpoll()
+{
+    // Register sockets of new nodes. Readiness reported by earlier events is
+    // kept on the nodes (edge-triggered), so don't block if some node can
+    // still make progress with it.
+    bool fPending = false;
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes)
+        {
+            bool fSendPending;
+            {
+                LOCK(pnode->cs_vSend);
+                fSendPending = !pnode->vSendMsg.empty();
+            }
+
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            if (!pnode->fEventsRegistered) {
+                struct epoll_event event = {};
+                event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                event.data.ptr = pnode;
+                if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) == SOCKET_ERROR) {
+                    LogPrintf("disconnecting peer=%d: epoll_ctl failed: %s\n", pnode->GetId(), NetworkErrorString(WSAGetLastError()));
+                    pnode->fDisconnect = true;
+                    continue;
+                }
+                // Closing the socket removes it from the epoll set again.
+                pnode->fEventsRegistered = true;
+            }
+            if (pnode->fErrorReady || (fSendPending ? pnode->fSendReady : (pnode->fRecvReady && !pnode->fPauseRecv)))
+                fPending = true;
+        }
+    }
+
+    struct epoll_event events[256];
+    int nEvents = epoll_wait(epollfd, events, ARRAYLEN(events), fPending ? 0 : 50);
+    if (interruptNet)
+        return;
+
+    for (ListenSocket& hListenSocket : vhListenSocket) {
+        hListenSocket.fAcceptReady = false;
+    }
+    if (nEvents == SOCKET_ERROR)
+    {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(50));
+        }
+        return;
+    }
+
+    // Nodes can't be deleted between epoll_wait and here: that only happens
+    // on this thread, after their socket was closed and thus deregistered.
+    for (int i = 0; i < nEvents; i++) {
+        CNode* pnode = static_cast<CNode*>(events[i].data.ptr);
+        if (pnode == nullptr) {
+            // Listen sockets are registered without a node; there are only a
+            // few, so just try all of them.
+            for (ListenSocket& hListenSocket : vhListenSocket) {
+                hListenSocket.fAcceptReady = true;
+            }
+            continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+            pnode->fRecvReady = true;
+        if (events[i].events & EPOLLOUT)
+            pnode->fSendReady = true;
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+            pnode->fErrorReady = true;
+    }
+}
+#endif
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -1217,91 +1666,21 @@ void CConnman::ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes)
-            {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+#ifdef USE_EPOLL
+        if (socketEventsMode == SOCKETEVENTS_EPOLL)
+            SocketEventsEpoll();
+        else
+#endif
+            SocketEventsSelect();
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
-        }
-
         //
         // Accept new connections
         //
-        for (const ListenSocket& hListenSocket : vhListenSocket)
+        for (ListenSocket& hListenSocket : vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && hListenSocket.fAcceptReady)
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1325,16 +1704,24 @@ void CConnman::ThreadSocketHandler()
             //
             // Receive
             //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
             {
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+            }
+            bool recvSet = pnode->fRecvReady;
+            bool sendSet = pnode->fSendReady;
+            bool errorSet = pnode->fErrorReady;
+            if (socketEventsMode != SOCKETEVENTS_SELECT) {
+                // Readiness is remembered across iterations, so apply the
+                // rules SocketEventsSelect uses to pick the sockets to wait on.
+                bool fSendPending;
+                {
+                    LOCK(pnode->cs_vSend);
+                    fSendPending = !pnode->vSendMsg.empty();
+                }
+                sendSet = sendSet && fSendPending;
+                recvSet = recvSet && !fSendPending && !pnode->fPauseRecv;
             }
             if (recvSet || errorSet)
             {
@@ -1347,6 +1734,12 @@ void CConnman::ThreadSocketHandler()
                         continue;
                     nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
                 }
+                // A short read drained the socket; more data arriving later
+                // is reported as a new event.
+                if (nBytes < (int)sizeof(pchBuf))
+                    pnode->fRecvReady = false;
+                if (nBytes <= 0)
+                    pnode->fErrorReady = false;
                 if (nBytes > 0)
                 {
                     bool notify = false;
@@ -1359,7 +1752,7 @@ void CConnman::ThreadSocketHandler()
                         for (; it != pnode->vRecvMsg.end(); ++it) {
                             if (!it->complete())
                                 break;
-                            nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+                            nSizeAdded += it->hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
                         }
                         {
                             LOCK(pnode->cs_vProcessMsg);
@@ -1367,7 +1760,7 @@ void CConnman::ThreadSocketHandler()
                             pnode->nProcessQueueSize += nSizeAdded;
                             pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
                         }
-                        WakeMessageHandler();
+                        WakeMessageHandler(pnode->GetId());
                     }
                 }
                 else if (nBytes == 0)
@@ -1401,6 +1794,10 @@ void CConnman::ThreadSocketHandler()
                 if (nBytes) {
                     RecordBytesSent(nBytes);
                 }
+                // Data left over means the socket buffer is full; wait for
+                // it to become writable again.
+                if (!pnode->vSendMsg.empty())
+                    pnode->fSendReady = false;
             }
 
             //
@@ -1446,11 +1843,28 @@ void CConnman::ThreadSocketHandler()
 
 void CConnman::WakeMessageHandler()
 {
+    const int nThreads = nMsgProcThreads;
+    for (int i = 0; i < nThreads; i++) {
+        MessageHandlerThread& handler = vMessageHandlers[i];
+        {
+            std::lock_guard<std::mutex> lock(handler.mutexMsgProc);
+            handler.fMsgProcWake = true;
+        }
+        handler.condMsgProc.notify_one();
+    }
+}
+
+void CConnman::WakeMessageHandler(NodeId id)
+{
+    const int nThreads = nMsgProcThreads;
+    if (nThreads == 0)
+        return;
+    MessageHandlerThread& handler = vMessageHandlers[id % nThreads];
     {
-        std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        std::lock_guard<std::mutex> lock(handler.mutexMsgProc);
+        handler.fMsgProcWake = true;
     }
-    condMsgProc.notify_one();
+    handler.condMsgProc.notify_one();
 }
 
 
@@ -1991,16 +2405,23 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     }
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nThread)
 {
+    MessageHandlerThread& handler = vMessageHandlers[nThread];
+    const NodeId nThreads = nMsgProcThreads;
+
     while (!flagInterruptMsgProc)
     {
+        // Only process the nodes assigned to this thread
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
+            vNodesCopy.reserve(vNodes.size() / nThreads + 1);
+            for (CNode* pnode : vNodes) {
+                if (pnode->GetId() % nThreads != nThread)
+                    continue;
                 pnode->AddRef();
+                vNodesCopy.push_back(pnode);
             }
         }
 
@@ -2032,11 +2453,11 @@ void CConnman::ThreadMessageHandler()
                 pnode->Release();
         }
 
-        std::unique_lock<std::mutex> lock(mutexMsgProc);
+        std::unique_lock<std::mutex> lock(handler.mutexMsgProc);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            handler.condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [&handler] { return handler.fMsgProcWake; });
         }
-        fMsgProcWake = false;
+        handler.fMsgProcWake = false;
     }
 }
 
@@ -2202,7 +2623,11 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nSendBufferMaxSize = 0;
     nReceiveFloodSize = 0;
     flagInterruptMsgProc = false;
+    nMsgProcThreads = 0;
     SetTryNewOutboundPeer(false);
+#ifdef USE_EPOLL
+    epollfd = -1;
+#endif
 
     Options connOptions;
     Init(connOptions);
@@ -2268,6 +2693,27 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         return false;
     }
 
+#ifdef USE_EPOLL
+    if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        bool fEpollOK = epollfd != -1;
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.ptr = nullptr;
+            fEpollOK = fEpollOK && epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != SOCKET_ERROR;
+        }
+        if (!fEpollOK) {
+            if (clientInterface) {
+                clientInterface->ThreadSafeMessageBox(
+                    strprintf(_("Failed to set up epoll: %s. Use -socketevents=select if you want to use select()."), NetworkErrorString(WSAGetLastError())),
+                    "", CClientUIInterface::MSG_ERROR);
+            }
+            return false;
+        }
+    }
+#endif
+
     for (const auto& strDest : connOptions.vSeedNodes) {
         AddOneShot(strDest);
     }
@@ -2327,9 +2773,9 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
     interruptNet.reset();
     flagInterruptMsgProc = false;
 
-    {
-        std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+    for (MessageHandlerThread& handler : vMessageHandlers) {
+        std::unique_lock<std::mutex> lock(handler.mutexMsgProc);
+        handler.fMsgProcWake = false;
     }
 
     // Send and receive from sockets, accept connections
@@ -2355,7 +2801,10 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMsgProcThreads; i++) {
+        vMessageHandlers[i].thread = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i)));
+    }
+    LogPrintf("Using %d message processing threads\n", nMsgProcThreads);
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000);
@@ -2380,11 +2829,12 @@ instance_of_cnetcleanup;
 
 void CConnman::Interrupt()
 {
-    {
-        std::lock_guard<std::mutex> lock(mutexMsgProc);
-        flagInterruptMsgProc = true;
+    flagInterruptMsgProc = true;
+    for (MessageHandlerThread& handler : vMessageHandlers) {
+        // Take the lock so a thread about to wait can't miss the interrupt
+        std::lock_guard<std::mutex> lock(handler.mutexMsgProc);
+        handler.condMsgProc.notify_all();
     }
-    condMsgProc.notify_all();
 
     interruptNet();
     InterruptSocks5(true);
@@ -2404,8 +2854,10 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (MessageHandlerThread& handler : vMessageHandlers) {
+        if (handler.thread.joinable())
+            handler.thread.join();
+    }
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2441,6 +2893,12 @@ void CConnman::Stop()
     vhListenSocket.clear();
     semOutbound.reset();
     semAddnode.reset();
+#ifdef USE_EPOLL
+    if (epollfd != -1) {
+        close(epollfd);
+        epollfd = -1;
+    }
+#endif
 }
 
 void CConnman::DeleteNode(CNode* pnode)
@@ -2740,6 +3198,10 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    fEventsRegistered = false;
+    fRecvReady = false;
+    fSendReady = false;
+    fErrorReady = false;
     nProcessQueueSize = 0;
 
     for (const std::string &msg : getAllNetMessageTypes())
@@ -2797,11 +3259,9 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
-void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+CSharedNetMsg CConnman::PrepareMessage(CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
-    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
+    const size_t nMessageSize = msg.data.size();
 
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
@@ -2811,6 +3271,73 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
 
+    CSharedNetMsg shared;
+    shared.header = std::make_shared<const std::vector<unsigned char>>(std::move(serializedHeader));
+    if (nMessageSize)
+        shared.data = std::make_shared<const std::vector<unsigned char>>(std::move(msg.data));
+    shared.command = std::move(msg.command);
+    return shared;
+}
+
+CSharedNetMsg CSharedNetMsgCache::Find(const CInv& inv)
+{
+    LOCK(cs);
+    auto it = mapEntries.find(inv);
+    if (it == mapEntries.end())
+        return CSharedNetMsg();
+    lruEntries.splice(lruEntries.begin(), lruEntries, it->second);
+    return it->second->second;
+}
+
+void CSharedNetMsgCache::Insert(const CInv& inv, const CSharedNetMsg& msg)
+{
+    const size_t nMsgSize = msg.GetSize();
+    if (msg.IsNull() || nMsgSize > nMaxSize)
+        return;
+    LOCK(cs);
+    if (mapEntries.count(inv))
+        return;
+    lruEntries.emplace_front(inv, msg);
+    mapEntries.emplace(inv, lruEntries.begin());
+    nSize += nMsgSize;
+    while (nSize > nMaxSize) {
+        nSize -= lruEntries.back().second.GetSize();
+        mapEntries.erase(lruEntries.back().first);
+        lruEntries.pop_back();
+    }
+}
+
+void CSharedNetMsgCache::Clear()
+{
+    LOCK(cs);
+    mapEntries.clear();
+    lruEntries.clear();
+    nSize = 0;
+}
+
+size_t CSharedNetMsgCache::GetSize() const
+{
+    LOCK(cs);
+    return nSize;
+}
+
+size_t CSharedNetMsgCache::GetCount() const
+{
+    LOCK(cs);
+    return mapEntries.size();
+}
+
+void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+{
+    PushMessage(pnode, PrepareMessage(std::move(msg)));
+}
+
+void CConnman::PushMessage(CNode* pnode, const CSharedNetMsg& msg)
+{
+    size_t nMessageSize = msg.data ? msg.data->size() : 0;
+    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
+    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
+
     size_t nBytesSent = 0;
     {
         LOCK(pnode->cs_vSend);
@@ -2822,9 +3349,9 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
+        pnode->vSendMsg.push_back(msg.header);
         if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+            pnode->vSendMsg.push_back(msg.data);
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
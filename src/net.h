@@ -15,6 +15,7 @@
 #include <limitedmap.h>
 #include <netaddress.h>
 #include <policy/feerate.h>
+#include <primitives/block.h>
 #include <protocol.h>
 #include <random.h>
 #include <streams.h>
@@ -24,6 +25,8 @@
 
 #include <atomic>
 #include <deque>
+#include <list>
+#include <map>
 #include <stdint.h>
 #include <thread>
 #include <memory>
@@ -53,6 +56,8 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 4 MB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 4 * 1000 * 1000;
+/** Maximum number of payload bytes deserialized by the socket thread per receive; the message handler deserializes the rest. */
+static const unsigned int MAX_RECV_PARSE_BYTES = 128 * 1024;
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** Maximum number of automatic outgoing nodes */
@@ -83,6 +88,16 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** -socketevents default */
+#ifdef USE_EPOLL
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+/** -msgprocthreads default */
+static const int DEFAULT_MSGPROC_THREADS = 1;
+/** Maximum number of message processing threads */
+static const int MAX_MSGPROC_THREADS = 16;
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
@@ -113,6 +128,55 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/** Serialized message bytes queued for sending. Shared by the send queues of
+ *  all nodes the message is pushed to, so it is never modified once built. */
+typedef std::shared_ptr<const std::vector<unsigned char>> CSendBuffer;
+
+/**
+ * A message with its header (and payload checksum) already built, that can
+ * be pushed to any number of nodes without copying or hashing the payload
+ * again. Created by CConnman::PrepareMessage.
+ */
+struct CSharedNetMsg
+{
+    CSendBuffer header;
+    CSendBuffer data; //!< Null for messages without payload
+    std::string command;
+
+    bool IsNull() const { return !header; }
+    size_t GetSize() const { return (header ? header->size() : 0) + (data ? data->size() : 0); }
+};
+
+/**
+ * Recently prepared messages for objects that are served to many peers, such
+ * as relayed transactions and new blocks, so each wire form is only
+ * serialized once. The inv type says which form a message is (e.g.
+ * MSG_TX or MSG_WITNESS_TX), the caller picks a hash that determines its
+ * contents. The least recently used messages are dropped once the total
+ * size exceeds the limit.
+ */
+class CSharedNetMsgCache
+{
+public:
+    explicit CSharedNetMsgCache(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn) {}
+
+    //! Return the message cached for inv, or a null message
+    CSharedNetMsg Find(const CInv& inv);
+    void Insert(const CInv& inv, const CSharedNetMsg& msg);
+    void Clear();
+    size_t GetSize() const;
+    size_t GetCount() const;
+
+private:
+    typedef std::list<std::pair<CInv, CSharedNetMsg>> EntryList;
+
+    mutable CCriticalSection cs;
+    EntryList lruEntries GUARDED_BY(cs); //!< Most recently used first
+    std::map<CInv, EntryList::iterator> mapEntries GUARDED_BY(cs);
+    size_t nSize GUARDED_BY(cs) = 0;
+    const size_t nMaxSize;
+};
+
 class NetEventsInterface;
 class CConnman
 {
@@ -125,6 +189,12 @@ public:
         CONNECTIONS_ALL = (CONNECTIONS_IN | CONNECTIONS_OUT),
     };
 
+    /** How ThreadSocketHandler waits for socket readiness */
+    enum SocketEventsMode {
+        SOCKETEVENTS_SELECT = 0, //!< select() on fd_sets rebuilt every iteration; limited to FD_SETSIZE
+        SOCKETEVENTS_EPOLL = 1,  //!< Persistent edge-triggered epoll registrations (Linux only)
+    };
+
     struct Options
     {
         ServiceFlags nLocalServices = NODE_NONE;
@@ -145,6 +215,8 @@ public:
         bool m_use_addrman_outgoing = true;
         std::vector<std::string> m_specified_outgoing;
         std::vector<std::string> m_added_nodes;
+        SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
+        int nMsgProcThreads = DEFAULT_MSGPROC_THREADS;
     };
 
     void Init(const Options& connOptions) {
@@ -168,6 +240,8 @@ public:
             LOCK(cs_vAddedNodes);
             vAddedNodes = connOptions.m_added_nodes;
         }
+        socketEventsMode = connOptions.socketEventsMode;
+        nMsgProcThreads = std::max(1, std::min(connOptions.nMsgProcThreads, MAX_MSGPROC_THREADS));
     }
 
     CConnman(uint64_t seed0, uint64_t seed1);
@@ -183,6 +257,10 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    void PushMessage(CNode* pnode, const CSharedNetMsg& msg);
+    /** Build the header of msg and move both into shared buffers, for a
+     *  message that is pushed to several nodes. */
+    static CSharedNetMsg PrepareMessage(CSerializedNetMsg&& msg);
 
     template<typename Callable>
     void ForEachNode(Callable&& func)
@@ -313,13 +391,17 @@ public:
 
     unsigned int GetReceiveFloodSize() const;
 
+    /** Wake all message processing threads. */
     void WakeMessageHandler();
+    /** Wake the message processing thread that handles the given node. */
+    void WakeMessageHandler(NodeId id);
 private:
     struct ListenSocket {
         SOCKET socket;
         bool whitelisted;
+        bool fAcceptReady; //!< Set by the socket events backend when a connection can be accepted
 
-        ListenSocket(SOCKET socket_, bool whitelisted_) : socket(socket_), whitelisted(whitelisted_) {}
+        ListenSocket(SOCKET socket_, bool whitelisted_) : socket(socket_), whitelisted(whitelisted_), fAcceptReady(false) {}
     };
 
     bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
@@ -329,9 +411,18 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nThread);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
+    /** Wait for socket events with select() and set the readiness flags of
+     *  listen sockets and nodes from the result. */
+    void SocketEventsSelect();
+#ifdef USE_EPOLL
+    /** Register new node sockets with epollfd, wait for socket events and
+     *  set the readiness flags they report. Node flags stay set until a
+     *  recv or send shows the socket is drained or full. */
+    void SocketEventsEpoll();
+#endif
     void ThreadDNSAddressSeed();
 
     uint64_t CalculateKeyedNetGroup(const CAddress& ad) const;
@@ -415,14 +506,29 @@ private:
     CClientUIInterface* clientInterface;
     NetEventsInterface* m_msgproc;
 
+    SocketEventsMode socketEventsMode;
+#ifdef USE_EPOLL
+    int epollfd; //!< epoll instance of ThreadSocketHandler, -1 unless socketEventsMode is SOCKETEVENTS_EPOLL
+#endif
+
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
-
-    std::condition_variable condMsgProc;
-    std::mutex mutexMsgProc;
+    /**
+     * Message processing threads. Every node is handled by exactly one of
+     * them (selected by NodeId), so messages from and to a node are still
+     * processed in order while different nodes are served concurrently.
+     */
+    struct MessageHandlerThread {
+        /** flag for waking the message processor. */
+        bool fMsgProcWake = false;
+
+        std::condition_variable condMsgProc;
+        std::mutex mutexMsgProc;
+        std::thread thread;
+    };
+    std::atomic<int> nMsgProcThreads; //!< Number of vMessageHandlers in use, 0 until Start()
+    MessageHandlerThread vMessageHandlers[MAX_MSGPROC_THREADS];
     std::atomic<bool> flagInterruptMsgProc;
 
     CThreadInterrupt interruptNet;
@@ -431,7 +537,6 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -564,18 +669,57 @@ public:
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CDataStream vRecv;              // received message data, from nParsePos on
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
+    /**
+     * Messages that are deserialized while they are received (see
+     * StartParse). Complete transactions and headers are deserialized as
+     * their bytes arrive, up to a bounded amount per receive, and their
+     * bytes are dropped from vRecv, so a large message mostly doesn't hold
+     * both its raw and its deserialized form. Whatever is left when the
+     * message is complete is deserialized by TakeParsed.
+     */
+    enum ParseType {
+        PARSE_NONE,
+        PARSE_BLOCK,
+        PARSE_HEADERS,
+    };
+    ParseType nParseType;
+    int nParseVersion;              // stream version the payload is deserialized with
+    unsigned int nParsePos;         // payload bytes deserialized and dropped from vRecv
+    unsigned int nParseRetryPos;    // nDataPos to reach before retrying an incomplete object
+    bool fParsePrefix;              // block header / item count was read
+    bool fParseDone;                // all items were read or the payload is malformed; further bytes are ignored
+    uint64_t nParseItemsLeft;
+    std::shared_ptr<CBlock> pblockParsed;
+    std::vector<CBlockHeader> vHeadersParsed;
+    std::string strParseError;      // set if the payload turned out to be malformed
+    bool fParseErrorIO;             // strParseError came from a std::ios_base::failure
+
     CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        nParseType = PARSE_NONE;
+        nParseVersion = 0;
+        nParsePos = 0;
+        nParseRetryPos = 0;
+        fParsePrefix = false;
+        fParseDone = false;
+        nParseItemsLeft = 0;
+        fParseErrorIO = false;
     }
+    ~CNetMessage();
+
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    CNetMessage(const CNetMessage&) = delete;
+    CNetMessage& operator=(const CNetMessage&) = delete;
 
     bool complete() const
     {
@@ -594,6 +738,21 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    /** Deserialize block and headers payloads with stream version nVersion
+     *  while they are received. Call once the header was read. */
+    void StartParse(int nVersion);
+    /** Deserialize what can be deserialized of the bytes received so far,
+     *  looking at no more than nMaxBytes of them. */
+    void Parse(unsigned int nMaxBytes);
+    /**
+     * Hand over what was deserialized while the message was received, after
+     * deserializing the rest, or return false if it isn't deserialized this
+     * way. Throws the deserialization error if the payload was malformed,
+     * like deserializing it from vRecv would.
+     */
+    bool TakeParsed(std::shared_ptr<CBlock>& pblock);
+    bool TakeParsed(std::vector<CBlockHeader>& headers);
 };
 
 
@@ -608,7 +767,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CSendBuffer> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -660,6 +819,13 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+
+    // Socket readiness reported by the socket events backend. Only accessed
+    // by ThreadSocketHandler (fEventsRegistered also under cs_hSocket).
+    bool fEventsRegistered;
+    bool fRecvReady;
+    bool fSendReady;
+    bool fErrorReady;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -670,15 +836,18 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
-    std::vector<CAddress> vAddrToSend;
-    CRollingBloomFilter addrKnown;
+    // vAddrToSend and addrKnown are also written by the message processing
+    // threads of other nodes relaying addresses to this one.
+    CCriticalSection cs_addrRelay;
+    std::vector<CAddress> vAddrToSend GUARDED_BY(cs_addrRelay);
+    CBlockedRollingBloomFilter addrKnown GUARDED_BY(cs_addrRelay);
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
     int64_t nNextLocalAddrSend;
 
     // inventory based relay
-    CRollingBloomFilter filterInventoryKnown;
+    CBlockedRollingBloomFilter filterInventoryKnown;
     // Set of transaction ids we still have to announce.
     // They are sorted by the mempool before relay, so the order is not important.
     std::set<uint256> setInventoryTxToSend;
@@ -792,6 +961,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_addrRelay);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -800,6 +970,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrRelay);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] = _addr;
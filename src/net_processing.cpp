@@ -11,6 +11,7 @@
 #include <chainparams.h>
 #include <consensus/validation.h>
 #include <hash.h>
+#include <headerssync.h>
 #include <init.h>
 #include <validation.h>
 #include <merkleblock.h>
@@ -69,6 +70,10 @@ static const int STALE_RELAY_AGE_LIMIT = 30 * 24 * 60 * 60;
 /// limiting block relay. Set to one week, denominated in seconds.
 static const int HISTORICAL_BLOCK_AGE = 7 * 24 * 60 * 60;
 
+/// Maximum total size of the transaction and block messages kept in the
+/// relay message cache, in bytes.
+static const size_t MAX_RELAY_MSG_CACHE_SIZE = 32 * 1000 * 1000;
+
 // Internal stuff
 namespace {
     /** Number of nodes with fSyncStarted. */
@@ -101,9 +106,9 @@ namespace {
      * million to make it highly unlikely for users to have issues with this
      * filter.
      *
-     * Memory used: 1.3 MB
+     * Memory used: 1.0 MB (3 generations of 5093 blocks of 64 bytes)
      */
-    std::unique_ptr<CRollingBloomFilter> recentRejects;
+    std::unique_ptr<CBlockedRollingBloomFilter> recentRejects;
     uint256 hashRecentRejectsChainTip;
 
     /** Blocks that are in flight, and that are in the queue to be downloaded. Protected by cs_main. */
@@ -112,6 +117,7 @@ namespace {
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        int64_t nTimeRequested;                                  //!< When the block was requested (in microseconds)
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -130,13 +136,64 @@ namespace {
     /** When our tip was last updated. */
     std::atomic<int64_t> g_last_tip_update(0);
 
+    /** Ranges of headers downloaded from other peers during initial headers sync. Protected by cs_main. */
+    CHeadersRangeSync g_headers_range_sync;
+    bool g_headers_range_sync_started = false;
+
+    /** Decaying average size of the blocks we requested and received, or 0. Protected by cs_main. */
+    double g_block_download_avg_size = 0;
+
+    /**
+     * Blocks that were in flight from a slow peer and were requested from a
+     * faster one instead, with the slow peer and when it was asked for the
+     * block. Until either copy arrives, the slow peer's is still handled as
+     * requested. Protected by cs_main.
+     */
+    std::map<uint256, std::pair<NodeId, int64_t>> mapBlocksReassigned;
+
     /** Relay map, protected by cs_main. */
     typedef std::map<uint256, CTransactionRef> MapRelay;
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /** Serialized transactions and recent blocks, in the forms peers asked for. */
+    CSharedNetMsgCache g_relay_msg_cache(MAX_RELAY_MSG_CACHE_SIZE);
+
+    /** Mempool data used to order the announcement of a transaction. tx is null if it wasn't in the mempool. */
+    struct TxAnnounceInfo {
+        CTransactionRef tx;
+        CFeeRate feeRate;
+        uint64_t nCountWithAncestors;
+        CAmount nModFee;
+        size_t nTxSize;
+    };
+    typedef std::unordered_map<uint256, TxAnnounceInfo, SaltedTxidHasher> TxAnnounceBatch;
+    /**
+     * Mempool data of the transactions due to be announced, looked up once and
+     * shared by all peers until g_tx_announce_batch_expiry or the next tip
+     * change. Protected by cs_main.
+     */
+    TxAnnounceBatch g_tx_announce_batch;
+    int64_t g_tx_announce_batch_expiry = 0;
+    const CBlockIndex* g_tx_announce_batch_tip = nullptr;
 } // namespace
 
+/**
+ * Return the message cached under inv in g_relay_msg_cache, or prepare the
+ * one make() returns and cache it. inv's hash must determine the message.
+ */
+template <typename Callable>
+static CSharedNetMsg GetRelayMessage(const CInv& inv, Callable make)
+{
+    CSharedNetMsg msg = g_relay_msg_cache.Find(inv);
+    if (msg.IsNull()) {
+        msg = CConnman::PrepareMessage(make());
+        g_relay_msg_cache.Insert(inv, msg);
+    }
+    return msg;
+}
+
 namespace {
 
 struct CBlockReject {
@@ -185,6 +242,19 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Number of blocks we may have in flight from this peer, sized to its download rate.
+    int nBlockDownloadWindow;
+    //! Decaying sums of the size of requested blocks received from this peer and of the time
+    //! (in microseconds) it spent sending them. Their ratio is the peer's download rate.
+    double dBlockDownloadBytes;
+    double dBlockDownloadTime;
+    //! When we last received a requested block from this peer (in microseconds), or 0.
+    int64_t nLastBlockReceived;
+    //! Number of requested blocks received from this peer, and their total size.
+    int nBlocksDownloaded;
+    uint64_t nBlockBytesDownloaded;
+    //! Number of blocks in flight from this peer that we requested from a faster peer instead.
+    int nBlocksReassigned;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -252,6 +322,13 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlockDownloadWindow = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        dBlockDownloadBytes = 0;
+        dBlockDownloadTime = 0;
+        nLastBlockReceived = 0;
+        nBlocksDownloaded = 0;
+        nBlockBytesDownloaded = 0;
+        nBlocksReassigned = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -352,7 +429,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
+            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr), GetTimeMicros()});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -547,6 +624,102 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
     }
 }
 
+/** Round trip time to a peer in microseconds, from its fastest ping, or 0 while unknown. */
+int64_t GetPeerRTT(const CNode* pnode) {
+    const int64_t nMinPing = pnode->nMinPingUsecTime;
+    return nMinPing == std::numeric_limits<int64_t>::max() ? 0 : nMinPing;
+}
+
+// Requires cs_main.
+// Account a block we requested from a peer towards its download rate.
+void RecordBlockDownload(CNodeState* state, int64_t nTimeRequested, uint64_t nBytes, int64_t nTimeReceived, int64_t nRTT) {
+    static const double DECAY = 0.9;
+    // The peer started sending the block a round trip after we requested it,
+    // or right after sending the previous one if that was later.
+    int64_t nStart = std::max(nTimeRequested + nRTT, state->nLastBlockReceived);
+    int64_t nTime = std::max<int64_t>(nTimeReceived - nStart, 1000);
+    state->dBlockDownloadBytes = state->dBlockDownloadBytes * DECAY + nBytes;
+    state->dBlockDownloadTime = state->dBlockDownloadTime * DECAY + nTime;
+    state->nLastBlockReceived = nTimeReceived;
+    state->nBlocksDownloaded++;
+    state->nBlockBytesDownloaded += nBytes;
+    if (g_block_download_avg_size > 0) {
+        g_block_download_avg_size = g_block_download_avg_size * DECAY + nBytes * (1 - DECAY);
+    } else {
+        g_block_download_avg_size = nBytes;
+    }
+}
+
+// Requires cs_main.
+// Expected time in microseconds for a peer to send nBlocks average sized blocks, or -1 while its rate is unknown.
+int64_t EstimateBlockDownloadTime(const CNodeState* state, int nBlocks) {
+    if (state->dBlockDownloadTime <= 0 || g_block_download_avg_size <= 0)
+        return -1;
+    return nBlocks * g_block_download_avg_size * state->dBlockDownloadTime / state->dBlockDownloadBytes;
+}
+
+// Requires cs_main.
+// Size the number of blocks we keep in flight from a peer so it stays busy for
+// a round trip plus BLOCK_DOWNLOAD_QUEUE_TIME, instead of a fixed number that is
+// too small for fast peers and lets slow peers hold up much of the download window.
+void UpdateBlockDownloadWindow(CNodeState* state, int64_t nRTT) {
+    const int64_t nBlockTime = EstimateBlockDownloadTime(state, 1);
+    if (nBlockTime < 0) {
+        state->nBlockDownloadWindow = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        return;
+    }
+    const int64_t nWindow = (nRTT + BLOCK_DOWNLOAD_QUEUE_TIME) / std::max<int64_t>(nBlockTime, 1) + 1;
+    state->nBlockDownloadWindow = std::max<int64_t>(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, nWindow));
+}
+
+// Requires cs_main.
+// The block after pindexLastCommonBlock holds up connecting everything that was
+// downloaded after it. Return it if it is in flight from another peer, and this
+// peer is expected to deliver it much sooner, so it can be requested here instead.
+const CBlockIndex* FindBlockToReassign(NodeId nodeid, int64_t nRTT, int64_t nNow, const Consensus::Params& consensusParams) {
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+
+    if (state->pindexBestKnownBlock == nullptr || state->pindexLastCommonBlock == nullptr ||
+            state->pindexBestKnownBlock->nHeight <= state->pindexLastCommonBlock->nHeight ||
+            state->pindexBestKnownBlock->GetAncestor(state->pindexLastCommonBlock->nHeight) != state->pindexLastCommonBlock)
+        return nullptr;
+    const CBlockIndex* pindex = state->pindexBestKnownBlock->GetAncestor(state->pindexLastCommonBlock->nHeight + 1);
+    if (!pindex->IsValid(BLOCK_VALID_TREE) || (pindex->nStatus & BLOCK_HAVE_DATA))
+        return nullptr;
+    if (!state->fHaveWitness && IsWitnessEnabled(pindex->pprev, consensusParams))
+        return nullptr;
+    auto itInFlight = mapBlocksInFlight.find(pindex->GetBlockHash());
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first == nodeid)
+        return nullptr;
+    const QueuedBlock& queuedBlock = *itInFlight->second.second;
+    if (queuedBlock.partialBlock) {
+        // Being reconstructed from a compact block
+        return nullptr;
+    }
+
+    int64_t nTime = EstimateBlockDownloadTime(state, state->nBlocksInFlight + 1);
+    if (nTime < 0)
+        return nullptr;
+    nTime += nRTT;
+
+    // Blocks we don't have an estimate for are expected to take at least as
+    // long again as they did so far.
+    const CNodeState* stateOther = State(itInFlight->second.first);
+    int nPos = 1;
+    for (auto it = stateOther->vBlocksInFlight.begin(); it != itInFlight->second.second; it++) {
+        nPos++;
+    }
+    int64_t nRemaining = nNow - queuedBlock.nTimeRequested;
+    const int64_t nTimeOther = EstimateBlockDownloadTime(stateOther, nPos);
+    if (nTimeOther >= 0) {
+        nRemaining = std::max(nRemaining, stateOther->nDownloadingSince + nTimeOther - nNow);
+    }
+    if (nRemaining < BLOCK_REASSIGN_SPEEDUP * nTime || nRemaining - nTime < BLOCK_REASSIGN_MIN_GAIN)
+        return nullptr;
+    return pindex;
+}
+
 } // namespace
 
 // This function is used for testing the stale tip eviction logic, see
@@ -593,7 +766,15 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
     for (const QueuedBlock& entry : state->vBlocksInFlight) {
         mapBlocksInFlight.erase(entry.hash);
     }
+    for (auto it = mapBlocksReassigned.begin(); it != mapBlocksReassigned.end();) {
+        if (it->second.first == nodeid) {
+            it = mapBlocksReassigned.erase(it);
+        } else {
+            ++it;
+        }
+    }
     EraseOrphansFor(nodeid);
+    g_headers_range_sync.NodeDisconnected(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
@@ -605,6 +786,7 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
     if (mapNodeState.empty()) {
         // Do a consistency check after the last peer is removed.
         assert(mapBlocksInFlight.empty());
+        assert(mapBlocksReassigned.empty());
         assert(nPreferredDownload == 0);
         assert(nPeersWithValidatedDownloads == 0);
         assert(g_outbound_peers_with_protect_from_disconnect == 0);
@@ -620,6 +802,11 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     stats.nMisbehavior = state->nMisbehavior;
     stats.nSyncHeight = state->pindexBestKnownBlock ? state->pindexBestKnownBlock->nHeight : -1;
     stats.nCommonHeight = state->pindexLastCommonBlock ? state->pindexLastCommonBlock->nHeight : -1;
+    stats.dBlockDownloadRate = state->dBlockDownloadTime > 0 ? state->dBlockDownloadBytes * 1000000 / state->dBlockDownloadTime : 0;
+    stats.nBlockDownloadWindow = state->nBlockDownloadWindow;
+    stats.nBlocksDownloaded = state->nBlocksDownloaded;
+    stats.nBlockBytesDownloaded = state->nBlockBytesDownloaded;
+    stats.nBlocksReassigned = state->nBlocksReassigned;
     for (const QueuedBlock& queue : state->vBlocksInFlight) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
@@ -796,7 +983,7 @@ static bool BlockRequestAllowed(const CBlockIndex* pindex, const Consensus::Para
 
 PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn, CScheduler &scheduler) : connman(connmanIn), m_stale_tip_check_time(0) {
     // Initialize global variables that cannot be constructed at startup.
-    recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
+    recentRejects.reset(new CBlockedRollingBloomFilter(120000, 0.000001));
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
     // Stale tip checking and peer eviction are on two different timers, but we
@@ -868,8 +1055,11 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
+    // Serialized on first use and shared by all peers it is sent to, also
+    // those that ask for it later
+    CSharedNetMsg msgCmpctBlock;
+
+    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock, &msgCmpctBlock](CNode* pnode) {
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -881,7 +1071,12 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->GetId());
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            if (msgCmpctBlock.IsNull()) {
+                msgCmpctBlock = GetRelayMessage(CInv(MSG_CMPCT_BLOCK | MSG_WITNESS_FLAG, hashBlock), [&] {
+                    return msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock);
+                });
+            }
+            connman->PushMessage(pnode, msgCmpctBlock);
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -1073,110 +1268,155 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
         ActivateBestChain(dummy, Params(), a_recent_block);
     }
 
-    LOCK(cs_main);
-    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-    if (mi != mapBlockIndex.end()) {
-        send = BlockRequestAllowed(mi->second, consensusParams);
-        if (!send) {
-            LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
-        }
-    }
+    const CBlockIndex* pindex = nullptr;
+    CDiskBlockPos blockPos;
+    bool fPeerWantsWitness = false;
+    bool fSendCompact = false;
+    bool fRecent = false;
+    uint256 hashTip;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
-    // disconnect node in case we have reached the outbound limit for serving historical blocks
-    // never disconnect whitelisted nodes
-    if (send && connman->OutboundTargetReached(true) && ( ((pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > HISTORICAL_BLOCK_AGE)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
     {
-        LogPrint(BCLog::NET, "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+        if (mi != mapBlockIndex.end()) {
+            send = BlockRequestAllowed(mi->second, consensusParams);
+            if (!send) {
+                LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+            }
+        }
+        // disconnect node in case we have reached the outbound limit for serving historical blocks
+        // never disconnect whitelisted nodes
+        if (send && connman->OutboundTargetReached(true) && ( ((pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > HISTORICAL_BLOCK_AGE)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
+        {
+            LogPrint(BCLog::NET, "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
 
-        //disconnect node
-        pfrom->fDisconnect = true;
-        send = false;
+            //disconnect node
+            pfrom->fDisconnect = true;
+            send = false;
+        }
+        // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold
+        if (send && !pfrom->fWhitelisted && (
+                (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - mi->second->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2 /* add two blocks buffer extension for possible races */) )
+           )) {
+            LogPrint(BCLog::NET, "Ignore block request below NODE_NETWORK_LIMITED threshold from peer=%d\n", pfrom->GetId());
+
+            //disconnect node and prevent it from stalling (would otherwise wait for the missing block)
+            pfrom->fDisconnect = true;
+            send = false;
+        }
+        // Pruned nodes may have deleted the block, so check whether
+        // it's available before trying to send.
+        if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            pindex = mi->second;
+            blockPos = pindex->GetBlockPos();
+            if (inv.type == MSG_CMPCT_BLOCK) {
+                fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+                fSendCompact = CanDirectFetch(consensusParams) && pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+            }
+            hashTip = chainActive.Tip()->GetBlockHash();
+            // Only blocks near the tip are likely to be asked for by other peers
+            fRecent = pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+        }
+    } // release cs_main before reading the block, so other peers aren't held up by disk I/O
+
+    if (pindex == nullptr) {
+        return;
     }
-    // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold
-    if (send && !pfrom->fWhitelisted && (
-            (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - mi->second->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2 /* add two blocks buffer extension for possible races */) )
-       )) {
-        LogPrint(BCLog::NET, "Ignore block request below NODE_NETWORK_LIMITED threshold from peer=%d\n", pfrom->GetId());
 
-        //disconnect node and prevent it from stalling (would otherwise wait for the missing block)
-        pfrom->fDisconnect = true;
-        send = false;
+    // The form of the block the peer gets, under which it is kept in the
+    // relay message cache. If a peer is asking for old blocks, we're almost
+    // guaranteed they won't have a useful mempool to match against a compact
+    // block, and we don't feel like constructing the object for them, so
+    // instead we respond with the full, non-compact block.
+    const uint256 hashBlock = pindex->GetBlockHash();
+    CInv invMsg(inv.type, hashBlock);
+    if (inv.type == MSG_CMPCT_BLOCK) {
+        invMsg.type = fSendCompact ? MSG_CMPCT_BLOCK : MSG_BLOCK;
+        if (fPeerWantsWitness)
+            invMsg.type |= MSG_WITNESS_FLAG;
     }
-    // Pruned nodes may have deleted the block, so check whether
-    // it's available before trying to send.
-    if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
-    {
-        std::shared_ptr<const CBlock> pblock;
-        if (a_recent_block && a_recent_block->GetHash() == (*mi).second->GetBlockHash()) {
-            pblock = a_recent_block;
-        } else {
-            // Send block from disk
-            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
-            if (!ReadBlockFromDisk(*pblockRead, (*mi).second, consensusParams))
-                assert(!"cannot load block from disk");
-            pblock = pblockRead;
-        }
-        if (inv.type == MSG_BLOCK)
-            connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
-        else if (inv.type == MSG_WITNESS_BLOCK)
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
-        else if (inv.type == MSG_FILTERED_BLOCK)
-        {
-            bool sendMerkleBlock = false;
-            CMerkleBlock merkleBlock;
+    CSharedNetMsg msg;
+    if (inv.type != MSG_FILTERED_BLOCK) {
+        msg = g_relay_msg_cache.Find(invMsg);
+    }
+
+    std::shared_ptr<const CBlock> pblock;
+    if (!msg.IsNull()) {
+        // Already serialized for another peer
+    } else if (a_recent_block && a_recent_block->GetHash() == hashBlock) {
+        pblock = a_recent_block;
+    } else {
+        // Send block from disk
+        std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockRead, blockPos, consensusParams) || pblockRead->GetHash() != hashBlock) {
+            // The block file may have been pruned after cs_main was released
             {
-                LOCK(pfrom->cs_filter);
-                if (pfrom->pfilter) {
-                    sendMerkleBlock = true;
-                    merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
-                }
+                LOCK(cs_main);
+                if (pindex->nStatus & BLOCK_HAVE_DATA)
+                    assert(!"cannot load block from disk");
             }
-            if (sendMerkleBlock) {
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
-                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                // This avoids hurting performance by pointlessly requiring a round-trip
-                // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                // they must either disconnect and retry or request the full block.
-                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                // however we MUST always provide at least what the remote peer needs
-                typedef std::pair<unsigned int, uint256> PairType;
-                for (PairType& pair : merkleBlock.vMatchedTxn)
-                    connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]));
-            }
-            // else
-                // no response
-        }
-        else if (inv.type == MSG_CMPCT_BLOCK)
+            LogPrint(BCLog::NET, "%s: block %s was pruned before it could be sent, disconnect peer=%d\n", __func__, inv.hash.ToString(), pfrom->GetId());
+            pfrom->fDisconnect = true;
+            return;
+        }
+        pblock = pblockRead;
+    }
+    if (inv.type == MSG_FILTERED_BLOCK)
+    {
+        bool sendMerkleBlock = false;
+        CMerkleBlock merkleBlock;
         {
-            // If a peer is asking for old blocks, we're almost guaranteed
-            // they won't have a useful mempool to match against a compact block,
-            // and we don't feel like constructing the object for them, so
-            // instead we respond with the full, non-compact block.
-            bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-            int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-            if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
-                } else {
-                    CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
-                }
+            LOCK(pfrom->cs_filter);
+            if (pfrom->pfilter) {
+                sendMerkleBlock = true;
+                merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
+            }
+        }
+        if (sendMerkleBlock) {
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
+            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+            // This avoids hurting performance by pointlessly requiring a round-trip
+            // Note that there is currently no way for a node to request any single transactions we didn't send here -
+            // they must either disconnect and retry or request the full block.
+            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+            // however we MUST always provide at least what the remote peer needs
+            typedef std::pair<unsigned int, uint256> PairType;
+            for (PairType& pair : merkleBlock.vMatchedTxn)
+                connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]));
+        }
+        // else
+            // no response
+    }
+    else
+    {
+        if (msg.IsNull()) {
+            int nSendFlags = (invMsg.type & MSG_WITNESS_FLAG) ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+            CSerializedNetMsg serialized;
+            if (invMsg.type == MSG_BLOCK || invMsg.type == MSG_WITNESS_BLOCK) {
+                serialized = msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock);
+            } else if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == hashBlock) {
+                serialized = msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block);
             } else {
-                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+                CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
+                serialized = msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock);
             }
+            msg = CConnman::PrepareMessage(std::move(serialized));
+            if (fRecent)
+                g_relay_msg_cache.Insert(invMsg, msg);
         }
+        connman->PushMessage(pfrom, msg);
+    }
 
-        // Trigger the peer node to send a getblocks request for the next batch of inventory
-        if (inv.hash == pfrom->hashContinue)
-        {
-            // Bypass PushInventory, this must send even if redundant,
-            // and we want it right after the last block so they don't
-            // wait for other stuff first.
-            std::vector<CInv> vInv;
-            vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
-            pfrom->hashContinue.SetNull();
-        }
+    // Trigger the peer node to send a getblocks request for the next batch of inventory
+    if (inv.hash == pfrom->hashContinue)
+    {
+        // Bypass PushInventory, this must send even if redundant,
+        // and we want it right after the last block so they don't
+        // wait for other stuff first.
+        std::vector<CInv> vInv;
+        vInv.push_back(CInv(MSG_BLOCK, hashTip));
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
+        pfrom->hashContinue.SetNull();
     }
 }
 
@@ -1201,22 +1441,26 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             it++;
 
             // Send stream from relay memory
-            bool push = false;
+            CTransactionRef tx;
             auto mi = mapRelay.find(inv.hash);
             int nSendFlags = (inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0);
             if (mi != mapRelay.end()) {
-                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second));
-                push = true;
+                tx = mi->second;
             } else if (pfrom->timeLastMempoolReq) {
                 auto txinfo = mempool.info(inv.hash);
                 // To protect privacy, do not answer getdata using the mempool when
                 // that TX couldn't have been INVed in reply to a MEMPOOL request.
                 if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq) {
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *txinfo.tx));
-                    push = true;
+                    tx = std::move(txinfo.tx);
                 }
             }
-            if (!push) {
+            if (tx) {
+                // The txid only determines the serialization without witness
+                const CInv invMsg(inv.type, inv.type == MSG_TX ? tx->GetHash() : tx->GetWitnessHash());
+                connman->PushMessage(pfrom, GetRelayMessage(invMsg, [&] {
+                    return msgMaker.Make(nSendFlags, NetMsgType::TX, *tx);
+                }));
+            } else {
                 vNotFound.push_back(inv);
             }
 
@@ -1272,11 +1516,69 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
 }
 
+/**
+ * Validate the headers downloaded by range that connect to headers we know,
+ * in chain order. Called without cs_main held.
+ */
+void static ConnectHeadersRanges(const CChainParams& chainparams)
+{
+    std::vector<CBlockHeader> headers;
+    NodeId node;
+    int nRange;
+    while (true) {
+        {
+            LOCK(cs_main);
+            if (!g_headers_range_sync.PopHeaders([](const uint256& hash) { return mapBlockIndex.count(hash) > 0; }, headers, node, nRange))
+                return;
+        }
+        CValidationState state;
+        const CBlockIndex *pindexLast = nullptr;
+        bool fValid = ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast);
+        LOCK(cs_main);
+        if (!fValid) {
+            LogPrint(BCLog::NET, "invalid headers in range from peer=%d: %s\n", node, FormatStateMessage(state));
+            g_headers_range_sync.RejectHeaders(nRange, node);
+            int nDoS;
+            if (state.IsInvalid(nDoS) && nDoS > 0) {
+                Misbehaving(node, nDoS);
+            }
+            continue;
+        }
+        LogPrint(BCLog::NET, "connected %u headers up to %d downloaded from peer=%d\n", headers.size(), pindexLast->nHeight, node);
+        if (State(node) != nullptr) {
+            UpdateBlockAvailability(node, pindexLast->GetBlockHash());
+        }
+    }
+}
+
 bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::vector<CBlockHeader>& headers, const CChainParams& chainparams, bool punish_duplicate_invalid)
 {
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
     size_t nCount = headers.size();
 
+    // Headers of a range requested from this peer are buffered until the
+    // headers before them are known
+    CHeadersRangeSync::Result rangeResult;
+    {
+        LOCK(cs_main);
+        uint256 hashFrom, hashStop;
+        rangeResult = g_headers_range_sync.ProcessHeaders(pfrom->GetId(), headers, chainparams.GetConsensus(), GetTimeMicros(), hashFrom, hashStop);
+        if (rangeResult == CHeadersRangeSync::Result::INVALID) {
+            Misbehaving(pfrom->GetId(), 100);
+            return error("invalid headers in the requested range");
+        }
+        if (rangeResult != CHeadersRangeSync::Result::NOT_IN_RANGE) {
+            LogPrint(BCLog::NET, "received %u headers in range (%u buffered) peer=%d\n", nCount, g_headers_range_sync.GetBufferedCount(), pfrom->GetId());
+        }
+        if (rangeResult == CHeadersRangeSync::Result::REQUEST_MORE) {
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, CBlockLocator(std::vector<uint256>(1, hashFrom)), hashStop));
+        }
+    }
+    if (rangeResult != CHeadersRangeSync::Result::NOT_IN_RANGE) {
+        ConnectHeadersRanges(chainparams);
+        return true;
+    }
+
     if (nCount == 0) {
         // Nothing interesting. Stop asking this peers for more headers.
         return true;
@@ -1399,10 +1701,14 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
 
         if (nCount == MAX_HEADERS_RESULTS) {
             // Headers message had its maximum size; the peer may have more headers.
-            // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
-            // from there instead.
-            LogPrint(BCLog::NET, "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->GetId(), pfrom->nStartingHeight);
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexLast), uint256()));
+            // If pindexLast is an ancestor of pindexBestHeader, e.g. because headers
+            // further ahead were downloaded by range, continue from there instead.
+            const CBlockIndex *pindexFrom = pindexLast;
+            if (pindexBestHeader->nHeight > pindexLast->nHeight && pindexBestHeader->GetAncestor(pindexLast->nHeight) == pindexLast) {
+                pindexFrom = pindexBestHeader;
+            }
+            LogPrint(BCLog::NET, "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexFrom->nHeight, pfrom->GetId(), pfrom->nStartingHeight);
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexFrom), uint256()));
         }
 
         bool fCanDirectFetch = CanDirectFetch(chainparams.GetConsensus());
@@ -1488,12 +1794,16 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
         }
     }
 
+    // These headers may have reached the start of a range downloaded from another peer
+    ConnectHeadersRanges(chainparams);
+
     return true;
 }
 
-bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
+bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc, CNetMessage* pmsg = nullptr)
 {
-    LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->GetId());
+    // Block and headers payloads may already have been taken out of vRecv
+    LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), pmsg ? pmsg->hdr.nMessageSize : vRecv.size(), pfrom->GetId());
     if (gArgs.IsArgSet("-dropmessagestest") && GetRand(gArgs.GetArg("-dropmessagestest", 0)) == 0)
     {
         LogPrintf("dropmessagestest DROPPING RECV MESSAGE\n");
@@ -2598,17 +2908,20 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     {
         std::vector<CBlockHeader> headers;
 
-        // Bypass the normal CBlock deserialization, as we don't want to risk deserializing 2000 full blocks.
-        unsigned int nCount = ReadCompactSize(vRecv);
-        if (nCount > MAX_HEADERS_RESULTS) {
-            LOCK(cs_main);
-            Misbehaving(pfrom->GetId(), 20);
-            return error("headers message size = %u", nCount);
-        }
-        headers.resize(nCount);
-        for (unsigned int n = 0; n < nCount; n++) {
-            vRecv >> headers[n];
-            ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
+        // Use the headers deserialized while the message was received, if it was
+        if (!pmsg || !pmsg->TakeParsed(headers)) {
+            // Bypass the normal CBlock deserialization, as we don't want to risk deserializing 2000 full blocks.
+            unsigned int nCount = ReadCompactSize(vRecv);
+            if (nCount > MAX_HEADERS_RESULTS) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 20);
+                return error("headers message size = %u", nCount);
+            }
+            headers.resize(nCount);
+            for (unsigned int n = 0; n < nCount; n++) {
+                vRecv >> headers[n];
+                ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
+            }
         }
 
         // Headers received via a HEADERS message should be valid, and reflect
@@ -2621,8 +2934,11 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
-        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-        vRecv >> *pblock;
+        std::shared_ptr<CBlock> pblock;
+        if (!pmsg || !pmsg->TakeParsed(pblock)) {
+            pblock = std::make_shared<CBlock>();
+            vRecv >> *pblock;
+        }
 
         LogPrint(BCLog::NET, "received block %s peer=%d\n", pblock->GetHash().ToString(), pfrom->GetId());
 
@@ -2630,6 +2946,21 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         const uint256 hash(pblock->GetHash());
         {
             LOCK(cs_main);
+            const uint64_t nBytes = pmsg ? pmsg->hdr.nMessageSize : ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
+            auto itInFlight = mapBlocksInFlight.find(hash);
+            if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId()) {
+                RecordBlockDownload(State(pfrom->GetId()), itInFlight->second.second->nTimeRequested, nBytes, nTimeReceived, GetPeerRTT(pfrom));
+            }
+            auto itReassigned = mapBlocksReassigned.find(hash);
+            if (itReassigned != mapBlocksReassigned.end()) {
+                if (itReassigned->second.first == pfrom->GetId()) {
+                    // The slow peer delivered the block it was asked for after all,
+                    // before the peer it was reassigned to
+                    RecordBlockDownload(State(pfrom->GetId()), itReassigned->second.second, nBytes, nTimeReceived, GetPeerRTT(pfrom));
+                    forceProcessing = true;
+                }
+                mapBlocksReassigned.erase(itReassigned);
+            }
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
             forceProcessing |= MarkBlockAsReceived(hash);
@@ -2668,6 +2999,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
+        LOCK(pfrom->cs_addrRelay);
         pfrom->vAddrToSend.clear();
         std::vector<CAddress> vAddr = connman->GetAddresses();
         FastRandomContext insecure_rand;
@@ -2921,7 +3253,7 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
             return false;
         // Just take one message
         msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
-        pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
+        pfrom->nProcessQueueSize -= msgs.front().hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
         pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman->GetReceiveFloodSize();
         fMoreWork = !pfrom->vProcessMsg.empty();
     }
@@ -2963,7 +3295,7 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     bool fRet = false;
     try
     {
-        fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
+        fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc, &msg);
         if (interruptMsgProc)
             return false;
         if (!pfrom->vRecvGetData.empty())
@@ -3140,21 +3472,64 @@ void PeerLogicValidation::CheckForStaleTipAndEvictPeers(const Consensus::Params
 
 class CompareInvMempoolOrder
 {
-    CTxMemPool *mp;
 public:
-    explicit CompareInvMempoolOrder(CTxMemPool *_mempool)
-    {
-        mp = _mempool;
-    }
-
-    bool operator()(std::set<uint256>::iterator a, std::set<uint256>::iterator b)
+    bool operator()(const TxAnnounceBatch::value_type* a, const TxAnnounceBatch::value_type* b) const
     {
         /* As std::make_heap produces a max-heap, we want the entries with the
-         * fewest ancestors/highest fee to sort later. */
-        return mp->CompareDepthAndScore(*b, *a);
+         * fewest ancestors/highest fee to sort later. Same order as
+         * CTxMemPool::CompareDepthAndScore. */
+        const TxAnnounceInfo& infoa = a->second;
+        const TxAnnounceInfo& infob = b->second;
+        if (infoa.nCountWithAncestors != infob.nCountWithAncestors)
+            return infob.nCountWithAncestors < infoa.nCountWithAncestors;
+        double f1 = (double)infob.nModFee * infoa.nTxSize;
+        double f2 = (double)infoa.nModFee * infob.nTxSize;
+        if (f1 == f2)
+            return a->first < b->first;
+        return f1 > f2;
     }
 };
 
+/**
+ * Return the g_tx_announce_batch entries of the transactions in setHashes, in
+ * the same order. The ones missing from the batch are looked up in the mempool
+ * under a single lock.
+ */
+static std::vector<const TxAnnounceBatch::value_type*> GetTxAnnounceBatch(const std::set<uint256>& setHashes, int64_t nNow)
+{
+    AssertLockHeld(cs_main);
+    if (nNow > g_tx_announce_batch_expiry || chainActive.Tip() != g_tx_announce_batch_tip) {
+        g_tx_announce_batch.clear();
+        g_tx_announce_batch_expiry = nNow + TX_ANNOUNCE_BATCH_INTERVAL;
+        g_tx_announce_batch_tip = chainActive.Tip();
+    }
+
+    std::vector<const TxAnnounceBatch::value_type*> ret;
+    std::vector<TxAnnounceBatch::value_type*> vMissing;
+    ret.reserve(setHashes.size());
+    for (const uint256& hash : setHashes) {
+        auto inserted = g_tx_announce_batch.emplace(hash, TxAnnounceInfo());
+        if (inserted.second)
+            vMissing.push_back(&*inserted.first);
+        ret.push_back(&*inserted.first);
+    }
+    if (!vMissing.empty()) {
+        LOCK(mempool.cs);
+        for (TxAnnounceBatch::value_type* entry : vMissing) {
+            auto it = mempool.mapTx.find(entry->first);
+            if (it == mempool.mapTx.end())
+                continue;
+            TxAnnounceInfo& info = entry->second;
+            info.tx = it->GetSharedTx();
+            info.feeRate = CFeeRate(it->GetFee(), it->GetTxSize());
+            info.nCountWithAncestors = it->GetCountWithAncestors();
+            info.nModFee = it->GetModifiedFee();
+            info.nTxSize = it->GetTxSize();
+        }
+    }
+    return ret;
+}
+
 bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptMsgProc)
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -3215,6 +3590,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_addrRelay);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             for (const CAddress& addr : pto->vAddrToSend)
@@ -3263,6 +3639,21 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                 connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), uint256()));
             }
         }
+        // While headers are synced from a single peer, fetch ranges of headers
+        // between checkpoints further ahead from the other ones.
+        if (!state.fSyncStarted && fFetch && !fImporting && !fReindex && fCheckpointsEnabled &&
+                pindexBestHeader->GetBlockTime() <= GetAdjustedTime() - 24 * 60 * 60) {
+            if (!g_headers_range_sync_started) {
+                g_headers_range_sync.Init(Params().Checkpoints().mapCheckpoints, pindexBestHeader->nHeight, MAX_HEADERS_RANGE_BUFFERED, MAX_HEADERS_RANGE_BUFFERED_PER_PEER);
+                g_headers_range_sync_started = true;
+            }
+            g_headers_range_sync.ExpireRequests(nNow - HEADERS_RANGE_REQUEST_TIMEOUT);
+            uint256 hashFrom, hashStop;
+            if (g_headers_range_sync.AssignRange(pto->GetId(), pto->nStartingHeight, pindexBestHeader->nHeight + MAX_HEADERS_RANGE_LOOKAHEAD, nNow, hashFrom, hashStop)) {
+                LogPrint(BCLog::NET, "range getheaders (%s to %s) to peer=%d (startheight:%d)\n", hashFrom.ToString(), hashStop.ToString(), pto->GetId(), pto->nStartingHeight);
+                connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, CBlockLocator(std::vector<uint256>(1, hashFrom)), hashStop));
+            }
+        }
 
         // Resend wallet transactions that haven't gotten in a block yet
         // Except during reindex, importing and IBD, when old wallet
@@ -3347,27 +3738,29 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                             vHeaders.front().GetHash().ToString(), pto->GetId());
 
                     int nSendFlags = state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+                    const CInv invMsg(state.fWantsCmpctWitness ? (int)(MSG_CMPCT_BLOCK | MSG_WITNESS_FLAG) : (int)MSG_CMPCT_BLOCK, pBestIndex->GetBlockHash());
 
-                    bool fGotBlockFromCache = false;
-                    {
+                    CSharedNetMsg msg = g_relay_msg_cache.Find(invMsg);
+                    if (msg.IsNull()) {
                         LOCK(cs_most_recent_block);
                         if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
                             if (state.fWantsCmpctWitness || !fWitnessesPresentInMostRecentCompactBlock)
-                                connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
+                                msg = CConnman::PrepareMessage(msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
                             else {
                                 CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness);
-                                connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                                msg = CConnman::PrepareMessage(msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                             }
-                            fGotBlockFromCache = true;
                         }
                     }
-                    if (!fGotBlockFromCache) {
+                    if (msg.IsNull()) {
                         CBlock block;
                         bool ret = ReadBlockFromDisk(block, pBestIndex, consensusParams);
                         assert(ret);
                         CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
-                        connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                        msg = CConnman::PrepareMessage(msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                     }
+                    g_relay_msg_cache.Insert(invMsg, msg);
+                    connman->PushMessage(pto, msg);
                     state.pindexBestHeaderSent = pBestIndex;
                 } else if (state.fPreferHeaders) {
                     if (vHeaders.size() > 1) {
@@ -3480,20 +3873,29 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
 
             // Determine transactions to relay
             if (fSendTrickle) {
-                // Produce a vector with all candidates for sending
-                std::vector<std::set<uint256>::iterator> vInvTx;
-                vInvTx.reserve(pto->setInventoryTxToSend.size());
-                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
-                    vInvTx.push_back(it);
-                }
                 CAmount filterrate = 0;
                 {
                     LOCK(pto->cs_feeFilter);
                     filterrate = pto->minFeeFilter;
                 }
+                // Produce a vector with all candidates for sending. The ones the peer knows about
+                // already, that aren't in the mempool anymore or that pay less than its fee filter
+                // would be skipped when their turn comes, so drop them all at once up front.
+                std::vector<const TxAnnounceBatch::value_type*> vInvTx = GetTxAnnounceBatch(pto->setInventoryTxToSend, nNow);
+                auto itKeep = vInvTx.begin();
+                for (const TxAnnounceBatch::value_type* entry : vInvTx) {
+                    const TxAnnounceInfo& info = entry->second;
+                    if (!info.tx || pto->filterInventoryKnown.contains(entry->first) ||
+                        (filterrate && info.feeRate.GetFeePerK() < filterrate)) {
+                        pto->setInventoryTxToSend.erase(entry->first);
+                    } else {
+                        *itKeep++ = entry;
+                    }
+                }
+                vInvTx.erase(itKeep, vInvTx.end());
                 // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
                 // A heap is used so that not all items need sorting if only a few are being sent.
-                CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
+                CompareInvMempoolOrder compareInvMempoolOrder;
                 std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
                 // No reason to drain out at many times the network's capacity,
                 // especially since we have many peers and some will draw much shorter delays.
@@ -3502,24 +3904,13 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                 while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
                     // Fetch the top element from the heap
                     std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                    std::set<uint256>::iterator it = vInvTx.back();
+                    const TxAnnounceBatch::value_type* entry = vInvTx.back();
                     vInvTx.pop_back();
-                    uint256 hash = *it;
+                    const uint256& hash = entry->first;
+                    const CTransactionRef& tx = entry->second.tx;
                     // Remove it from the to-be-sent set
-                    pto->setInventoryTxToSend.erase(it);
-                    // Check if not in the filter already
-                    if (pto->filterInventoryKnown.contains(hash)) {
-                        continue;
-                    }
-                    // Not in the mempool anymore? don't bother sending it.
-                    auto txinfo = mempool.info(hash);
-                    if (!txinfo.tx) {
-                        continue;
-                    }
-                    if (filterrate && txinfo.feeRate.GetFeePerK() < filterrate) {
-                        continue;
-                    }
-                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
+                    pto->setInventoryTxToSend.erase(hash);
+                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*tx)) continue;
                     // Send
                     vInv.push_back(CInv(MSG_TX, hash));
                     nRelayedTransactions++;
@@ -3531,7 +3922,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                             vRelayExpiration.pop_front();
                         }
 
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
+                        auto ret = mapRelay.insert(std::make_pair(hash, tx));
                         if (ret.second) {
                             vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
                         }
@@ -3612,10 +4003,26 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        UpdateBlockDownloadWindow(&state, GetPeerRTT(pto));
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < state.nBlockDownloadWindow) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            const unsigned int nMaxToDownload = state.nBlockDownloadWindow - state.nBlocksInFlight;
+            FindNextBlocksToDownload(pto->GetId(), nMaxToDownload, vToDownload, staller, consensusParams);
+            if (vToDownload.size() < nMaxToDownload) {
+                // This peer has room to spare, take over the block that holds up
+                // the download if it is in flight from a much slower peer.
+                const CBlockIndex* pindexReassign = FindBlockToReassign(pto->GetId(), GetPeerRTT(pto), nNow, consensusParams);
+                if (pindexReassign) {
+                    const auto& inFlight = mapBlocksInFlight[pindexReassign->GetBlockHash()];
+                    const NodeId nodeSlow = inFlight.first;
+                    State(nodeSlow)->nBlocksReassigned++;
+                    mapBlocksReassigned[pindexReassign->GetBlockHash()] = std::make_pair(nodeSlow, inFlight.second->nTimeRequested);
+                    LogPrint(BCLog::NET, "Reassigning block %s (%d) from peer=%d to peer=%d\n", pindexReassign->GetBlockHash().ToString(),
+                        pindexReassign->nHeight, nodeSlow, pto->GetId());
+                    vToDownload.insert(vToDownload.begin(), pindexReassign);
+                }
+            }
             for (const CBlockIndex *pindex : vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -22,6 +22,15 @@ static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
  *  Timeout = base + per_header * (expected number of headers) */
 static constexpr int64_t HEADERS_DOWNLOAD_TIMEOUT_BASE = 15 * 60 * 1000000; // 15 minutes
 static constexpr int64_t HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER = 1000; // 1ms/header
+/** Timeout in microseconds for a peer to answer a getheaders request for a range of headers,
+ *  before the range is requested from another peer */
+static constexpr int64_t HEADERS_RANGE_REQUEST_TIMEOUT = 60 * 1000000;
+/** How far ahead of our best header ranges of headers may be downloaded from other peers */
+static constexpr int MAX_HEADERS_RANGE_LOOKAHEAD = 400000;
+/** Maximum number of headers downloaded by range that are buffered or requested at any time, across all peers (80 bytes each) */
+static constexpr size_t MAX_HEADERS_RANGE_BUFFERED = 100000;
+/** Maximum number of headers downloaded by range from one peer that are buffered or requested at any time */
+static constexpr size_t MAX_HEADERS_RANGE_BUFFERED_PER_PEER = 20000;
 /** Protect at least this many outbound peers from disconnection due to slow/
  * behind headers chain.
  */
@@ -34,6 +43,8 @@ static constexpr int64_t STALE_CHECK_INTERVAL = 2.5 * 60; // 2.5 minutes
 static constexpr int64_t EXTRA_PEER_CHECK_INTERVAL = 45;
 /** Minimum time an outbound-peer-eviction candidate must be connected for, in order to evict, in seconds */
 static constexpr int64_t MINIMUM_CONNECT_TIME = 30;
+/** How long the mempool data looked up to order transaction announcements is shared by all peers, in microseconds */
+static constexpr int64_t TX_ANNOUNCE_BATCH_INTERVAL = 1 * 1000000;
 
 class PeerLogicValidation : public CValidationInterface, public NetEventsInterface {
 private:
@@ -74,6 +85,11 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    double dBlockDownloadRate;
+    int nBlockDownloadWindow;
+    int nBlocksDownloaded;
+    uint64_t nBlockBytesDownloaded;
+    int nBlocksReassigned;
 };
 
 /** Get statistics from node state */
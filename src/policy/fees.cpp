@@ -14,6 +14,10 @@
 
 static constexpr double INF_FEERATE = 1e99;
 
+/** Once the accumulated decay of a TxConfirmStats drops below this, the stored
+ * averages are rescaled so that they stay well within double precision */
+static constexpr double MIN_DECAY_FACTOR = 1e-20;
+
 std::string StringForFeeEstimateHorizon(FeeEstimateHorizon horizon) {
     static const std::map<FeeEstimateHorizon, std::string> horizon_strings = {
         {FeeEstimateHorizon::SHORT_HALFLIFE, "short"},
@@ -98,6 +102,12 @@ private:
 
     double decay;
 
+    // Rather than decaying every moving average on every block, all of the above
+    // averages are stored relative to decayFactor, the product of the decays
+    // applied since they were last rescaled. The actual value of e.g. txCtAvg[X]
+    // is txCtAvg[X] * decayFactor.
+    double decayFactor;
+
     // Resolution (# of blocks) with which confirmations are tracked
     unsigned int scale;
 
@@ -108,8 +118,19 @@ private:
     // transactions still unconfirmed after GetMaxConfirms for each bucket
     std::vector<int> oldUnconfTxs;
 
+    // Cache of cumulative unconfTxs counts at unconfTotalsHeight, used to
+    // answer many estimates at the same height without rescanning unconfTxs:
+    // unconfTotals[Y][X] is the number of transactions in bucket X that have
+    // been unconfirmed for at least Y blocks (not counting oldUnconfTxs).
+    mutable std::vector<std::vector<int>> unconfTotals;
+    mutable unsigned int unconfTotalsHeight;
+    mutable bool unconfTotalsValid;
+
     void resizeInMemoryCounters(size_t newbuckets);
 
+    /** Apply decayFactor to all stored averages and reset it to 1 */
+    void Rescale();
+
 public:
     /**
      * Create new TxConfirmStats. This is called by BlockPolicyEstimator's
@@ -143,6 +164,9 @@ public:
         with the data gathered from the current block */
     void UpdateMovingAverages();
 
+    /** Fill the unconfirmed transaction totals used by EstimateMedianVal at nBlockHeight */
+    void UpdateUnconfirmedTotals(unsigned int nBlockHeight) const;
+
     /**
      * Calculate a feerate estimate.  Find the lowest value bucket (or range of buckets
      * to make sure we have enough data points) whose transactions still have sufficient likelihood
@@ -175,9 +199,10 @@ public:
 TxConfirmStats::TxConfirmStats(const std::vector<double>& defaultBuckets,
                                 const std::map<double, unsigned int>& defaultBucketMap,
                                unsigned int maxPeriods, double _decay, unsigned int _scale)
-    : buckets(defaultBuckets), bucketMap(defaultBucketMap)
+    : buckets(defaultBuckets), bucketMap(defaultBucketMap), unconfTotalsHeight(0), unconfTotalsValid(false)
 {
     decay = _decay;
+    decayFactor = 1;
     assert(_scale != 0 && "_scale must be non-zero");
     scale = _scale;
     confAvg.resize(maxPeriods);
@@ -202,6 +227,7 @@ void TxConfirmStats::resizeInMemoryCounters(size_t newbuckets) {
         unconfTxs[i].resize(newbuckets);
     }
     oldUnconfTxs.resize(newbuckets);
+    unconfTotalsValid = false;
 }
 
 // Roll the unconfirmed txs circular buffer
@@ -211,6 +237,24 @@ void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
         oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
         unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
     }
+    unconfTotalsValid = false;
+}
+
+void TxConfirmStats::UpdateUnconfirmedTotals(unsigned int nBlockHeight) const
+{
+    if (unconfTotalsValid && unconfTotalsHeight == nBlockHeight)
+        return;
+    unsigned int bins = unconfTxs.size();
+    unconfTotals.resize(GetMaxConfirms() + 1);
+    unconfTotals[GetMaxConfirms()].assign(buckets.size(), 0);
+    for (unsigned int confct = GetMaxConfirms(); confct-- > 0; ) {
+        unconfTotals[confct] = unconfTotals[confct + 1];
+        for (unsigned int j = 0; j < buckets.size(); j++) {
+            unconfTotals[confct][j] += unconfTxs[(nBlockHeight - confct)%bins][j];
+        }
+    }
+    unconfTotalsHeight = nBlockHeight;
+    unconfTotalsValid = true;
 }
 
 
@@ -222,22 +266,31 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     int periodsToConfirm = (blocksToConfirm + scale - 1)/scale;
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
     for (size_t i = periodsToConfirm; i <= confAvg.size(); i++) {
-        confAvg[i - 1][bucketindex]++;
+        confAvg[i - 1][bucketindex] += 1 / decayFactor;
     }
-    txCtAvg[bucketindex]++;
-    avg[bucketindex] += val;
+    txCtAvg[bucketindex] += 1 / decayFactor;
+    avg[bucketindex] += val / decayFactor;
 }
 
 void TxConfirmStats::UpdateMovingAverages()
+{
+    decayFactor *= decay;
+    if (decayFactor < MIN_DECAY_FACTOR) {
+        Rescale();
+    }
+}
+
+void TxConfirmStats::Rescale()
 {
     for (unsigned int j = 0; j < buckets.size(); j++) {
         for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay;
+            confAvg[i][j] = confAvg[i][j] * decayFactor;
         for (unsigned int i = 0; i < failAvg.size(); i++)
-            failAvg[i][j] = failAvg[i][j] * decay;
-        avg[j] = avg[j] * decay;
-        txCtAvg[j] = txCtAvg[j] * decay;
+            failAvg[i][j] = failAvg[i][j] * decayFactor;
+        avg[j] = avg[j] * decayFactor;
+        txCtAvg[j] = txCtAvg[j] * decayFactor;
     }
+    decayFactor = 1;
 }
 
 // returns -1 on error conditions
@@ -285,11 +338,15 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
             newBucketRange = false;
         }
         curFarBucket = bucket;
-        nConf += confAvg[periodTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
-        failNum += failAvg[periodTarget - 1][bucket];
-        for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
-            extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
+        nConf += confAvg[periodTarget - 1][bucket] * decayFactor;
+        totalNum += txCtAvg[bucket] * decayFactor;
+        failNum += failAvg[periodTarget - 1][bucket] * decayFactor;
+        if (unconfTotalsValid && unconfTotalsHeight == nBlockHeight) {
+            extraNum += unconfTotals[std::min<unsigned int>(confTarget, GetMaxConfirms())][bucket];
+        } else {
+            for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
+                extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
+        }
         extraNum += oldUnconfTxs[bucket];
         // If we have enough transaction data points in this range of buckets,
         // we can test for success
@@ -395,12 +452,15 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
 
 void TxConfirmStats::Write(CAutoFile& fileout) const
 {
+    // The file holds the actual averages, so apply the pending decay
+    TxConfirmStats rescaled(*this);
+    rescaled.Rescale();
     fileout << decay;
     fileout << scale;
-    fileout << avg;
-    fileout << txCtAvg;
-    fileout << confAvg;
-    fileout << failAvg;
+    fileout << rescaled.avg;
+    fileout << rescaled.txCtAvg;
+    fileout << rescaled.confAvg;
+    fileout << rescaled.failAvg;
 }
 
 void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets)
@@ -415,6 +475,7 @@ void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets
     if (decay <= 0 || decay >= 1) {
         throw std::runtime_error("Corrupt estimates file. Decay must be between 0 and 1 (non-inclusive)");
     }
+    decayFactor = 1;
     filein >> scale;
     if (scale == 0) {
         throw std::runtime_error("Corrupt estimates file. Scale must be non-zero");
@@ -464,6 +525,7 @@ unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
     unsigned int blockIndex = nBlockHeight % unconfTxs.size();
     unconfTxs[blockIndex][bucketindex]++;
+    unconfTotalsValid = false;
     return bucketindex;
 }
 
@@ -495,11 +557,12 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
                      blockIndex, bucketindex);
         }
     }
+    unconfTotalsValid = false;
     if (!inBlock && (unsigned int)blocksAgo >= scale) { // Only counts as a failure if not confirmed for entire period
         assert(scale != 0);
         unsigned int periodsAgo = blocksAgo / scale;
         for (size_t i = 0; i < periodsAgo && i < failAvg.size(); i++) {
-            failAvg[i][bucketindex]++;
+            failAvg[i][bucketindex] += 1 / decayFactor;
         }
     }
 }
@@ -514,6 +577,11 @@ bool CBlockPolicyEstimator::removeTx(uint256 hash, bool inBlock)
     LOCK(cs_feeEstimator);
     std::map<uint256, TxStatsInfo>::iterator pos = mapMemPoolTxs.find(hash);
     if (pos != mapMemPoolTxs.end()) {
+        // Transactions which entered the mempool since the last block are not
+        // counted by any estimate, so only older ones affect the answers.
+        if (pos->second.blockHeight != nBestSeenHeight) {
+            InvalidateSmartFeeTable();
+        }
         feeStats->removeTx(pos->second.blockHeight, nBestSeenHeight, pos->second.bucketIndex, inBlock);
         shortStats->removeTx(pos->second.blockHeight, nBestSeenHeight, pos->second.bucketIndex, inBlock);
         longStats->removeTx(pos->second.blockHeight, nBestSeenHeight, pos->second.bucketIndex, inBlock);
@@ -629,6 +697,7 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     // calls to removeTx (via processBlockTx) correctly calculate age
     // of unconfirmed txs to remove from tracking.
     nBestSeenHeight = nBlockHeight;
+    InvalidateSmartFeeTable();
 
     // Update unconfirmed circular buffer
     feeStats->ClearCurrent(nBlockHeight);
@@ -817,35 +886,13 @@ double CBlockPolicyEstimator::estimateConservativeFee(unsigned int doubleTarget,
  * estimates, however, required the 95% threshold at 2 * target be met for any
  * longer time horizons also.
  */
-CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, FeeCalculation *feeCalc, bool conservative) const
+void CBlockPolicyEstimator::ComputeSmartFee(unsigned int confTarget, bool conservative, SmartFeeAnswer& answer) const
 {
-    LOCK(cs_feeEstimator);
-
-    if (feeCalc) {
-        feeCalc->desiredTarget = confTarget;
-        feeCalc->returnedTarget = confTarget;
-    }
+    AssertLockHeld(cs_feeEstimator);
 
     double median = -1;
     EstimationResult tempResult;
 
-    // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > longStats->GetMaxConfirms()) {
-        return CFeeRate(0);  // error condition
-    }
-
-    // It's not possible to get reasonable estimates for confTarget of 1
-    if (confTarget == 1) confTarget = 2;
-
-    unsigned int maxUsableEstimate = MaxUsableEstimate();
-    if ((unsigned int)confTarget > maxUsableEstimate) {
-        confTarget = maxUsableEstimate;
-    }
-    if (feeCalc) feeCalc->returnedTarget = confTarget;
-
-    if (confTarget <= 1) return CFeeRate(0); // error condition
-
-    assert(confTarget > 0); //estimateCombinedFee and estimateConservativeFee take unsigned ints
     /** true is passed to estimateCombined fee for target/2 and target so
      * that we check the max confirms for shorter time horizons as well.
      * This is necessary to preserve monotonically increasing estimates.
@@ -857,42 +904,108 @@ CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, FeeCalculation
      * fluctuations lower our estimates by too much.
      */
     double halfEst = estimateCombinedFee(confTarget/2, HALF_SUCCESS_PCT, true, &tempResult);
-    if (feeCalc) {
-        feeCalc->est = tempResult;
-        feeCalc->reason = FeeReason::HALF_ESTIMATE;
-    }
+    answer.est = tempResult;
+    answer.reason = FeeReason::HALF_ESTIMATE;
     median = halfEst;
     double actualEst = estimateCombinedFee(confTarget, SUCCESS_PCT, true, &tempResult);
     if (actualEst > median) {
         median = actualEst;
-        if (feeCalc) {
-            feeCalc->est = tempResult;
-            feeCalc->reason = FeeReason::FULL_ESTIMATE;
-        }
+        answer.est = tempResult;
+        answer.reason = FeeReason::FULL_ESTIMATE;
     }
     double doubleEst = estimateCombinedFee(2 * confTarget, DOUBLE_SUCCESS_PCT, !conservative, &tempResult);
     if (doubleEst > median) {
         median = doubleEst;
-        if (feeCalc) {
-            feeCalc->est = tempResult;
-            feeCalc->reason = FeeReason::DOUBLE_ESTIMATE;
-        }
+        answer.est = tempResult;
+        answer.reason = FeeReason::DOUBLE_ESTIMATE;
     }
 
     if (conservative || median == -1) {
         double consEst =  estimateConservativeFee(2 * confTarget, &tempResult);
         if (consEst > median) {
             median = consEst;
-            if (feeCalc) {
-                feeCalc->est = tempResult;
-                feeCalc->reason = FeeReason::CONSERVATIVE;
-            }
+            answer.est = tempResult;
+            answer.reason = FeeReason::CONSERVATIVE;
         }
     }
 
-    if (median < 0) return CFeeRate(0); // error condition
+    answer.feeRate = median < 0 ? CFeeRate(0) : CFeeRate(llround(median));
+}
 
-    return CFeeRate(llround(median));
+std::shared_ptr<const CBlockPolicyEstimator::SmartFeeTable> CBlockPolicyEstimator::GetSmartFeeTable() const
+{
+    {
+        LOCK(cs_smartFeeTable);
+        if (smartFeeTable) return smartFeeTable;
+    }
+
+    LOCK(cs_feeEstimator);
+    {
+        // Another caller may have computed it while we waited for cs_feeEstimator
+        LOCK(cs_smartFeeTable);
+        if (smartFeeTable) return smartFeeTable;
+    }
+
+    int64_t nTimeStart = GetTimeMicros();
+    std::shared_ptr<SmartFeeTable> table = std::make_shared<SmartFeeTable>();
+    table->maxTarget = longStats->GetMaxConfirms();
+    table->maxUsableEstimate = MaxUsableEstimate();
+    feeStats->UpdateUnconfirmedTotals(nBestSeenHeight);
+    shortStats->UpdateUnconfirmedTotals(nBestSeenHeight);
+    longStats->UpdateUnconfirmedTotals(nBestSeenHeight);
+    for (int conservative = 0; conservative < 2; conservative++) {
+        std::vector<SmartFeeAnswer>& answers = table->answers[conservative];
+        answers.resize(table->maxUsableEstimate + 1);
+        // Targets 0 and 1 are never looked up
+        for (unsigned int confTarget = 2; confTarget <= table->maxUsableEstimate; confTarget++) {
+            ComputeSmartFee(confTarget, conservative, answers[confTarget]);
+        }
+    }
+    LogPrint(BCLog::ESTIMATEFEE, "Blockpolicy computed smart fee estimates for %u targets at height %u in %.2fms\n",
+             table->maxUsableEstimate, nBestSeenHeight, (GetTimeMicros() - nTimeStart) * 0.001);
+
+    LOCK(cs_smartFeeTable);
+    smartFeeTable = table;
+    return smartFeeTable;
+}
+
+void CBlockPolicyEstimator::InvalidateSmartFeeTable()
+{
+    AssertLockHeld(cs_feeEstimator);
+    LOCK(cs_smartFeeTable);
+    smartFeeTable.reset();
+}
+
+CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, FeeCalculation *feeCalc, bool conservative) const
+{
+    if (feeCalc) {
+        feeCalc->desiredTarget = confTarget;
+        feeCalc->returnedTarget = confTarget;
+    }
+
+    std::shared_ptr<const SmartFeeTable> table = GetSmartFeeTable();
+
+    // Return failure if trying to analyze a target we're not tracking
+    if (confTarget <= 0 || (unsigned int)confTarget > table->maxTarget) {
+        return CFeeRate(0);  // error condition
+    }
+
+    // It's not possible to get reasonable estimates for confTarget of 1
+    if (confTarget == 1) confTarget = 2;
+
+    if ((unsigned int)confTarget > table->maxUsableEstimate) {
+        confTarget = table->maxUsableEstimate;
+    }
+    if (feeCalc) feeCalc->returnedTarget = confTarget;
+
+    if (confTarget <= 1) return CFeeRate(0); // error condition
+
+    const SmartFeeAnswer& answer = table->answers[conservative][confTarget];
+    if (feeCalc) {
+        feeCalc->est = answer.est;
+        feeCalc->reason = answer.reason;
+    }
+    return answer.feeRate;
 }
 
 
@@ -972,6 +1085,7 @@ bool CBlockPolicyEstimator::Read(CAutoFile& filein)
             nBestSeenHeight = nFileBestSeenHeight;
             historicalFirst = nFileHistoricalFirst;
             historicalBest = nFileHistoricalBest;
+            InvalidateSmartFeeTable();
         }
     }
     catch (const std::exception& e) {
@@ -12,6 +12,7 @@
 #include <sync.h>
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -64,6 +65,11 @@ class TxConfirmStats;
  * outstanding and use both of these numbers to increase the number of transactions
  * we've seen in that feerate bucket when calculating an estimate for any number
  * of confirmations below the number of blocks they've been outstanding.
+ *
+ * The answers of estimateSmartFee only change when a block is processed or
+ * when a transaction that has been outstanding for at least one block leaves
+ * the mempool, so they are computed for all targets at once on the first call
+ * after such a change and served from that table until the next one.
  */
 
 /* Identifier for each of the 3 different TxConfirmStats which will track
@@ -257,6 +263,32 @@ private:
 
     mutable CCriticalSection cs_feeEstimator;
 
+    struct SmartFeeAnswer
+    {
+        CFeeRate feeRate;
+        EstimationResult est;
+        FeeReason reason = FeeReason::NONE;
+    };
+
+    /** estimateSmartFee results for every usable target, in economical and conservative mode */
+    struct SmartFeeTable
+    {
+        unsigned int maxTarget = 0;
+        unsigned int maxUsableEstimate = 0;
+        std::vector<SmartFeeAnswer> answers[2]; // answers[conservative][confTarget]
+    };
+
+    /** Guards smartFeeTable, may be taken while holding cs_feeEstimator but not the other way around */
+    mutable CCriticalSection cs_smartFeeTable;
+    mutable std::shared_ptr<const SmartFeeTable> smartFeeTable;
+
+    /** Return the current table of estimateSmartFee results, computing it if needed */
+    std::shared_ptr<const SmartFeeTable> GetSmartFeeTable() const;
+    /** Drop the table of estimateSmartFee results after the data it was computed from changed */
+    void InvalidateSmartFeeTable();
+    /** Uncached estimateSmartFee for a target between 2 and MaxUsableEstimate() */
+    void ComputeSmartFee(unsigned int confTarget, bool conservative, SmartFeeAnswer& answer) const;
+
     /** Process a transaction confirmed in a block*/
     bool processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry* entry);
 
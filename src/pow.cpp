@@ -55,23 +55,11 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     return CalculateNextWorkRequired(pindexLast, pindexFirst->GetBlockTime(), params);
 }
 
-unsigned int CalculateNextWorkRequired(const CBlockIndex* pindexLast, int64_t nFirstBlockTime, const Consensus::Params& params)
+/** Scale the target of nBits by an already limited timespan */
+static unsigned int RetargetWork(unsigned int nBits, int64_t nActualTimespan, const Consensus::Params& params)
 {
-    if (params.fPowNoRetargeting)
-        return pindexLast->nBits;
-
-    // Limit adjustment step
-    int64_t nActualTimespan = pindexLast->GetBlockTime() - nFirstBlockTime;
-    if (nActualTimespan < params.nPowTargetTimespan/4)
-        nActualTimespan = params.nPowTargetTimespan/4;
-    if (nActualTimespan > params.nPowTargetTimespan*4)
-        nActualTimespan = params.nPowTargetTimespan*4;
-
-    // Retarget
     arith_uint256 bnNew;
-    arith_uint256 bnOld;
-    bnNew.SetCompact(pindexLast->nBits);
-    bnOld = bnNew;
+    bnNew.SetCompact(nBits);
     // Litecoin: intermediate uint256 can overflow by 1 bit
     const arith_uint256 bnPowLimit = UintToArith256(params.powLimit);
     bool fShift = bnNew.bits() > bnPowLimit.bits() - 1;
@@ -88,6 +76,38 @@ unsigned int CalculateNextWorkRequired(const CBlockIndex* pindexLast, int64_t nF
     return bnNew.GetCompact();
 }
 
+unsigned int CalculateNextWorkRequired(const CBlockIndex* pindexLast, int64_t nFirstBlockTime, const Consensus::Params& params)
+{
+    if (params.fPowNoRetargeting)
+        return pindexLast->nBits;
+
+    // Limit adjustment step
+    int64_t nActualTimespan = pindexLast->GetBlockTime() - nFirstBlockTime;
+    if (nActualTimespan < params.nPowTargetTimespan/4)
+        nActualTimespan = params.nPowTargetTimespan/4;
+    if (nActualTimespan > params.nPowTargetTimespan*4)
+        nActualTimespan = params.nPowTargetTimespan*4;
+
+    // Retarget
+    return RetargetWork(pindexLast->nBits, nActualTimespan, params);
+}
+
+bool PermittedDifficultyTransition(const Consensus::Params& params, int64_t nHeight, unsigned int nBitsOld, unsigned int nBitsNew)
+{
+    if (params.fPowAllowMinDifficultyBlocks)
+        return true;
+    if (params.fPowNoRetargeting || nHeight % params.DifficultyAdjustmentInterval() != 0)
+        return nBitsNew == nBitsOld;
+
+    // Anything between the targets of the shortest and the longest timespan
+    // the retarget allows, computed the same way
+    arith_uint256 bnNew, bnMin, bnMax;
+    bnNew.SetCompact(nBitsNew);
+    bnMin.SetCompact(RetargetWork(nBitsOld, params.nPowTargetTimespan/4, params));
+    bnMax.SetCompact(RetargetWork(nBitsOld, params.nPowTargetTimespan*4, params));
+    return bnNew >= bnMin && bnNew <= bnMax;
+}
+
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, const Consensus::Params& params)
 {
     bool fNegative;
@@ -20,4 +20,12 @@ unsigned int CalculateNextWorkRequired(const CBlockIndex* pindexLast, int64_t nF
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, const Consensus::Params&);
 
+/**
+ * Whether a header at nHeight may have nBitsNew when its predecessor has
+ * nBitsOld, as far as can be told without the timestamps of the headers
+ * before it: the target only changes at retargets, and then at most by the
+ * factor the timespan limits allow.
+ */
+bool PermittedDifficultyTransition(const Consensus::Params& params, int64_t nHeight, unsigned int nBitsOld, unsigned int nBitsNew);
+
 #endif // BITCOIN_POW_H
@@ -9,6 +9,8 @@
 #include <tinyformat.h>
 #include <utilstrencodings.h>
 
+#include <thread>
+
 std::string COutPoint::ToString() const
 {
     return strprintf("COutPoint(%s, %u)", hash.ToString().substr(0,10), n);
@@ -62,23 +64,50 @@ uint256 CMutableTransaction::GetHash() const
     return SerializeHash(*this, SER_GETHASH, SERIALIZE_TRANSACTION_NO_WITNESS);
 }
 
-uint256 CTransaction::ComputeHash() const
+uint256 CTransaction::ComputeHash(int nSerVersion) const
 {
-    return SerializeHash(*this, SER_GETHASH, SERIALIZE_TRANSACTION_NO_WITNESS);
+    return SerializeHash(*this, SER_GETHASH, nSerVersion);
+}
+
+const uint256& CTransaction::GetCachedHash(uint256& hashCached, std::atomic<uint8_t>& nState, int nSerVersion) const
+{
+    uint8_t nExpected = HASH_UNSET;
+    if (nState.compare_exchange_strong(nExpected, HASH_COMPUTING)) {
+        hashCached = ComputeHash(nSerVersion);
+        nState.store(HASH_SET, std::memory_order_release);
+        return hashCached;
+    }
+    // Another thread is computing it
+    while (nState.load(std::memory_order_acquire) != HASH_SET)
+        std::this_thread::yield();
+    return hashCached;
 }
 
-uint256 CTransaction::GetWitnessHash() const
+const uint256& CTransaction::GetWitnessHash() const
 {
+    if (nWitnessHashState.load(std::memory_order_acquire) == HASH_SET)
+        return m_witness_hash;
     if (!HasWitness()) {
         return GetHash();
     }
-    return SerializeHash(*this, SER_GETHASH, 0);
+    return GetCachedHash(m_witness_hash, nWitnessHashState, 0);
 }
 
 /* For backward compatibility, the hash is initialized to 0. TODO: remove the need for this default constructor entirely. */
-CTransaction::CTransaction() : vin(), vout(), nVersion(CTransaction::CURRENT_VERSION), nLockTime(0), hash() {}
-CTransaction::CTransaction(const CMutableTransaction &tx) : vin(tx.vin), vout(tx.vout), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash(ComputeHash()) {}
-CTransaction::CTransaction(CMutableTransaction &&tx) : vin(std::move(tx.vin)), vout(std::move(tx.vout)), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash(ComputeHash()) {}
+CTransaction::CTransaction() : vin(), vout(), nVersion(CTransaction::CURRENT_VERSION), nLockTime(0), hash(), m_witness_hash(), nHashState(HASH_SET), nWitnessHashState(HASH_SET) {}
+CTransaction::CTransaction(const CMutableTransaction &tx) : vin(tx.vin), vout(tx.vout), nVersion(tx.nVersion), nLockTime(tx.nLockTime), nHashState(HASH_UNSET), nWitnessHashState(HASH_UNSET) {}
+CTransaction::CTransaction(CMutableTransaction &&tx) : vin(std::move(tx.vin)), vout(std::move(tx.vout)), nVersion(tx.nVersion), nLockTime(tx.nLockTime), nHashState(HASH_UNSET), nWitnessHashState(HASH_UNSET) {}
+CTransaction::CTransaction(const CTransaction &tx) : vin(tx.vin), vout(tx.vout), nVersion(tx.nVersion), nLockTime(tx.nLockTime), nHashState(HASH_UNSET), nWitnessHashState(HASH_UNSET)
+{
+    if (tx.nHashState.load(std::memory_order_acquire) == HASH_SET) {
+        hash = tx.hash;
+        nHashState = HASH_SET;
+    }
+    if (tx.nWitnessHashState.load(std::memory_order_acquire) == HASH_SET) {
+        m_witness_hash = tx.m_witness_hash;
+        nWitnessHashState = HASH_SET;
+    }
+}
 
 CAmount CTransaction::GetValueOut() const
 {
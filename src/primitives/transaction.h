@@ -6,6 +6,7 @@
 #ifndef BITCOIN_PRIMITIVES_TRANSACTION_H
 #define BITCOIN_PRIMITIVES_TRANSACTION_H
 
+#include <atomic>
 #include <stdint.h>
 #include <amount.h>
 #include <script/script.h>
@@ -274,20 +275,27 @@ public:
     static const int32_t MAX_STANDARD_VERSION=2;
 
     // The local variables are made const to prevent unintended modification
-    // without updating the cached hash value. However, CTransaction is not
+    // without updating the cached hash values. However, CTransaction is not
     // actually immutable; deserialization and assignment are implemented,
     // and bypass the constness. This is safe, as they update the entire
-    // structure, including the hash.
+    // structure, including the hashes.
     const std::vector<CTxIn> vin;
     const std::vector<CTxOut> vout;
     const int32_t nVersion;
     const uint32_t nLockTime;
 
 private:
-    /** Memory only. */
-    const uint256 hash;
+    //! States of a hash that is computed on first use
+    enum : uint8_t { HASH_UNSET, HASH_COMPUTING, HASH_SET };
 
-    uint256 ComputeHash() const;
+    /** Memory only, computed on first use. */
+    mutable uint256 hash;
+    mutable uint256 m_witness_hash;
+    mutable std::atomic<uint8_t> nHashState;
+    mutable std::atomic<uint8_t> nWitnessHashState;
+
+    uint256 ComputeHash(int nSerVersion) const;
+    const uint256& GetCachedHash(uint256& hashCached, std::atomic<uint8_t>& nState, int nSerVersion) const;
 
 public:
     /** Construct a CTransaction that qualifies as IsNull() */
@@ -296,6 +304,7 @@ public:
     /** Convert a CMutableTransaction into a CTransaction. */
     CTransaction(const CMutableTransaction &tx);
     CTransaction(CMutableTransaction &&tx);
+    CTransaction(const CTransaction &tx);
 
     template <typename Stream>
     inline void Serialize(Stream& s) const {
@@ -312,11 +321,13 @@ public:
     }
 
     const uint256& GetHash() const {
-        return hash;
+        if (nHashState.load(std::memory_order_acquire) == HASH_SET)
+            return hash;
+        return GetCachedHash(hash, nHashState, SERIALIZE_TRANSACTION_NO_WITNESS);
     }
 
-    // Compute a hash that includes both transaction and witness data
-    uint256 GetWitnessHash() const;
+    // Hash that includes both transaction and witness data
+    const uint256& GetWitnessHash() const;
 
     // Return sum of txouts.
     CAmount GetValueOut() const;
@@ -337,12 +348,12 @@ public:
 
     friend bool operator==(const CTransaction& a, const CTransaction& b)
     {
-        return a.hash == b.hash;
+        return a.GetHash() == b.GetHash();
     }
 
     friend bool operator!=(const CTransaction& a, const CTransaction& b)
     {
-        return a.hash != b.hash;
+        return a.GetHash() != b.GetHash();
     }
 
     std::string ToString() const;
@@ -25,6 +25,7 @@
 #include <utilstrencodings.h>
 #include <hash.h>
 #include <validationinterface.h>
+#include <validationstats.h>
 #include <warnings.h>
 
 #include <stdint.h>
@@ -419,7 +420,9 @@ UniValue mempoolToJSON(bool fVerbose)
             const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             entryToJSON(info, e);
-            o.push_back(Pair(hash.ToString(), info));
+            // Mempool has unique entries so there is no advantage in using
+            // UniValue::pushKV, which checks if the key already exists in O(N).
+            o.__pushKV(hash.ToString(), info);
         }
         return o;
     }
@@ -468,6 +471,74 @@ UniValue getrawmempool(const JSONRPCRequest& request)
     return mempoolToJSON(fVerbose);
 }
 
+UniValue mempoolChangesToJSON(uint64_t nSequence)
+{
+    LOCK(mempool.cs);
+    UniValue ret(UniValue::VOBJ);
+    std::vector<MempoolChangeEntry> changes;
+    bool fComplete = mempool.GetChangesSince(nSequence, changes);
+    ret.push_back(Pair("sequence", (int64_t)mempool.GetChangeSequence()));
+    ret.push_back(Pair("complete", fComplete));
+    if (fComplete) {
+        UniValue a(UniValue::VARR);
+        for (const MempoolChangeEntry& change : changes) {
+            UniValue o(UniValue::VOBJ);
+            o.push_back(Pair("txid", change.txid.GetHex()));
+            o.push_back(Pair("action", change.fAdded ? "added" : "removed"));
+            if (!change.fAdded) {
+                o.push_back(Pair("reason", RemovalReasonToString(change.reason)));
+            }
+            a.push_back(o);
+        }
+        ret.push_back(Pair("changes", a));
+    } else {
+        UniValue a(UniValue::VARR);
+        for (const CTxMemPoolEntry& e : mempool.mapTx) {
+            a.push_back(e.GetTx().GetHash().GetHex());
+        }
+        ret.push_back(Pair("txids", a));
+    }
+    return ret;
+}
+
+UniValue getmempoolchanges(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "getmempoolchanges sequence\n"
+            "\nReturns the transactions added to and removed from the memory pool since the given sequence number.\n"
+            "\nPass the returned sequence to the next call to receive only newer changes. If the requested changes\n"
+            "are no longer available (only the last -mempoolchangelog changes are kept, and sequence numbers restart\n"
+            "from 0 when the node is restarted), the full set of transaction ids in the memory pool is returned instead.\n"
+            "\nArguments:\n"
+            "1. sequence        (numeric, required) The sequence number returned by a previous call, or 0\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"sequence\": n,              (numeric) The sequence number of the most recent change\n"
+            "  \"complete\": true|false,     (boolean) Whether all changes since the requested sequence are listed in \"changes\"\n"
+            "  \"changes\": [                (array) Present if complete is true. Changes in the order they happened\n"
+            "    {\n"
+            "      \"txid\": \"hash\",        (string) The transaction id\n"
+            "      \"action\": \"str\",       (string) \"added\" or \"removed\"\n"
+            "      \"reason\": \"str\"        (string) For removals: unknown, expiry, sizelimit, reorg, block, conflict or replaced\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"txids\": [                  (array) Present if complete is false. All transaction ids currently in the memory pool\n"
+            "    \"transactionid\", ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolchanges", "1000")
+            + HelpExampleRpc("getmempoolchanges", "1000")
+        );
+
+    int64_t nSequence = request.params[0].get_int64();
+    if (nSequence < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative sequence number");
+
+    return mempoolChangesToJSON(nSequence);
+}
+
 UniValue getmempoolancestors(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2) {
@@ -1402,6 +1473,105 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+UniValue mempoolFeeHistogramToJSON()
+{
+    std::vector<FeeHistogramBucket> histogram = mempool.GetFeeHistogram();
+    UniValue buckets(UniValue::VARR);
+    uint64_t nTotalSize = 0;
+    for (size_t i = 0; i < histogram.size(); i++) {
+        const FeeHistogramBucket& bucket = histogram[i];
+        if (bucket.nCount == 0) continue;
+        UniValue o(UniValue::VOBJ);
+        o.push_back(Pair("from_feerate", ValueFromAmount(bucket.nMinFeeRate)));
+        if (i + 1 < histogram.size()) {
+            o.push_back(Pair("to_feerate", ValueFromAmount(histogram[i + 1].nMinFeeRate)));
+        }
+        o.push_back(Pair("count", bucket.nCount));
+        o.push_back(Pair("size", bucket.nVSize));
+        o.push_back(Pair("fees", ValueFromAmount(bucket.nFees)));
+        buckets.push_back(o);
+        nTotalSize += bucket.nVSize;
+    }
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("size", nTotalSize));
+    ret.push_back(Pair("buckets", buckets));
+    return ret;
+}
+
+UniValue getmempoolfeehistogram(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getmempoolfeehistogram\n"
+            "\nReturns the distribution of the fee rates of the transactions in the memory pool.\n"
+            "Transactions are grouped by modified fee rate (including prioritisetransaction deltas) into exponentially\n"
+            "spaced buckets; buckets without transactions are omitted.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"size\": xxxxx,               (numeric) Sum of all virtual transaction sizes\n"
+            "  \"buckets\": [                 (array) Buckets in order of increasing fee rate\n"
+            "    {\n"
+            "      \"from_feerate\": x.xxxx,  (numeric) Lowest fee rate in the bucket, in " + CURRENCY_UNIT + "/kB\n"
+            "      \"to_feerate\": x.xxxx,    (numeric) Fee rate of the next bucket (absent for the last bucket), in " + CURRENCY_UNIT + "/kB\n"
+            "      \"count\": n,              (numeric) Number of transactions in the bucket\n"
+            "      \"size\": n,               (numeric) Sum of the virtual sizes of these transactions\n"
+            "      \"fees\": x.xxxx           (numeric) Sum of the modified fees of these transactions, in " + CURRENCY_UNIT + "\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolfeehistogram", "")
+            + HelpExampleRpc("getmempoolfeehistogram", "")
+        );
+
+    return mempoolFeeHistogramToJSON();
+}
+
+UniValue getmempoolfeerates(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "getmempoolfeerates [vsize,...]\n"
+            "\nReturns, for each given size, the fee rate a transaction needs to be ranked within that many virtual bytes\n"
+            "of the memory pool, walking it in the ancestor fee rate order used for block creation.\n"
+            "\nArguments:\n"
+            "1. vsizes          (json array, required) A json array of sizes in virtual bytes\n"
+            "     [\n"
+            "       n,          (numeric) Virtual size from the top of the memory pool\n"
+            "       ...\n"
+            "     ]\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"vsize\": n,                (numeric) The requested size\n"
+            "    \"feerate\": x.xxxx          (numeric) Fee rate in " + CURRENCY_UNIT + "/kB, 0 if the memory pool is smaller than vsize\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolfeerates", "\"[1000000, 4000000]\"")
+            + HelpExampleRpc("getmempoolfeerates", "[1000000, 4000000]")
+        );
+
+    const UniValue& vsizes = request.params[0].get_array();
+    std::vector<uint64_t> vTopSizes;
+    for (size_t i = 0; i < vsizes.size(); i++) {
+        int64_t nSize = vsizes[i].get_int64();
+        if (nSize < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative size");
+        vTopSizes.push_back(nSize);
+    }
+
+    std::vector<CFeeRate> feeRates = mempool.GetTopFeeRates(vTopSizes);
+    UniValue ret(UniValue::VARR);
+    for (size_t i = 0; i < vTopSizes.size(); i++) {
+        UniValue o(UniValue::VOBJ);
+        o.push_back(Pair("vsize", vTopSizes[i]));
+        o.push_back(Pair("feerate", ValueFromAmount(feeRates[i].GetFeePerK())));
+        ret.push_back(o);
+    }
+    return ret;
+}
+
 UniValue preciousblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1594,6 +1764,106 @@ UniValue getchaintxstats(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue getblockconnectstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw std::runtime_error(
+            "getblockconnectstats ( count )\n"
+            "\nReturns how long the phases of connecting blocks to the chain took, as a histogram per phase since\n"
+            "startup and for each of the most recently connected blocks. All times are in microseconds.\n"
+            "The phases are load, check, forks, connect, verify, index, callbacks, flush, chainstate, postconnect\n"
+            "and total. When blocks are connected together in a run, the load, verify, flush, chainstate,\n"
+            "postconnect and total phases are only measured for the whole run, and reported on its last block.\n"
+            "\nArguments:\n"
+            "1. count        (numeric, optional, default=10) The number of recent blocks to return, at most " + std::to_string(MAX_BLOCK_CONNECT_RECORDS) + "\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocks\": xxxxx,             (numeric) The number of blocks connected since startup\n"
+            "  \"phases\": {                  (json object) Keyed by phase\n"
+            "    \"phase\": {\n"
+            "      \"count\": xxxxx,          (numeric) The number of times the phase was measured\n"
+            "      \"total\": xxxxx,          (numeric) The time spent in the phase\n"
+            "      \"buckets\": [             (array) Non-empty buckets in order of increasing time\n"
+            "        {\n"
+            "          \"le\": xxxxx,         (numeric) The upper bound of the bucket (absent for the last bucket)\n"
+            "          \"count\": xxxxx       (numeric) The number of measurements in the bucket and above the previous one\n"
+            "        }, ...\n"
+            "      ]\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"recent\": [                  (array) The most recently connected blocks, oldest first\n"
+            "    {\n"
+            "      \"hash\": \"hash\",          (string) The block hash\n"
+            "      \"height\": xxxxx,         (numeric) The block height\n"
+            "      \"time\": xxxxx,           (numeric) When the block was connected, in seconds since epoch (Jan 1 1970 GMT)\n"
+            "      \"txs\": xxxxx,            (numeric) The number of transactions in the block\n"
+            "      \"inputs\": xxxxx,         (numeric) The number of transaction inputs in the block\n"
+            "      \"run_size\": xxxxx,       (numeric) The number of blocks connected in the same run\n"
+            "      \"phases\": {              (json object) The time spent in each phase measured for this block\n"
+            "        \"phase\": xxxxx, ...\n"
+            "      }\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockconnectstats", "")
+            + HelpExampleRpc("getblockconnectstats", "100")
+        );
+
+    int nRecords = 10;
+    if (!request.params[0].isNull()) {
+        nRecords = request.params[0].get_int();
+        if (nRecords < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    }
+
+    UniValue phases(UniValue::VOBJ);
+    std::array<BlockPhaseHistogram, NUM_BLOCK_PHASES> histograms = g_block_connect_stats.GetHistograms();
+    for (int i = 0; i < NUM_BLOCK_PHASES; i++) {
+        const BlockPhaseHistogram& histogram = histograms[i];
+        UniValue buckets(UniValue::VARR);
+        for (size_t j = 0; j < histogram.vCounts.size(); j++) {
+            if (histogram.vCounts[j] == 0) continue;
+            UniValue o(UniValue::VOBJ);
+            if (j < BLOCK_PHASE_BUCKET_BOUNDS.size()) {
+                o.push_back(Pair("le", BLOCK_PHASE_BUCKET_BOUNDS[j]));
+            }
+            o.push_back(Pair("count", histogram.vCounts[j]));
+            buckets.push_back(o);
+        }
+        UniValue phase(UniValue::VOBJ);
+        phase.push_back(Pair("count", histogram.nCount));
+        phase.push_back(Pair("total", histogram.nTotalMicros));
+        phase.push_back(Pair("buckets", buckets));
+        phases.push_back(Pair(GetBlockPhaseName((BlockConnectPhase)i), phase));
+    }
+
+    UniValue recent(UniValue::VARR);
+    for (const BlockConnectRecord& record : g_block_connect_stats.GetRecords(nRecords)) {
+        UniValue recordPhases(UniValue::VOBJ);
+        for (int i = 0; i < NUM_BLOCK_PHASES; i++) {
+            if (record.vPhaseMicros[i] >= 0) {
+                recordPhases.push_back(Pair(GetBlockPhaseName((BlockConnectPhase)i), record.vPhaseMicros[i]));
+            }
+        }
+        UniValue o(UniValue::VOBJ);
+        o.push_back(Pair("hash", record.hash.GetHex()));
+        o.push_back(Pair("height", record.nHeight));
+        o.push_back(Pair("time", record.nTime));
+        o.push_back(Pair("txs", (uint64_t)record.nTx));
+        o.push_back(Pair("inputs", (uint64_t)record.nInputs));
+        o.push_back(Pair("run_size", (uint64_t)record.nRunSize));
+        o.push_back(Pair("phases", recordPhases));
+        recent.push_back(o);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("blocks", g_block_connect_stats.GetBlockCount()));
+    ret.push_back(Pair("phases", phases));
+    ret.push_back(Pair("recent", recent));
+    return ret;
+}
+
 UniValue savemempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0) {
@@ -1618,6 +1888,7 @@ static const CRPCCommand commands[] =
   //  --------------------- ------------------------  -----------------------  ----------
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      {} },
     { "blockchain",         "getchaintxstats",        &getchaintxstats,        {"nblocks", "blockhash"} },
+    { "blockchain",         "getblockconnectstats",   &getblockconnectstats,   {"count"} },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       {} },
     { "blockchain",         "getblockcount",          &getblockcount,          {} },
     { "blockchain",         "getblock",               &getblock,               {"blockhash","verbosity|verbose"} },
@@ -1626,8 +1897,11 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getchaintips",           &getchaintips,           {} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          {} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    {"txid","verbose"} },
+    { "blockchain",         "getmempoolchanges",      &getmempoolchanges,      {"sequence"} },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  {"txid","verbose"} },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        {"txid"} },
+    { "blockchain",         "getmempoolfeehistogram", &getmempoolfeehistogram, {} },
+    { "blockchain",         "getmempoolfeerates",     &getmempoolfeerates,     {"vsizes"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
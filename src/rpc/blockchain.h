@@ -5,6 +5,8 @@
 #ifndef BITCOIN_RPC_BLOCKCHAIN_H
 #define BITCOIN_RPC_BLOCKCHAIN_H
 
+#include <stdint.h>
+
 class CBlock;
 class CBlockIndex;
 class UniValue;
@@ -30,6 +32,12 @@ UniValue mempoolInfoToJSON();
 /** Mempool to JSON */
 UniValue mempoolToJSON(bool fVerbose = false);
 
+/** Mempool fee rate histogram to JSON */
+UniValue mempoolFeeHistogramToJSON();
+
+/** Mempool additions and removals after the given change sequence number to JSON */
+UniValue mempoolChangesToJSON(uint64_t nSequence);
+
 /** Block header to JSON */
 UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
@@ -85,6 +85,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblock", 1, "verbose" },
     { "getblockheader", 1, "verbose" },
     { "getchaintxstats", 0, "nblocks" },
+    { "getblockconnectstats", 0, "count" },
     { "gettransaction", 1, "include_watchonly" },
     { "getrawtransaction", 1, "verbose" },
     { "createrawtransaction", 0, "inputs" },
@@ -124,10 +125,13 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "setban", 3, "absolute" },
     { "setnetworkactive", 0, "state" },
     { "getmempoolancestors", 1, "verbose" },
+    { "getmempoolchanges", 0, "sequence" },
     { "getmempooldescendants", 1, "verbose" },
+    { "getmempoolfeerates", 0, "vsizes" },
     { "bumpfee", 1, "options" },
     { "logging", 0, "include" },
     { "logging", 1, "exclude" },
+    { "setsigcachesize", 0, "size" },
     { "disconnectnode", 1, "nodeid" },
     { "addwitnessaddress", 1, "p2sh" },
     // Echo with conversion (For testing only)
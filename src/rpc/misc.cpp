@@ -16,6 +16,7 @@
 #include <rpc/blockchain.h>
 #include <rpc/server.h>
 #include <rpc/util.h>
+#include <script/sigcache.h>
 #include <timedata.h>
 #include <util.h>
 #include <utilstrencodings.h>
@@ -610,6 +611,90 @@ UniValue logging(const JSONRPCRequest& request)
     return result;
 }
 
+static UniValue SigCacheStatsToJSON(const SigCacheStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("elements", (uint64_t)stats.nElements);
+    obj.pushKV("bytes", (uint64_t)stats.nBytes);
+    obj.pushKV("shards", stats.nShards);
+    obj.pushKV("hits", stats.nHits);
+    obj.pushKV("misses", stats.nMisses);
+    obj.pushKV("inserts", stats.nInserts);
+    obj.pushKV("evictions", stats.nEvictions);
+    return obj;
+}
+
+static UniValue SigCacheInfo()
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("signatures", SigCacheStatsToJSON(GetSignatureCacheStats()));
+    obj.pushKV("scripts", SigCacheStatsToJSON(GetScriptExecutionCacheStats()));
+    return obj;
+}
+
+static const std::string SIG_CACHE_INFO_RESULT =
+    "{\n"
+    "  \"signatures\": {          (json object) The signature cache\n"
+    "    \"elements\": xxxxx,     (numeric) Number of entries the cache can hold\n"
+    "    \"bytes\": xxxxx,        (numeric) Memory used by the cache\n"
+    "    \"shards\": xxxxx,       (numeric) Number of independently locked shards\n"
+    "    \"hits\": xxxxx,         (numeric) Lookups that found their entry since the cache was last sized\n"
+    "    \"misses\": xxxxx,       (numeric) Lookups that didn't\n"
+    "    \"inserts\": xxxxx,      (numeric) Entries added\n"
+    "    \"evictions\": xxxxx,    (numeric) Live entries dropped to make room for new ones, not counting\n"
+    "                              entries erased on use or aged out\n"
+    "  },\n"
+    "  \"scripts\": {             (json object) The script execution cache, same fields as above\n"
+    "    ...\n"
+    "  }\n"
+    "}\n";
+
+UniValue getsigcacheinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getsigcacheinfo\n"
+            "Returns the size and usage counters of the signature and script execution caches.\n"
+            "\nResult:\n"
+            + SIG_CACHE_INFO_RESULT +
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    return SigCacheInfo();
+}
+
+UniValue setsigcachesize(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "setsigcachesize size\n"
+            "Replaces the signature and script execution caches with empty ones that together use at most size MiB,\n"
+            "as -maxsigcachesize does at startup. Their counters are reset.\n"
+            "\nArguments:\n"
+            "1. size    (numeric, required) The combined size of the caches in MiB\n"
+            "\nResult:\n"
+            "The new cache information, as returned by getsigcacheinfo\n"
+            "\nExamples:\n"
+            + HelpExampleCli("setsigcachesize", "64")
+            + HelpExampleRpc("setsigcachesize", "64")
+        );
+
+    int64_t nSize = request.params[0].get_int64();
+    if (nSize < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cache size must not be negative");
+    size_t nBytes = GetSigCacheBytes(nSize);
+    {
+        // Both caches end up with the size of the same call
+        static CCriticalSection cs_resize;
+        LOCK(cs_resize);
+        ResizeSignatureCache(nBytes);
+        ResizeScriptExecutionCache(nBytes);
+    }
+    return SigCacheInfo();
+}
+
 UniValue echo(const JSONRPCRequest& request)
 {
     if (request.fHelp)
@@ -640,6 +725,8 @@ static const CRPCCommand commands[] =
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getmemoryinfo",          &getmemoryinfo,          {"mode"} },
     { "control",            "logging",                &logging,                {"include", "exclude"}},
+    { "control",            "getsigcacheinfo",        &getsigcacheinfo,        {} },
+    { "control",            "setsigcachesize",        &setsigcachesize,        {"size"} },
     { "util",               "validateaddress",        &validateaddress,        {"address"} }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         {"nrequired","keys"} },
     { "util",               "verifymessage",          &verifymessage,          {"address","signature","message"} },
@@ -101,6 +101,11 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"blocks_downloaded\": n,    (numeric) The number of blocks we requested and received from this peer\n"
+            "    \"block_bytes_downloaded\": n, (numeric) The total size of those blocks\n"
+            "    \"block_download_rate\": n,  (numeric) The recent rate in bytes per second at which the peer sent blocks we requested\n"
+            "    \"block_download_window\": n, (numeric) The number of blocks we may have in flight from this peer, sized to that rate\n"
+            "    \"blocks_reassigned\": n,    (numeric) The number of blocks in flight from this peer that we requested from a faster peer instead\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
@@ -167,6 +172,11 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("blocks_downloaded", statestats.nBlocksDownloaded));
+            obj.push_back(Pair("block_bytes_downloaded", statestats.nBlockBytesDownloaded));
+            obj.push_back(Pair("block_download_rate", statestats.dBlockDownloadRate));
+            obj.push_back(Pair("block_download_window", statestats.nBlockDownloadWindow));
+            obj.push_back(Pair("blocks_reassigned", statestats.nBlocksReassigned));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
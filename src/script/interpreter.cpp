@@ -3,17 +3,28 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
 #include <script/interpreter.h>
 
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
+#include <prevector.h>
 #include <pubkey.h>
 #include <script/script.h>
 #include <uint256.h>
 
 typedef std::vector<unsigned char> valtype;
 
+/**
+ * Stack element used by VerifyScript(), which keeps signatures and public
+ * keys inline rather than allocating each of them on the heap.
+ */
+typedef prevector<76, unsigned char> smallvaltype;
+
 namespace {
 
 inline bool set_success(ScriptError* ret)
@@ -32,7 +43,8 @@ inline bool set_error(ScriptError* ret, const ScriptError serror)
 
 } // namespace
 
-bool CastToBool(const valtype& vch)
+template <typename T>
+static bool CastToBool(const T& vch)
 {
     for (unsigned int i = 0; i < vch.size(); i++)
     {
@@ -53,14 +65,16 @@ bool CastToBool(const valtype& vch)
  */
 #define stacktop(i)  (stack.at(stack.size()+(i)))
 #define altstacktop(i)  (altstack.at(altstack.size()+(i)))
-static inline void popstack(std::vector<valtype>& stack)
+template <typename T>
+static inline void popstack(std::vector<T>& stack)
 {
     if (stack.empty())
         throw std::runtime_error("popstack(): stack empty");
     stack.pop_back();
 }
 
-bool static IsCompressedOrUncompressedPubKey(const valtype &vchPubKey) {
+template <typename T>
+bool static IsCompressedOrUncompressedPubKey(const T &vchPubKey) {
     if (vchPubKey.size() < 33) {
         //  Non-canonical public key: too short
         return false;
@@ -82,7 +96,8 @@ bool static IsCompressedOrUncompressedPubKey(const valtype &vchPubKey) {
     return true;
 }
 
-bool static IsCompressedPubKey(const valtype &vchPubKey) {
+template <typename T>
+bool static IsCompressedPubKey(const T &vchPubKey) {
     if (vchPubKey.size() != 33) {
         //  Non-canonical public key: invalid length for compressed key
         return false;
@@ -104,7 +119,8 @@ bool static IsCompressedPubKey(const valtype &vchPubKey) {
  *
  * This function is consensus-critical since BIP66.
  */
-bool static IsValidSignatureEncoding(const std::vector<unsigned char> &sig) {
+template <typename T>
+bool static IsValidSignatureEncoding(const T &sig) {
     // Format: 0x30 [total-length] 0x02 [R-length] [R] 0x02 [S-length] [S] [sighash]
     // * total-length: 1-byte length descriptor of everything that follows,
     //   excluding the sighash byte.
@@ -169,7 +185,8 @@ bool static IsValidSignatureEncoding(const std::vector<unsigned char> &sig) {
     return true;
 }
 
-bool static IsLowDERSignature(const valtype &vchSig, ScriptError* serror) {
+template <typename T>
+bool static IsLowDERSignature(const T &vchSig, ScriptError* serror) {
     if (!IsValidSignatureEncoding(vchSig)) {
         return set_error(serror, SCRIPT_ERR_SIG_DER);
     }
@@ -186,7 +203,8 @@ bool static IsLowDERSignature(const valtype &vchSig, ScriptError* serror) {
     return true;
 }
 
-bool static IsDefinedHashtypeSignature(const valtype &vchSig) {
+template <typename T>
+bool static IsDefinedHashtypeSignature(const T &vchSig) {
     if (vchSig.size() == 0) {
         return false;
     }
@@ -197,7 +215,8 @@ bool static IsDefinedHashtypeSignature(const valtype &vchSig) {
     return true;
 }
 
-bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror) {
+template <typename T>
+bool static CheckSignatureEncoding(const T &vchSig, unsigned int flags, ScriptError* serror) {
     // Empty signature. Not strictly DER encoded, but allowed to provide a
     // compact way to provide an invalid signature for use with CHECK(MULTI)SIG
     if (vchSig.size() == 0) {
@@ -214,7 +233,12 @@ bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned i
     return true;
 }
 
-bool static CheckPubKeyEncoding(const valtype &vchPubKey, unsigned int flags, const SigVersion &sigversion, ScriptError* serror) {
+bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror) {
+    return CheckSignatureEncoding<valtype>(vchSig, flags, serror);
+}
+
+template <typename T>
+bool static CheckPubKeyEncoding(const T &vchPubKey, unsigned int flags, const SigVersion &sigversion, ScriptError* serror) {
     if ((flags & SCRIPT_VERIFY_STRICTENC) != 0 && !IsCompressedOrUncompressedPubKey(vchPubKey)) {
         return set_error(serror, SCRIPT_ERR_PUBKEYTYPE);
     }
@@ -225,7 +249,8 @@ bool static CheckPubKeyEncoding(const valtype &vchPubKey, unsigned int flags, co
     return true;
 }
 
-bool static CheckMinimalPush(const valtype& data, opcodetype opcode) {
+template <typename T>
+bool static CheckMinimalPush(const T& data, opcodetype opcode) {
     if (data.size() == 0) {
         // Could have used OP_0.
         return opcode == OP_0;
@@ -248,23 +273,46 @@ bool static CheckMinimalPush(const valtype& data, opcodetype opcode) {
     return true;
 }
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
+static inline void pushnum(std::vector<valtype>& stack, const CScriptNum& bn)
+{
+    stack.push_back(bn.getvch());
+}
+
+template <typename T>
+static inline void pushnum(std::vector<T>& stack, const CScriptNum& bn)
+{
+    valtype vch = bn.getvch();
+    stack.emplace_back(vch.begin(), vch.end());
+}
+
+static inline const valtype& tovector(const valtype& vch)
+{
+    return vch;
+}
+
+static inline valtype tovector(const smallvaltype& vch)
+{
+    return valtype(vch.begin(), vch.end());
+}
+
+template <typename T>
+static bool EvalScript(std::vector<T>& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
 {
     static const CScriptNum bnZero(0);
     static const CScriptNum bnOne(1);
     // static const CScriptNum bnFalse(0);
     // static const CScriptNum bnTrue(1);
-    static const valtype vchFalse(0);
-    // static const valtype vchZero(0);
-    static const valtype vchTrue(1, 1);
+    static const T vchFalse;
+    // static const T vchZero(0);
+    static const T vchTrue(1, (unsigned char)1);
 
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
-    valtype vchPushValue;
+    T vchPushValue;
     std::vector<bool> vfExec;
-    std::vector<valtype> altstack;
+    std::vector<T> altstack;
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
     if (script.size() > MAX_SCRIPT_SIZE)
         return set_error(serror, SCRIPT_ERR_SCRIPT_SIZE);
@@ -337,7 +385,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                 {
                     // ( -- value)
                     CScriptNum bn((int)opcode - (int)(OP_1 - 1));
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                     // The result of these opcodes should always be the minimal way to push the data
                     // they push, so no need for a CheckMinimalPush here.
                 }
@@ -440,7 +488,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     {
                         if (stack.size() < 1)
                             return set_error(serror, SCRIPT_ERR_UNBALANCED_CONDITIONAL);
-                        valtype& vch = stacktop(-1);
+                        T& vch = stacktop(-1);
                         if (sigversion == SIGVERSION_WITNESS_V0 && (flags & SCRIPT_VERIFY_MINIMALIF)) {
                             if (vch.size() > 1)
                                 return set_error(serror, SCRIPT_ERR_MINIMALIF);
@@ -529,8 +577,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 -- x1 x2 x1 x2)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
+                    T vch1 = stacktop(-2);
+                    T vch2 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -541,9 +589,9 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 x3 -- x1 x2 x3 x1 x2 x3)
                     if (stack.size() < 3)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-3);
-                    valtype vch2 = stacktop(-2);
-                    valtype vch3 = stacktop(-1);
+                    T vch1 = stacktop(-3);
+                    T vch2 = stacktop(-2);
+                    T vch3 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                     stack.push_back(vch3);
@@ -555,8 +603,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 x3 x4 -- x1 x2 x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-4);
-                    valtype vch2 = stacktop(-3);
+                    T vch1 = stacktop(-4);
+                    T vch2 = stacktop(-3);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -567,8 +615,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
                     if (stack.size() < 6)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
+                    T vch1 = stacktop(-6);
+                    T vch2 = stacktop(-5);
                     stack.erase(stack.end()-6, stack.end()-4);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
@@ -580,8 +628,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 x3 x4 -- x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    swap(stacktop(-4), stacktop(-2));
-                    swap(stacktop(-3), stacktop(-1));
+                    std::swap(stacktop(-4), stacktop(-2));
+                    std::swap(stacktop(-3), stacktop(-1));
                 }
                 break;
 
@@ -590,7 +638,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x - 0 | x x)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
+                    T vch = stacktop(-1);
                     if (CastToBool(vch))
                         stack.push_back(vch);
                 }
@@ -600,7 +648,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                 {
                     // -- stacksize
                     CScriptNum bn(stack.size());
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                 }
                 break;
 
@@ -618,7 +666,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x -- x x)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
+                    T vch = stacktop(-1);
                     stack.push_back(vch);
                 }
                 break;
@@ -637,7 +685,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 -- x1 x2 x1)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-2);
+                    T vch = stacktop(-2);
                     stack.push_back(vch);
                 }
                 break;
@@ -653,7 +701,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     popstack(stack);
                     if (n < 0 || n >= (int)stack.size())
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-n-1);
+                    T vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
                         stack.erase(stack.end()-n-1);
                     stack.push_back(vch);
@@ -667,8 +715,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     //  x2 x3 x1  after second swap
                     if (stack.size() < 3)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    swap(stacktop(-3), stacktop(-2));
-                    swap(stacktop(-2), stacktop(-1));
+                    std::swap(stacktop(-3), stacktop(-2));
+                    std::swap(stacktop(-2), stacktop(-1));
                 }
                 break;
 
@@ -677,7 +725,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 -- x2 x1)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    swap(stacktop(-2), stacktop(-1));
+                    std::swap(stacktop(-2), stacktop(-1));
                 }
                 break;
 
@@ -686,7 +734,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 -- x2 x1 x2)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
+                    T vch = stacktop(-1);
                     stack.insert(stack.end()-2, vch);
                 }
                 break;
@@ -698,7 +746,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     CScriptNum bn(stacktop(-1).size());
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                 }
                 break;
 
@@ -713,8 +761,8 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (x1 x2 - bool)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    T& vch1 = stacktop(-2);
+                    T& vch2 = stacktop(-1);
                     bool fEqual = (vch1 == vch2);
                     // OP_NOTEQUAL is disabled because it would be too easy to say
                     // something like n != 1 and have some wiseguy pass in 1 with extra
@@ -760,7 +808,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     default:            assert(!"invalid opcode"); break;
                     }
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
                 }
                 break;
 
@@ -809,7 +857,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     }
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, bn);
 
                     if (opcode == OP_NUMEQUALVERIFY)
                     {
@@ -850,8 +898,9 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // (in -- hash)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    T& vch = stacktop(-1);
+                    T vchHash;
+                    vchHash.resize((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
                     if (opcode == OP_RIPEMD160)
                         CRIPEMD160().Write(vch.data(), vch.size()).Finalize(vchHash.data());
                     else if (opcode == OP_SHA1)
@@ -881,22 +930,22 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
 
-                    valtype& vchSig    = stacktop(-2);
-                    valtype& vchPubKey = stacktop(-1);
+                    T& vchSig    = stacktop(-2);
+                    T& vchPubKey = stacktop(-1);
 
                     // Subset of script starting at the most recent codeseparator
                     CScript scriptCode(pbegincodehash, pend);
 
                     // Drop the signature in pre-segwit scripts but not segwit scripts
                     if (sigversion == SIGVERSION_BASE) {
-                        scriptCode.FindAndDelete(CScript(vchSig));
+                        scriptCode.FindAndDelete(CScript(tovector(vchSig)));
                     }
 
                     if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, sigversion, serror)) {
                         //serror is set
                         return false;
                     }
-                    bool fSuccess = checker.CheckSig(vchSig, vchPubKey, scriptCode, sigversion);
+                    bool fSuccess = checker.CheckSig(tovector(vchSig), tovector(vchPubKey), scriptCode, sigversion);
 
                     if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) && vchSig.size())
                         return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
@@ -951,17 +1000,16 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                     // Drop the signature in pre-segwit scripts but not segwit scripts
                     for (int k = 0; k < nSigsCount; k++)
                     {
-                        valtype& vchSig = stacktop(-isig-k);
                         if (sigversion == SIGVERSION_BASE) {
-                            scriptCode.FindAndDelete(CScript(vchSig));
+                            scriptCode.FindAndDelete(CScript(tovector(stacktop(-isig-k))));
                         }
                     }
 
                     bool fSuccess = true;
                     while (fSuccess && nSigsCount > 0)
                     {
-                        valtype& vchSig    = stacktop(-isig);
-                        valtype& vchPubKey = stacktop(-ikey);
+                        T& vchSig    = stacktop(-isig);
+                        T& vchPubKey = stacktop(-ikey);
 
                         // Note how this makes the exact order of pubkey/signature evaluation
                         // distinguishable by CHECKMULTISIG NOT if the STRICTENC flag is set.
@@ -972,7 +1020,7 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
                         }
 
                         // Check signature
-                        bool fOk = checker.CheckSig(vchSig, vchPubKey, scriptCode, sigversion);
+                        bool fOk = checker.CheckSig(tovector(vchSig), tovector(vchPubKey), scriptCode, sigversion);
 
                         if (fOk) {
                             isig++;
@@ -1042,6 +1090,11 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
     return set_success(serror);
 }
 
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* serror)
+{
+    return EvalScript<valtype>(stack, script, flags, checker, sigversion, serror);
+}
+
 namespace {
 
 /**
@@ -1139,6 +1192,38 @@ public:
     }
 };
 
+/** Stream that hashes the data serialized into it */
+class CSHA256Writer
+{
+private:
+    CSHA256& sha;
+
+public:
+    explicit CSHA256Writer(CSHA256& shaIn) : sha(shaIn) {}
+    void write(const char* pch, size_t nSize) { sha.Write((const unsigned char*)pch, nSize); }
+    int GetType() const { return SER_GETHASH; }
+    int GetVersion() const { return 0; }
+};
+
+/** Stream that appends the data serialized into it to a byte vector */
+class CByteVectorWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+
+public:
+    explicit CByteVectorWriter(std::vector<unsigned char>& vchIn) : vch(vchIn) {}
+    void write(const char* pch, size_t nSize) { vch.insert(vch.end(), pch, pch + nSize); }
+    int GetType() const { return SER_GETHASH; }
+    int GetVersion() const { return 0; }
+};
+
+/** Number of inputs between the SHA256 midstates kept for legacy signature hashes */
+const unsigned int LEGACY_SIGHASH_MIDSTATE_INTERVAL = 16;
+/** Size of a serialized prevout, and of an input with an empty script */
+const size_t PREVOUT_SIZE = 36;
+const size_t BLANK_INPUT_SIZE = PREVOUT_SIZE + 1 + 4;
+
 uint256 GetPrevoutHash(const CTransaction& txTo) {
     CHashWriter ss(SER_GETHASH, 0);
     for (const auto& txin : txTo.vin) {
@@ -1165,6 +1250,30 @@ uint256 GetOutputsHash(const CTransaction& txTo) {
 
 } // namespace
 
+LegacySighashCache::LegacySighashCache(const CTransaction& txTo)
+{
+    CByteVectorWriter inputs(vInputs);
+    vInputs.reserve(txTo.vin.size() * BLANK_INPUT_SIZE);
+    for (const CTxIn& txin : txTo.vin) {
+        ::Serialize(inputs, txin.prevout);
+        ::Serialize(inputs, CScript());
+        ::Serialize(inputs, txin.nSequence);
+    }
+    CByteVectorWriter outputs(vOutputs);
+    ::Serialize(outputs, txTo.vout);
+    ::Serialize(outputs, txTo.nLockTime);
+
+    CSHA256 sha;
+    CSHA256Writer hasher(sha);
+    ::Serialize(hasher, txTo.nVersion);
+    ::WriteCompactSize(hasher, txTo.vin.size());
+    const size_t nInterval = LEGACY_SIGHASH_MIDSTATE_INTERVAL * BLANK_INPUT_SIZE;
+    for (size_t nPos = 0; nPos < vInputs.size(); nPos += nInterval) {
+        vMidstates.push_back(sha);
+        sha.Write(vInputs.data() + nPos, std::min(nInterval, vInputs.size() - nPos));
+    }
+}
+
 PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
 {
     // Cache is calculated only for transactions with witness
@@ -1174,6 +1283,23 @@ PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
         hashOutputs = GetOutputsHash(txTo);
         ready = true;
     }
+
+    // Inputs with a witness don't use the legacy signature hash
+    size_t nLegacyInputs = std::count_if(txTo.vin.begin(), txTo.vin.end(), [](const CTxIn& txin) { return txin.scriptWitness.IsNull(); });
+    legacyCacheable = nLegacyInputs > 1;
+}
+
+std::shared_ptr<const LegacySighashCache> PrecomputedTransactionData::GetLegacyCache(const CTransaction& txTo) const
+{
+    std::shared_ptr<const LegacySighashCache> cache = std::atomic_load(&legacyCache);
+    if (cache)
+        return cache;
+    // Script checks of the same transaction may get here at the same time;
+    // all of them use the cache that is stored first.
+    std::shared_ptr<const LegacySighashCache> built = std::make_shared<const LegacySighashCache>(txTo);
+    if (std::atomic_compare_exchange_strong(&legacyCache, &cache, built))
+        return built;
+    return cache;
 }
 
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
@@ -1239,6 +1365,30 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    if (cache && cache->legacyCacheable && !(nHashType & SIGHASH_ANYONECANPAY) && (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        // Only the scriptCode of the input being signed differs from the
+        // serialization the cache holds: continue from the last midstate
+        // before the input, and hash the rest of it as it is.
+        std::shared_ptr<const LegacySighashCache> legacy = cache->GetLegacyCache(txTo);
+        const std::vector<unsigned char>& vInputs = legacy->vInputs;
+        const size_t nMidstate = nIn / LEGACY_SIGHASH_MIDSTATE_INTERVAL;
+        const size_t nPos = nIn * BLANK_INPUT_SIZE;
+        const size_t nMidstatePos = nMidstate * LEGACY_SIGHASH_MIDSTATE_INTERVAL * BLANK_INPUT_SIZE;
+        CSHA256 sha(legacy->vMidstates[nMidstate]);
+        CSHA256Writer hasher(sha);
+        sha.Write(vInputs.data() + nMidstatePos, nPos - nMidstatePos);
+        sha.Write(vInputs.data() + nPos, PREVOUT_SIZE);
+        txTmp.SerializeScriptCode(hasher);
+        sha.Write(vInputs.data() + nPos + PREVOUT_SIZE + 1, 4);
+        sha.Write(vInputs.data() + nPos + BLANK_INPUT_SIZE, vInputs.size() - nPos - BLANK_INPUT_SIZE);
+        sha.Write(legacy->vOutputs.data(), legacy->vOutputs.size());
+        ::Serialize(hasher, nHashType);
+        uint256 hash;
+        sha.Finalize(hash.begin());
+        CSHA256().Write(hash.begin(), CSHA256::OUTPUT_SIZE).Finalize(hash.begin());
+        return hash;
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
@@ -1353,9 +1503,28 @@ bool TransactionSignatureChecker::CheckSequence(const CScriptNum& nSequence) con
     return true;
 }
 
-static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion, const std::vector<unsigned char>& program, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+namespace {
+
+/**
+ * The stacks VerifyScript() works on. Each thread keeps its own, so that the
+ * memory of the stacks is reused from one input to the next.
+ */
+struct ScriptStacks
+{
+    std::vector<smallvaltype> stack, stackCopy, witnessStack;
+
+    void clear()
+    {
+        stack.clear();
+        stackCopy.clear();
+        witnessStack.clear();
+    }
+};
+
+} // namespace
+
+static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion, const std::vector<unsigned char>& program, unsigned int flags, const BaseSignatureChecker& checker, std::vector<smallvaltype>& stack, ScriptError* serror)
 {
-    std::vector<std::vector<unsigned char> > stack;
     CScript scriptPubKey;
 
     if (witversion == 0) {
@@ -1365,7 +1534,8 @@ static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion,
                 return set_error(serror, SCRIPT_ERR_WITNESS_PROGRAM_WITNESS_EMPTY);
             }
             scriptPubKey = CScript(witness.stack.back().begin(), witness.stack.back().end());
-            stack = std::vector<std::vector<unsigned char> >(witness.stack.begin(), witness.stack.end() - 1);
+            for (auto it = witness.stack.begin(); it != witness.stack.end() - 1; ++it)
+                stack.emplace_back(it->begin(), it->end());
             uint256 hashScriptPubKey;
             CSHA256().Write(&scriptPubKey[0], scriptPubKey.size()).Finalize(hashScriptPubKey.begin());
             if (memcmp(hashScriptPubKey.begin(), program.data(), 32)) {
@@ -1377,7 +1547,8 @@ static bool VerifyWitnessProgram(const CScriptWitness& witness, int witversion,
                 return set_error(serror, SCRIPT_ERR_WITNESS_PROGRAM_MISMATCH); // 2 items in witness
             }
             scriptPubKey << OP_DUP << OP_HASH160 << program << OP_EQUALVERIFY << OP_CHECKSIG;
-            stack = witness.stack;
+            for (const auto& item : witness.stack)
+                stack.emplace_back(item.begin(), item.end());
         } else {
             return set_error(serror, SCRIPT_ERR_WITNESS_PROGRAM_WRONG_LENGTH);
         }
@@ -1420,7 +1591,14 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY);
     }
 
-    std::vector<std::vector<unsigned char> > stack, stackCopy;
+#ifdef HAVE_THREAD_LOCAL
+    static thread_local ScriptStacks stacks;
+#else
+    ScriptStacks stacks;
+#endif
+    stacks.clear();
+    std::vector<smallvaltype>& stack = stacks.stack;
+    std::vector<smallvaltype>& stackCopy = stacks.stackCopy;
     if (!EvalScript(stack, scriptSig, flags, checker, SIGVERSION_BASE, serror))
         // serror is set
         return false;
@@ -1444,7 +1622,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
                 // The scriptSig must be _exactly_ CScript(), otherwise we reintroduce malleability.
                 return set_error(serror, SCRIPT_ERR_WITNESS_MALLEATED);
             }
-            if (!VerifyWitnessProgram(*witness, witnessversion, witnessprogram, flags, checker, serror)) {
+            if (!VerifyWitnessProgram(*witness, witnessversion, witnessprogram, flags, checker, stacks.witnessStack, serror)) {
                 return false;
             }
             // Bypass the cleanstack check at the end. The actual stack is obviously not clean
@@ -1468,8 +1646,8 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         // an empty stack and the EvalScript above would return false.
         assert(!stack.empty());
 
-        const valtype& pubKeySerialized = stack.back();
-        CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
+        const smallvaltype& pubKeySerialized = stack.back();
+        CScript pubKey2(pubKeySerialized.data(), pubKeySerialized.data() + pubKeySerialized.size());
         popstack(stack);
 
         if (!EvalScript(stack, pubKey2, flags, checker, SIGVERSION_BASE, serror))
@@ -1489,7 +1667,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
                     // reintroduce malleability.
                     return set_error(serror, SCRIPT_ERR_WITNESS_MALLEATED_P2SH);
                 }
-                if (!VerifyWitnessProgram(*witness, witnessversion, witnessprogram, flags, checker, serror)) {
+                if (!VerifyWitnessProgram(*witness, witnessversion, witnessprogram, flags, checker, stacks.witnessStack, serror)) {
                     return false;
                 }
                 // Bypass the cleanstack check at the end. The actual stack is obviously not clean
@@ -1525,6 +1703,168 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
     return set_success(serror);
 }
 
+namespace {
+
+/** Read a push from a scriptSig that EvalScript() would accept. */
+bool GetStandardPush(const CScript& script, CScript::const_iterator& pc, valtype& vch, unsigned int flags)
+{
+    opcodetype opcode;
+    if (!script.GetOp(pc, opcode, vch) || opcode > OP_PUSHDATA4 || vch.size() > MAX_SCRIPT_ELEMENT_SIZE)
+        return false;
+    return (flags & SCRIPT_VERIFY_MINIMALDATA) == 0 || CheckMinimalPush(vch, opcode);
+}
+
+/** Match OP_m <pubkey>... OP_n OP_CHECKMULTISIG, with the public keys pushed directly. */
+bool MatchStandardMultisig(const CScript& script, int& nRequired, std::vector<valtype>& keys)
+{
+    if (script.size() < 3 || script.back() != OP_CHECKMULTISIG || script[0] < OP_1 || script[0] > OP_16)
+        return false;
+    nRequired = CScript::DecodeOP_N((opcodetype)script[0]);
+    CScript::const_iterator pc = script.begin() + 1;
+    CScript::const_iterator pend = script.end() - 2;
+    while (pc < pend) {
+        unsigned int nSize = *pc++;
+        if (nSize < 33 || nSize > 65 || pend - pc < (int)nSize)
+            return false;
+        keys.emplace_back(pc, pc + nSize);
+        pc += nSize;
+    }
+    if (pc != pend || *pc < OP_1 || *pc > OP_16)
+        return false;
+    return CScript::DecodeOP_N((opcodetype)*pc) == (int)keys.size() && nRequired <= (int)keys.size();
+}
+
+/** The outcome of a CHECK(MULTI)SIG whose encoding checks passed, when it ends the script. */
+bool StandardSigResult(bool fOk, bool fNonEmptySig, unsigned int flags, ScriptError* serror)
+{
+    if (fOk)
+        return set_success(serror);
+    if ((flags & SCRIPT_VERIFY_NULLFAIL) && fNonEmptySig)
+        return set_error(serror, SCRIPT_ERR_SIG_NULLFAIL);
+    return set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+}
+
+/** Run OP_DUP OP_HASH160 <hash> OP_EQUALVERIFY OP_CHECKSIG on a signature and public key. */
+bool VerifyStandardKeyHash(const valtype& vchSig, const valtype& vchPubKey, const unsigned char* hash, const CScript& scriptCode, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, bool& fSuccess, ScriptError* serror)
+{
+    uint160 hashPubKey;
+    CHash160().Write(vchPubKey.data(), vchPubKey.size()).Finalize(hashPubKey.begin());
+    if (memcmp(hashPubKey.begin(), hash, 20) != 0)
+        return false;
+    if (!CheckSignatureEncoding(vchSig, flags, nullptr) || !CheckPubKeyEncoding(vchPubKey, flags, sigversion, nullptr))
+        return false;
+    fSuccess = StandardSigResult(checker.CheckSig(vchSig, vchPubKey, scriptCode, sigversion), !vchSig.empty(), flags, serror);
+    return true;
+}
+
+/** Verify a version 0 witness program that spends P2WPKH or P2WSH multisig. */
+bool VerifyStandardWitness(const CScriptWitness& witness, const valtype& program, unsigned int flags, const BaseSignatureChecker& checker, bool& fSuccess, ScriptError* serror)
+{
+    const std::vector<valtype>& items = witness.stack;
+    if (program.size() == 20) {
+        if (items.size() != 2 || items[0].size() > MAX_SCRIPT_ELEMENT_SIZE || items[1].size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        CScript scriptCode;
+        scriptCode << OP_DUP << OP_HASH160 << program << OP_EQUALVERIFY << OP_CHECKSIG;
+        return VerifyStandardKeyHash(items[0], items[1], program.data(), scriptCode, flags, checker, SIGVERSION_WITNESS_V0, fSuccess, serror);
+    }
+
+    if (items.empty())
+        return false;
+    uint256 hashScript;
+    CSHA256().Write(items.back().data(), items.back().size()).Finalize(hashScript.begin());
+    if (memcmp(hashScript.begin(), program.data(), 32) != 0)
+        return false;
+    CScript scriptCode(items.back().begin(), items.back().end());
+    int nRequired;
+    std::vector<valtype> keys;
+    if (!MatchStandardMultisig(scriptCode, nRequired, keys))
+        return false;
+    // The dummy element, which has to be empty, and the signatures
+    if (items.size() != (size_t)nRequired + 2 || !items[0].empty())
+        return false;
+    bool fNonEmptySig = false;
+    for (int i = 1; i <= nRequired; i++) {
+        if (items[i].size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        fNonEmptySig |= !items[i].empty();
+    }
+
+    // Match the signatures to the keys from the last one on, like OP_CHECKMULTISIG
+    int nSigs = nRequired;
+    int nKeys = keys.size();
+    bool fOk = true;
+    while (fOk && nSigs > 0) {
+        const valtype& vchSig = items[nSigs];
+        const valtype& vchPubKey = keys[nKeys - 1];
+        if (!CheckSignatureEncoding(vchSig, flags, nullptr) || !CheckPubKeyEncoding(vchPubKey, flags, SIGVERSION_WITNESS_V0, nullptr))
+            return false;
+        if (checker.CheckSig(vchSig, vchPubKey, scriptCode, SIGVERSION_WITNESS_V0))
+            nSigs--;
+        nKeys--;
+        if (nSigs > nKeys)
+            fOk = false;
+    }
+    fSuccess = StandardSigResult(fOk, fNonEmptySig, flags, serror);
+    return true;
+}
+
+} // namespace
+
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, bool& fSuccess, ScriptError* serror)
+{
+    static const CScriptWitness emptyWitness;
+    if (witness == nullptr) {
+        witness = &emptyWitness;
+    }
+    // Leave the flag combinations VerifyScript() asserts on to it
+    if ((flags & SCRIPT_VERIFY_WITNESS) && !(flags & SCRIPT_VERIFY_P2SH))
+        return false;
+    if ((flags & SCRIPT_VERIFY_CLEANSTACK) && (!(flags & SCRIPT_VERIFY_P2SH) || !(flags & SCRIPT_VERIFY_WITNESS)))
+        return false;
+
+    if (scriptPubKey.size() == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 &&
+        scriptPubKey[2] == 0x14 && scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG) {
+        // P2PKH: <sig> <pubkey>
+        if (!witness->IsNull())
+            return false;
+        CScript::const_iterator pc = scriptSig.begin();
+        valtype vchSig, vchPubKey;
+        if (!GetStandardPush(scriptSig, pc, vchSig, flags) || !GetStandardPush(scriptSig, pc, vchPubKey, flags) || pc != scriptSig.end())
+            return false;
+        // A 20 byte signature is the only one FindAndDelete() could find in the scriptCode
+        if (vchSig.size() == 20)
+            return false;
+        return VerifyStandardKeyHash(vchSig, vchPubKey, &scriptPubKey[3], scriptPubKey, flags, checker, SIGVERSION_BASE, fSuccess, serror);
+    }
+
+    if (!(flags & SCRIPT_VERIFY_WITNESS))
+        return false;
+    int witnessversion;
+    valtype program;
+    if (scriptPubKey.IsWitnessProgram(witnessversion, program)) {
+        if (!scriptSig.empty())
+            return false;
+    } else if (scriptPubKey.IsPayToScriptHash()) {
+        // P2SH-wrapped witness program: exactly one direct push of the redeemScript
+        if (scriptSig.empty() || scriptSig[0] != scriptSig.size() - 1)
+            return false;
+        CScript redeemScript(scriptSig.begin() + 1, scriptSig.end());
+        if (!redeemScript.IsWitnessProgram(witnessversion, program))
+            return false;
+        uint160 hashScript;
+        CHash160().Write(redeemScript.data(), redeemScript.size()).Finalize(hashScript.begin());
+        if (memcmp(hashScript.begin(), &scriptPubKey[2], 20) != 0)
+            return false;
+    } else {
+        return false;
+    }
+    // The program is left on the stack, and has to be true
+    if (witnessversion != 0 || !CastToBool(program))
+        return false;
+    return VerifyStandardWitness(*witness, program, flags, checker, fSuccess, serror);
+}
+
 size_t static WitnessSigOps(int witversion, const std::vector<unsigned char>& witprogram, const CScriptWitness& witness, int flags)
 {
     if (witversion == 0) {
@@ -6,9 +6,11 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include <crypto/sha256.h>
 #include <script/script_error.h>
 #include <primitives/transaction.h>
 
+#include <memory>
 #include <vector>
 #include <stdint.h>
 #include <string>
@@ -115,12 +117,42 @@ enum
 
 bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror);
 
+/**
+ * For the legacy (pre-segwit) signature hashes of transactions with several
+ * legacy inputs: the inputs serialized with blanked out scripts, the
+ * serialized outputs and nLockTime, and SHA256 midstates over the inputs, so
+ * that the shared parts aren't serialized again for every input signed with
+ * SIGHASH_ALL.
+ */
+struct LegacySighashCache
+{
+    std::vector<unsigned char> vInputs, vOutputs;
+    std::vector<CSHA256> vMidstates;
+
+    explicit LegacySighashCache(const CTransaction& tx);
+};
+
 struct PrecomputedTransactionData
 {
     uint256 hashPrevouts, hashSequence, hashOutputs;
     bool ready = false;
 
+    //! Whether the transaction has enough legacy inputs for a LegacySighashCache to pay off
+    bool legacyCacheable = false;
+
     explicit PrecomputedTransactionData(const CTransaction& tx);
+
+    /**
+     * The LegacySighashCache of tx, which must be the transaction this was
+     * constructed for. Built on first use, as many transactions are
+     * validated without computing any signature hash (assumevalid, script
+     * execution cache hits). Thread safe.
+     */
+    std::shared_ptr<const LegacySighashCache> GetLegacyCache(const CTransaction& tx) const;
+    bool HasLegacyCache() const { return std::atomic_load(&legacyCache) != nullptr; }
+
+private:
+    mutable std::shared_ptr<const LegacySighashCache> legacyCache;
 };
 
 enum SigVersion
@@ -183,6 +215,15 @@ public:
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, SigVersion sigversion, ScriptError* error = nullptr);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror = nullptr);
 
+/**
+ * Verify an input that spends P2PKH, P2WPKH or P2WSH multisig, the latter two
+ * possibly nested in P2SH, without running the interpreter. Returns false for
+ * anything else, including any input on which the interpreter could fail
+ * before checking the signatures, leaving it to VerifyScript(). Otherwise the
+ * result is in fSuccess and serror, and is the same as VerifyScript()'s.
+ */
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags, const BaseSignatureChecker& checker, bool& fSuccess, ScriptError* serror = nullptr);
+
 size_t CountWitnessSigOps(const CScript& scriptSig, const CScript& scriptPubKey, const CScriptWitness* witness, unsigned int flags);
 
 #endif // BITCOIN_SCRIPT_INTERPRETER_H
@@ -221,7 +221,8 @@ public:
 
     static const size_t nDefaultMaxNumSize = 4;
 
-    explicit CScriptNum(const std::vector<unsigned char>& vch, bool fRequireMinimal,
+    template <typename Container>
+    explicit CScriptNum(const Container& vch, bool fRequireMinimal,
                         const size_t nMaxNumSize = nDefaultMaxNumSize)
     {
         if (vch.size() > nMaxNumSize) {
@@ -357,7 +358,8 @@ public:
     }
 
 private:
-    static int64_t set_vch(const std::vector<unsigned char>& vch)
+    template <typename Container>
+    static int64_t set_vch(const Container& vch)
     {
       if (vch.empty())
           return 0;
@@ -520,7 +522,20 @@ public:
         return GetOp2(pc, opcodeRet, nullptr);
     }
 
+    //! Read the data pushed into another container than std::vector, like a prevector
+    template <typename Container>
+    bool GetOp(const_iterator& pc, opcodetype& opcodeRet, Container& vchRet) const
+    {
+        return GetOp2(pc, opcodeRet, &vchRet);
+    }
+
     bool GetOp2(const_iterator& pc, opcodetype& opcodeRet, std::vector<unsigned char>* pvchRet) const
+    {
+        return GetOp2<std::vector<unsigned char>>(pc, opcodeRet, pvchRet);
+    }
+
+    template <typename Container>
+    bool GetOp2(const_iterator& pc, opcodetype& opcodeRet, Container* pvchRet) const
     {
         opcodeRet = OP_INVALIDOPCODE;
         if (pvchRet)
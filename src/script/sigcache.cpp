@@ -12,6 +12,10 @@
 #include <util.h>
 
 #include <cuckoocache.h>
+
+#include <atomic>
+#include <mutex>
+
 #include <boost/thread.hpp>
 
 namespace {
@@ -26,8 +30,34 @@ private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
     typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
+
+    /**
+     * The entries are spread over shards with their own lock and counters,
+     * so that the script check threads don't all contend on the same lock
+     * and cache lines.
+     */
+    struct alignas(64) Shard
+    {
+        boost::shared_mutex cs;
+        std::unique_ptr<map_type> setValid;
+        size_t nElements = 0;
+        std::atomic<uint64_t> nHits{0};
+        std::atomic<uint64_t> nMisses{0};
+        std::atomic<uint64_t> nInserts{0};
+        std::atomic<uint64_t> nEvictions{0};
+    };
+    Shard shards[MAX_SIG_CACHE_SHARDS];
+    //! The number of shards less one, a power of two less one
+    std::atomic<uint32_t> nShardMask{0};
+    //! Serializes setup_bytes
+    std::mutex cs_setup;
+
+    Shard& GetShard(const uint256& entry)
+    {
+        // The hasher buckets entries by the high bits of each 32-bit word, so
+        // the low bits of the first one are free to pick the shard with
+        return shards[entry.begin()[0] & nShardMask.load(std::memory_order_relaxed)];
+    }
 
 public:
     CSignatureCache()
@@ -44,18 +74,65 @@ public:
     bool
     Get(const uint256& entry, const bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.contains(entry, erase);
+        Shard& shard = GetShard(entry);
+        boost::shared_lock<boost::shared_mutex> lock(shard.cs);
+        if (!shard.setValid->contains(entry, erase)) {
+            shard.nMisses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        shard.nHits.fetch_add(1, std::memory_order_relaxed);
+        return true;
     }
 
     void Set(uint256& entry)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.insert(entry);
+        Shard& shard = GetShard(entry);
+        boost::unique_lock<boost::shared_mutex> lock(shard.cs);
+        if (!shard.setValid->insert(entry))
+            shard.nEvictions.fetch_add(1, std::memory_order_relaxed);
+        shard.nInserts.fetch_add(1, std::memory_order_relaxed);
     }
-    uint32_t setup_bytes(size_t n)
+
+    //! nShards must be a power of two. Entries looked up while the number of shards changes may be missed.
+    size_t setup_bytes(size_t n, int nShards)
+    {
+        assert(IsValidSigCacheShardCount(nShards));
+        std::lock_guard<std::mutex> lock_setup(cs_setup);
+        size_t nElems = 0;
+        for (int i = 0; i < nShards; i++) {
+            Shard& shard = shards[i];
+            std::unique_ptr<map_type> setValid = MakeUnique<map_type>();
+            size_t nShardElems = setValid->setup_bytes(n / nShards);
+            boost::unique_lock<boost::shared_mutex> lock(shard.cs);
+            shard.setValid = std::move(setValid);
+            shard.nElements = nShardElems;
+            shard.nHits = shard.nMisses = shard.nInserts = shard.nEvictions = 0;
+            nElems += nShardElems;
+        }
+        nShardMask = nShards - 1;
+        return nElems;
+    }
+
+    int GetShardCount() const
+    {
+        return nShardMask + 1;
+    }
+
+    SigCacheStats GetStats()
     {
-        return setValid.setup_bytes(n);
+        SigCacheStats stats;
+        stats.nShards = GetShardCount();
+        for (int i = 0; i < stats.nShards; i++) {
+            Shard& shard = shards[i];
+            boost::shared_lock<boost::shared_mutex> lock(shard.cs);
+            stats.nElements += shard.nElements;
+            stats.nHits += shard.nHits;
+            stats.nMisses += shard.nMisses;
+            stats.nInserts += shard.nInserts;
+            stats.nEvictions += shard.nEvictions;
+        }
+        stats.nBytes = stats.nElements * sizeof(uint256);
+        return stats;
     }
 };
 
@@ -68,16 +145,43 @@ public:
 static CSignatureCache signatureCache;
 } // namespace
 
+bool IsValidSigCacheShardCount(int64_t nShards)
+{
+    return nShards >= 1 && nShards <= MAX_SIG_CACHE_SHARDS && (nShards & (nShards - 1)) == 0;
+}
+
+size_t GetSigCacheBytes(int64_t nMaxSigCacheSize)
+{
+    // The result is unsigned. If -maxsigcachesize is set to zero, setup_bytes
+    // creates the minimum possible cache (2 elements).
+    return std::min(std::max((int64_t)0, nMaxSigCacheSize / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+}
+
+static void SetupSignatureCache(size_t nMaxCacheSize, int nShards)
+{
+    size_t nElems = signatureCache.setup_bytes(nMaxCacheSize, nShards);
+    LogPrintf("Using %zu MiB out of %zu/2 requested for signature cache in %d shards, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nShards, nElems);
+}
+
 // To be called once in AppInitMain/BasicTestingSetup to initialize the
 // signatureCache.
 void InitSignatureCache()
 {
-    // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
-    // setup_bytes creates the minimum possible cache (2 elements).
-    size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-    size_t nElems = signatureCache.setup_bytes(nMaxCacheSize);
-    LogPrintf("Using %zu MiB out of %zu/2 requested for signature cache, able to store %zu elements\n",
-            (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
+    int64_t nShards = gArgs.GetArg("-sigcacheshards", DEFAULT_SIG_CACHE_SHARDS);
+    if (!IsValidSigCacheShardCount(nShards))
+        nShards = DEFAULT_SIG_CACHE_SHARDS;
+    SetupSignatureCache(GetSigCacheBytes(gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), nShards);
+}
+
+void ResizeSignatureCache(size_t nBytes)
+{
+    SetupSignatureCache(nBytes, signatureCache.GetShardCount());
+}
+
+SigCacheStats GetSignatureCacheStats()
+{
+    return signatureCache.GetStats();
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
@@ -16,6 +16,10 @@
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
 // Maximum sig cache size allowed
 static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+// Number of independently locked shards the signature cache is split into,
+// a power of two
+static const int DEFAULT_SIG_CACHE_SHARDS = 8;
+static const int MAX_SIG_CACHE_SHARDS = 64;
 
 class CPubKey;
 
@@ -51,6 +55,32 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
 };
 
+/** Usage statistics of the signature or script execution cache */
+struct SigCacheStats
+{
+    //! Number of entries the cache can hold, and the memory they take
+    size_t nElements = 0;
+    size_t nBytes = 0;
+    int nShards = 1;
+    //! Since the cache was last set up
+    uint64_t nHits = 0;
+    uint64_t nMisses = 0;
+    uint64_t nInserts = 0;
+    //! Insertions that had to drop a live entry for lack of room. Entries
+    //! overwritten after they were erased on use or aged out with their
+    //! generation are not counted.
+    uint64_t nEvictions = 0;
+};
+
+/** Whether the signature cache can be split into nShards, a power of two up to MAX_SIG_CACHE_SHARDS */
+bool IsValidSigCacheShardCount(int64_t nShards);
+
+/** Size in bytes of each of the signature and script execution caches, for a -maxsigcachesize in MiB */
+size_t GetSigCacheBytes(int64_t nMaxSigCacheSize);
+
 void InitSignatureCache();
+/** Set up the signature cache to use nBytes, dropping its entries and statistics. Thread safe. */
+void ResizeSignatureCache(size_t nBytes);
+SigCacheStats GetSignatureCacheStats();
 
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -411,6 +411,14 @@ public:
         clear();
     }
 
+    /** Exchange the underlying buffer with v and rewind, e.g. to reuse an
+     *  already allocated buffer. */
+    void swap(vector_type& v)
+    {
+        vch.swap(v);
+        nReadPos = 0;
+    }
+
     /**
      * XOR the contents of this stream with a certain key.
      *
@@ -0,0 +1,181 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Unit tests for sizing block download windows to peer throughput, and for
+// moving blocks in flight from slow peers to faster ones
+
+#include <chainparams.h>
+#include <consensus/merkle.h>
+#include <net.h>
+#include <net_processing.h>
+#include <netmessagemaker.h>
+#include <pow.h>
+#include <validation.h>
+
+#include <test/test_bitcoin.h>
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockdownload_tests, TestChain100Setup)
+
+static NodeId nNextId = 0;
+
+static CNode* AddOutboundPeer(PeerLogicValidation& peerLogic)
+{
+    CAddress addr(CService(CNetAddr(in_addr{htonl(0xa0b0c000 + nNextId)}), Params().GetDefaultPort()), NODE_NONE);
+    CNode* pnode = new CNode(nNextId++, ServiceFlags(NODE_NETWORK|NODE_WITNESS), 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", /*fInboundIn=*/ false);
+    pnode->SetSendVersion(PROTOCOL_VERSION);
+    pnode->SetRecvVersion(PROTOCOL_VERSION);
+    peerLogic.InitializeNode(pnode);
+    pnode->nVersion = PROTOCOL_VERSION;
+    pnode->fSuccessfullyConnected = true;
+    return pnode;
+}
+
+// Have the peer logic process msg as if node had sent it and its last byte
+// had arrived at nTimeReceived (in microseconds)
+static void ReceiveMessage(PeerLogicValidation& peerLogic, CNode& node, CSerializedNetMsg&& msg, int64_t nTimeReceived)
+{
+    CSharedNetMsg shared = CConnman::PrepareMessage(std::move(msg));
+    std::vector<unsigned char> vData(*shared.header);
+    if (shared.data) {
+        vData.insert(vData.end(), shared.data->begin(), shared.data->end());
+    }
+    CNetMessage netmsg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    const int nHeaderBytes = netmsg.readHeader((const char*)vData.data(), vData.size());
+    BOOST_REQUIRE(nHeaderBytes == CMessageHeader::HEADER_SIZE);
+    BOOST_REQUIRE(netmsg.readData((const char*)vData.data() + nHeaderBytes, vData.size() - nHeaderBytes) >= 0);
+    BOOST_REQUIRE(netmsg.complete());
+    netmsg.nTime = nTimeReceived;
+    {
+        LOCK(node.cs_vProcessMsg);
+        node.nProcessQueueSize += vData.size();
+        node.vProcessMsg.push_back(std::move(netmsg));
+    }
+    // Nothing is actually sent to the peer, so its send buffer never drains
+    node.fPauseSend = false;
+    std::atomic<bool> interrupt(false);
+    peerLogic.ProcessMessages(&node, interrupt);
+}
+
+static void SendMessages(PeerLogicValidation& peerLogic, CNode& node)
+{
+    std::atomic<bool> interrupt(false);
+    LOCK(node.cs_sendProcessing);
+    peerLogic.SendMessages(&node, interrupt);
+}
+
+static CNodeStateStats GetStats(const CNode& node)
+{
+    CNodeStateStats stats;
+    BOOST_REQUIRE(GetNodeStateStats(node.GetId(), stats));
+    return stats;
+}
+
+static bool IsInFlight(const CNode& node, const CBlockIndex* pindexPrev, int nBlock)
+{
+    std::vector<int> vHeights = GetStats(node).vHeightInFlight;
+    return std::count(vHeights.begin(), vHeights.end(), pindexPrev->nHeight + 1 + nBlock) > 0;
+}
+
+// A chain of nBlocks blocks with only a coinbase on top of pindexPrev
+static std::vector<std::shared_ptr<const CBlock>> BuildChain(const CBlockIndex* pindexPrev, int nBlocks)
+{
+    const CChainParams& chainparams = Params();
+    std::vector<std::shared_ptr<const CBlock>> blocks;
+    uint256 hashPrev = pindexPrev->GetBlockHash();
+    for (int i = 0; i < nBlocks; i++) {
+        auto pblock = std::make_shared<CBlock>();
+        pblock->nVersion = pindexPrev->nVersion;
+        pblock->hashPrevBlock = hashPrev;
+        pblock->nTime = pindexPrev->nTime + 1 + i;
+        pblock->nBits = pindexPrev->nBits;
+
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << (pindexPrev->nHeight + 1 + i) << OP_0;
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = 0;
+        coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        pblock->vtx.push_back(MakeTransactionRef(coinbase));
+
+        pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+        while (!CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits, chainparams.GetConsensus())) ++pblock->nNonce;
+        hashPrev = pblock->GetHash();
+        blocks.push_back(pblock);
+    }
+    return blocks;
+}
+
+BOOST_AUTO_TEST_CASE(window_sizing_and_reassignment)
+{
+    const CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+    // Too many blocks for the first peer to fetch directly on the headers
+    const std::vector<std::shared_ptr<const CBlock>> blocks = BuildChain(pindexTip, 30);
+    std::vector<CBlock> vHeaders;
+    for (const auto& pblock : blocks)
+        vHeaders.push_back(pblock->GetBlockHeader());
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+
+    // The slow peer is asked for the default window
+    CNode* pnodeSlow = AddOutboundPeer(*peerLogic);
+    ReceiveMessage(*peerLogic, *pnodeSlow, msgMaker.Make(NetMsgType::HEADERS, vHeaders), GetTimeMicros());
+    SendMessages(*peerLogic, *pnodeSlow);
+    BOOST_CHECK_EQUAL(GetStats(*pnodeSlow).vHeightInFlight.size(), (size_t)MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // It takes ten seconds for the first block, which shrinks its window to the minimum
+    ReceiveMessage(*peerLogic, *pnodeSlow, msgMaker.Make(NetMsgType::BLOCK, *blocks[0]), GetTimeMicros() + 10 * 1000000);
+    SendMessages(*peerLogic, *pnodeSlow);
+    CNodeStateStats stats = GetStats(*pnodeSlow);
+    BOOST_CHECK_EQUAL(stats.nBlocksDownloaded, 1);
+    BOOST_CHECK_EQUAL(stats.nBlockDownloadWindow, MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(stats.vHeightInFlight.size(), (size_t)MAX_BLOCKS_IN_TRANSIT_PER_PEER - 1);
+
+    // The fast peer gets the rest, and sends one of them in ten milliseconds,
+    // which grows its window to the maximum
+    CNode* pnodeFast = AddOutboundPeer(*peerLogic);
+    ReceiveMessage(*peerLogic, *pnodeFast, msgMaker.Make(NetMsgType::HEADERS, vHeaders), GetTimeMicros());
+    SendMessages(*peerLogic, *pnodeFast);
+    BOOST_CHECK_EQUAL(GetStats(*pnodeFast).vHeightInFlight.size(), blocks.size() - MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK(!IsInFlight(*pnodeFast, pindexTip, 1));
+    ReceiveMessage(*peerLogic, *pnodeFast, msgMaker.Make(NetMsgType::BLOCK, *blocks[MAX_BLOCKS_IN_TRANSIT_PER_PEER]), GetTimeMicros() + 10 * 1000);
+
+    // With room to spare, it takes over the block that holds up the download
+    SendMessages(*peerLogic, *pnodeFast);
+    stats = GetStats(*pnodeFast);
+    BOOST_CHECK_EQUAL(stats.nBlockDownloadWindow, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK(IsInFlight(*pnodeFast, pindexTip, 1));
+    BOOST_CHECK(!IsInFlight(*pnodeSlow, pindexTip, 1));
+    BOOST_CHECK_EQUAL(GetStats(*pnodeSlow).nBlocksReassigned, 1);
+
+    // The slow peer's copy, should it still come first, is handled as requested
+    ReceiveMessage(*peerLogic, *pnodeSlow, msgMaker.Make(NetMsgType::BLOCK, *blocks[1]), GetTimeMicros() + 1000000);
+    stats = GetStats(*pnodeSlow);
+    BOOST_CHECK_EQUAL(stats.nBlocksDownloaded, 2);
+    BOOST_CHECK_EQUAL(stats.nMisbehavior, 0);
+    BOOST_CHECK(!pnodeSlow->fDisconnect);
+    BOOST_CHECK(!IsInFlight(*pnodeFast, pindexTip, 1));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == blocks[1]->GetHash());
+    }
+
+    // And the fast peer's is no longer expected
+    ReceiveMessage(*peerLogic, *pnodeFast, msgMaker.Make(NetMsgType::BLOCK, *blocks[1]), GetTimeMicros());
+    BOOST_CHECK_EQUAL(GetStats(*pnodeFast).nBlocksDownloaded, 1);
+
+    for (CNode* pnode : {pnodeSlow, pnodeFast}) {
+        bool dummy;
+        peerLogic->FinalizeNode(pnode->GetId(), dummy);
+        delete pnode;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
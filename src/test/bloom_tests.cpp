@@ -462,10 +462,11 @@ static std::vector<unsigned char> RandomData()
     return std::vector<unsigned char>(r.begin(), r.end());
 }
 
-BOOST_AUTO_TEST_CASE(rolling_bloom)
+template <typename RollingBloomFilter>
+static void TestRollingBloom(unsigned int nMinFalsePositives)
 {
     // last-100-entry, 1% false positive:
-    CRollingBloomFilter rb1(100, 0.01);
+    RollingBloomFilter rb1(100, 0.01);
 
     // Overfill:
     static const int DATASIZE=399;
@@ -492,7 +493,7 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     BOOST_TEST_MESSAGE("RollingBloomFilter got " << nHits << " false positives (~100 expected)");
 
     // Insanely unlikely to get a fp count outside this range:
-    BOOST_CHECK(nHits > 25);
+    BOOST_CHECK(nHits > nMinFalsePositives);
     BOOST_CHECK(nHits < 175);
 
     BOOST_CHECK(rb1.contains(data[DATASIZE-1]));
@@ -526,7 +527,7 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     BOOST_CHECK(nHits < 100);
 
     // last-1000-entry, 0.01% false positive:
-    CRollingBloomFilter rb2(1000, 0.001);
+    RollingBloomFilter rb2(1000, 0.001);
     for (int i = 0; i < DATASIZE; i++) {
         rb2.insert(data[i]);
     }
@@ -536,4 +537,35 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(rolling_bloom)
+{
+    TestRollingBloom<CRollingBloomFilter>(25);
+}
+
+BOOST_AUTO_TEST_CASE(blocked_rolling_bloom)
+{
+    // Sized for the worst case fill of each generation, so it usually has
+    // fewer false positives than asked for
+    TestRollingBloom<CBlockedRollingBloomFilter>(0);
+
+    // The blocks must not skew the false positive rate of a large filter,
+    // nor forget the hashes inserted recently
+    CBlockedRollingBloomFilter rb(50000, 0.0001);
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 75000; i++) {
+        hashes.push_back(InsecureRand256());
+        rb.insert(hashes.back());
+    }
+    for (int i = 25000; i < 75000; i++) {
+        BOOST_CHECK(rb.contains(hashes[i]));
+    }
+    unsigned int nHits = 0;
+    for (int i = 0; i < 100000; i++) {
+        if (rb.contains(InsecureRand256()))
+            ++nHits;
+    }
+    BOOST_TEST_MESSAGE("BlockedRollingBloomFilter got " << nHits << " false positives (~10 expected)");
+    BOOST_CHECK(nHits < 40);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -58,6 +58,28 @@ BOOST_AUTO_TEST_CASE(test_cuckoocache_no_fakes)
     }
 };
 
+/* Test that insert reports when it had to drop an element to make room,
+ * which never happens while the cache is mostly empty
+ */
+BOOST_AUTO_TEST_CASE(test_cuckoocache_insert_evictions)
+{
+    local_rand_ctx = FastRandomContext(true);
+    CuckooCache::cache<uint256, SignatureCacheHasher> cc{};
+    uint32_t n = cc.setup(1 << 10);
+    uint256 v;
+    for (uint32_t x = 0; x < n / 4; ++x) {
+        insecure_GetRandHash(v);
+        BOOST_CHECK(cc.insert(v));
+    }
+    size_t nEvicted = 0;
+    for (uint32_t x = 0; x < 4 * n; ++x) {
+        insecure_GetRandHash(v);
+        if (!cc.insert(v))
+            ++nEvicted;
+    }
+    BOOST_CHECK(nEvicted > 0);
+};
+
 /** This helper returns the hit rate when megabytes*load worth of entries are
  * inserted into a megabytes sized cache
  */
@@ -145,6 +145,25 @@ BOOST_AUTO_TEST_CASE(siphash)
         BOOST_CHECK_EQUAL(SipHashUint256(k1, k2, x), sip256.Finalize());
         BOOST_CHECK_EQUAL(SipHashUint256Extra(k1, k2, x, n), sip288.Finalize());
     }
+
+    // Check consistency between SipHashUint256 and SipHashUint256Batch, also
+    // for batches that don't fill the interleaved lanes.
+    uint64_t k0 = ctx.rand64(), k1 = ctx.rand64();
+    std::vector<uint256> vals;
+    std::vector<const uint256*> ptrs;
+    for (int i = 0; i < 11; ++i) {
+        vals.push_back(InsecureRand256());
+    }
+    for (const uint256& val : vals) {
+        ptrs.push_back(&val);
+    }
+    for (size_t n = 0; n <= vals.size(); ++n) {
+        std::vector<uint64_t> out(n);
+        SipHashUint256Batch(k0, k1, ptrs.data(), n, out.data());
+        for (size_t i = 0; i < n; ++i) {
+            BOOST_CHECK_EQUAL(out[i], SipHashUint256(k0, k1, vals[i]));
+        }
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
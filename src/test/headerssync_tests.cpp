@@ -0,0 +1,296 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <headerssync.h>
+#include <net_processing.h>
+#include <pow.h>
+#include <test/test_bitcoin.h>
+
+#include <set>
+
+#include <boost/test/unit_test.hpp>
+
+// The main network rules, with a proof of work limit low enough to create
+// headers for, and without retargets, which overflow with such a limit
+static Consensus::Params EasyConsensusParams()
+{
+    Consensus::Params params = Params().GetConsensus();
+    params.powLimit = uint256S("7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+    params.fPowNoRetargeting = true;
+    return params;
+}
+
+static const uint32_t EASY_BITS = 0x207fffff;
+
+static void Mine(CBlockHeader& header, const Consensus::Params& params)
+{
+    while (!CheckProofOfWork(header.GetPoWHash(), header.nBits, params))
+        header.nNonce++;
+}
+
+static std::vector<CBlockHeader> CreateHeaders(int nCount, const Consensus::Params& params)
+{
+    std::vector<CBlockHeader> headers(nCount);
+    for (int i = 0; i < nCount; i++) {
+        headers[i].nVersion = 1;
+        headers[i].nTime = 1000 + i;
+        headers[i].nBits = EASY_BITS;
+        if (i > 0)
+            headers[i].hashPrevBlock = headers[i - 1].GetHash();
+        Mine(headers[i], params);
+    }
+    return headers;
+}
+
+static std::vector<CBlockHeader> Slice(const std::vector<CBlockHeader>& headers, const uint256& hashFrom, const uint256& hashStop)
+{
+    auto it = headers.begin();
+    while (it->GetHash() != hashFrom)
+        ++it;
+    std::vector<CBlockHeader> ret;
+    for (++it; it != headers.end() && ret.size() < MAX_HEADERS_RESULTS; ++it) {
+        ret.push_back(*it);
+        if (it->GetHash() == hashStop)
+            break;
+    }
+    return ret;
+}
+
+// A chain of headers with checkpoints, created once for all test cases
+struct HeadersRangeSyncSetup : public BasicTestingSetup {
+    const Consensus::Params consensusParams;
+    const std::vector<CBlockHeader>& chain;
+    const MapCheckpoints checkpoints;
+
+    HeadersRangeSyncSetup() : consensusParams(EasyConsensusParams()), chain(GetChain(consensusParams)), checkpoints{
+        {0, chain[0].GetHash()},
+        {3000, chain[3000].GetHash()},
+        {6000, chain[6000].GetHash()},
+        {9000, chain[9000].GetHash()},
+    } {}
+
+    static const std::vector<CBlockHeader>& GetChain(const Consensus::Params& params)
+    {
+        static const std::vector<CBlockHeader> chain = CreateHeaders(10001, params);
+        return chain;
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(headerssync_tests, HeadersRangeSyncSetup)
+
+BOOST_AUTO_TEST_CASE(headers_range_sync)
+{
+    CHeadersRangeSync sync;
+    sync.Init(checkpoints, 100, MAX_HEADERS_RANGE_BUFFERED, MAX_HEADERS_RANGE_BUFFERED_PER_PEER);
+    BOOST_CHECK_EQUAL(sync.GetRangeCount(), 2U);
+
+    uint256 hashFrom, hashStop;
+    // Peers without the end of a range, and ranges beyond the lookahead, are skipped
+    BOOST_CHECK(!sync.AssignRange(1, 5000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(!sync.AssignRange(1, 10000, 2999, 0, hashFrom, hashStop));
+
+    BOOST_CHECK(sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(hashFrom == chain[3000].GetHash());
+    BOOST_CHECK(hashStop == chain[6000].GetHash());
+    BOOST_CHECK(sync.IsAssigned(1));
+    // One range per peer
+    BOOST_CHECK(!sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+
+    // Headers that don't continue the range are left to the caller
+    uint256 hashFromOther, hashStopOther;
+    BOOST_CHECK(sync.ProcessHeaders(1, Slice(chain, chain[10].GetHash(), uint256()), consensusParams, 0, hashFromOther, hashStopOther) == CHeadersRangeSync::Result::NOT_IN_RANGE);
+    BOOST_CHECK(sync.ProcessHeaders(2, Slice(chain, hashFrom, hashStop), consensusParams, 0, hashFromOther, hashStopOther) == CHeadersRangeSync::Result::NOT_IN_RANGE);
+
+    // The difficulty of the checkpoint is unknown, so nothing more of the
+    // range is requested until the headers after it were validated
+    BOOST_CHECK(sync.ProcessHeaders(1, Slice(chain, hashFrom, hashStop), consensusParams, 0, hashFrom, hashStop) == CHeadersRangeSync::Result::DONE);
+    BOOST_CHECK(!sync.IsAssigned(1));
+    BOOST_CHECK_EQUAL(sync.GetBufferedCount(), MAX_HEADERS_RESULTS);
+
+    // A peer that sends headers that don't chain up to the end of the range
+    // loses the range, and doesn't get it again
+    BOOST_CHECK(sync.AssignRange(2, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(hashFrom == chain[6000].GetHash());
+    std::vector<CBlockHeader> headers = Slice(chain, hashFrom, hashStop);
+    headers[10].nNonce++;
+    BOOST_CHECK(sync.ProcessHeaders(2, headers, consensusParams, 0, hashFrom, hashStop) == CHeadersRangeSync::Result::INVALID);
+    BOOST_CHECK(!sync.IsAssigned(2));
+    BOOST_CHECK(!sync.AssignRange(2, 10000, 100000, 0, hashFrom, hashStop));
+
+    // Requests time out
+    BOOST_CHECK(sync.AssignRange(3, 10000, 100000, 100, hashFrom, hashStop));
+    sync.ExpireRequests(100);
+    BOOST_CHECK(sync.IsAssigned(3));
+    sync.ExpireRequests(101);
+    BOOST_CHECK(!sync.IsAssigned(3));
+    BOOST_CHECK(!sync.AssignRange(3, 10000, 100000, 0, hashFrom, hashStop));
+
+    // So do peers that don't have the range after all
+    BOOST_CHECK(sync.AssignRange(5, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(sync.ProcessHeaders(5, std::vector<CBlockHeader>(), consensusParams, 0, hashFrom, hashStop) == CHeadersRangeSync::Result::DONE);
+    BOOST_CHECK(!sync.IsAssigned(5));
+    BOOST_CHECK(!sync.AssignRange(5, 10000, 100000, 0, hashFrom, hashStop));
+
+    // Headers are handed out once the ones before them are known
+    std::set<uint256> setKnown;
+    for (int i = 0; i < 3000; i++)
+        setKnown.insert(chain[i].GetHash());
+    auto fHave = [&](const uint256& hash) { return setKnown.count(hash) > 0; };
+    NodeId node;
+    int nRange;
+    BOOST_CHECK(!sync.PopHeaders(fHave, headers, node, nRange));
+    setKnown.insert(chain[3000].GetHash());
+    BOOST_CHECK(sync.PopHeaders(fHave, headers, node, nRange));
+    BOOST_CHECK_EQUAL(node, 1);
+    BOOST_CHECK_EQUAL(headers.size(), MAX_HEADERS_RESULTS);
+    BOOST_CHECK(headers.front().GetHash() == chain[3001].GetHash());
+    BOOST_CHECK(!sync.PopHeaders(fHave, headers, node, nRange));
+
+    // After which the rest of the range is requested
+    BOOST_CHECK(sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(hashFrom == chain[3000 + MAX_HEADERS_RESULTS].GetHash());
+    BOOST_CHECK(hashStop == chain[6000].GetHash());
+    BOOST_CHECK(sync.ProcessHeaders(1, Slice(chain, hashFrom, hashStop), consensusParams, 0, hashFrom, hashStop) == CHeadersRangeSync::Result::DONE);
+    BOOST_CHECK(!sync.IsAssigned(1));
+    BOOST_CHECK_EQUAL(sync.GetBufferedCount(), 3000 - MAX_HEADERS_RESULTS);
+    for (int i = 3001; i <= 3000 + (int)MAX_HEADERS_RESULTS; i++)
+        setKnown.insert(chain[i].GetHash());
+    BOOST_CHECK(sync.PopHeaders(fHave, headers, node, nRange));
+    BOOST_CHECK(headers.back().GetHash() == chain[6000].GetHash());
+    BOOST_CHECK_EQUAL(sync.GetBufferedCount(), 0U);
+
+    // Invalid headers are downloaded again, from another peer
+    sync.RejectHeaders(nRange, node);
+    BOOST_CHECK(sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(hashFrom == chain[6000].GetHash());
+    sync.NodeDisconnected(1);
+    BOOST_CHECK(!sync.IsAssigned(1));
+    BOOST_CHECK(sync.AssignRange(4, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(hashFrom == chain[3000 + MAX_HEADERS_RESULTS].GetHash());
+    BOOST_CHECK(hashStop == chain[6000].GetHash());
+
+    // Ranges that are known up to their end are dropped
+    for (int i = 3001; i <= 6000; i++)
+        setKnown.insert(chain[i].GetHash());
+    BOOST_CHECK(!sync.PopHeaders(fHave, headers, node, nRange));
+    BOOST_CHECK_EQUAL(sync.GetRangeCount(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(headers_range_sync_checks_headers)
+{
+    CHeadersRangeSync sync;
+    sync.Init(checkpoints, 100, MAX_HEADERS_RANGE_BUFFERED, MAX_HEADERS_RANGE_BUFFERED_PER_PEER);
+    uint256 hashFrom, hashStop;
+
+    // Headers without proof of work are rejected as soon as they arrive
+    BOOST_CHECK(sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+    std::vector<CBlockHeader> headers = Slice(chain, hashFrom, hashStop);
+    while (CheckProofOfWork(headers[0].GetPoWHash(), headers[0].nBits, consensusParams))
+        headers[0].nNonce++;
+    BOOST_CHECK(sync.ProcessHeaders(1, headers, consensusParams, 0, hashFrom, hashStop) == CHeadersRangeSync::Result::INVALID);
+    BOOST_CHECK(!sync.IsAssigned(1));
+    BOOST_CHECK_EQUAL(sync.GetBufferedCount(), 0U);
+
+    // So are headers whose difficulty changes outside of a retarget
+    BOOST_CHECK(sync.AssignRange(2, 10000, 100000, 0, hashFrom, hashStop));
+    headers = Slice(chain, hashFrom, hashStop);
+    headers[1000].nBits = EASY_BITS - 1;
+    for (size_t i = 1000; i < headers.size(); i++) {
+        headers[i].hashPrevBlock = headers[i - 1].GetHash();
+        headers[i].nBits = EASY_BITS - 1;
+        Mine(headers[i], consensusParams);
+    }
+    BOOST_CHECK(sync.ProcessHeaders(2, headers, consensusParams, 0, hashFrom, hashStop) == CHeadersRangeSync::Result::INVALID);
+    BOOST_CHECK(!sync.IsAssigned(2));
+    BOOST_CHECK_EQUAL(sync.GetBufferedCount(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(headers_range_sync_checkpoint_difficulty)
+{
+    CHeadersRangeSync sync;
+    sync.Init(checkpoints, 100, MAX_HEADERS_RANGE_BUFFERED, MAX_HEADERS_RANGE_BUFFERED_PER_PEER);
+    uint256 hashFrom, hashStop, hashFromOther, hashStopOther;
+    BOOST_CHECK(sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(sync.AssignRange(2, 10000, 100000, 0, hashFromOther, hashStopOther));
+    BOOST_CHECK(hashFromOther == chain[6000].GetHash());
+
+    // Headers after a checkpoint of unknown difficulty may start with any
+    // difficulty, but only one response of them is buffered
+    std::vector<CBlockHeader> headers = Slice(chain, hashFromOther, hashStopOther);
+    for (size_t i = 0; i < headers.size(); i++) {
+        if (i > 0)
+            headers[i].hashPrevBlock = headers[i - 1].GetHash();
+        headers[i].nBits = EASY_BITS - 1;
+        Mine(headers[i], consensusParams);
+    }
+    BOOST_CHECK(sync.ProcessHeaders(2, headers, consensusParams, 0, hashFromOther, hashStopOther) == CHeadersRangeSync::Result::DONE);
+    BOOST_CHECK(!sync.IsAssigned(2));
+    BOOST_CHECK_EQUAL(sync.GetBufferedCount(), MAX_HEADERS_RESULTS);
+    BOOST_CHECK(!sync.AssignRange(3, 10000, 100000, 0, hashFromOther, hashStopOther));
+
+    // Once the range before it reaches the checkpoint, its difficulty is
+    // known, and the headers that can't follow it are dropped
+    BOOST_CHECK(sync.ProcessHeaders(1, Slice(chain, hashFrom, hashStop), consensusParams, 0, hashFrom, hashStop) == CHeadersRangeSync::Result::DONE);
+    std::set<uint256> setKnown;
+    for (int i = 0; i <= 3000; i++)
+        setKnown.insert(chain[i].GetHash());
+    NodeId node;
+    int nRange;
+    BOOST_CHECK(sync.PopHeaders([&](const uint256& hash) { return setKnown.count(hash) > 0; }, headers, node, nRange));
+    BOOST_CHECK(sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(sync.ProcessHeaders(1, Slice(chain, hashFrom, hashStop), consensusParams, 0, hashFrom, hashStop) == CHeadersRangeSync::Result::DONE);
+    BOOST_CHECK_EQUAL(sync.GetBufferedCount(), 3000 - MAX_HEADERS_RESULTS);
+
+    // The range goes to another peer, and is requested in full
+    BOOST_CHECK(!sync.AssignRange(2, 10000, 100000, 0, hashFromOther, hashStopOther));
+    BOOST_CHECK(sync.AssignRange(3, 10000, 100000, 0, hashFromOther, hashStopOther));
+    BOOST_CHECK(hashFromOther == chain[6000].GetHash());
+    BOOST_CHECK(sync.ProcessHeaders(3, Slice(chain, hashFromOther, hashStopOther), consensusParams, 0, hashFromOther, hashStopOther) == CHeadersRangeSync::Result::REQUEST_MORE);
+    BOOST_CHECK(hashFromOther == chain[6000 + MAX_HEADERS_RESULTS].GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(headers_range_sync_buffer_limit)
+{
+    // The headers buffered and requested from all peers are bounded
+    CHeadersRangeSync sync;
+    sync.Init(checkpoints, 100, 2 * MAX_HEADERS_RESULTS, MAX_HEADERS_RANGE_BUFFERED_PER_PEER);
+    uint256 hashFrom, hashStop, hashFromOther, hashStopOther;
+    BOOST_CHECK(sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(sync.AssignRange(2, 10000, 100000, 0, hashFromOther, hashStopOther));
+    BOOST_CHECK(!sync.AssignRange(3, 10000, 100000, 0, hashFromOther, hashStopOther));
+
+    // The range waits for the buffered headers to be handed out, without
+    // holding it against the peer
+    BOOST_CHECK(sync.ProcessHeaders(1, Slice(chain, hashFrom, hashStop), consensusParams, 0, hashFrom, hashStop) == CHeadersRangeSync::Result::DONE);
+    BOOST_CHECK(!sync.IsAssigned(1));
+    BOOST_CHECK_EQUAL(sync.GetBufferedCount(), MAX_HEADERS_RESULTS);
+    BOOST_CHECK(!sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+
+    std::set<uint256> setKnown;
+    for (int i = 0; i <= 3000; i++)
+        setKnown.insert(chain[i].GetHash());
+    std::vector<CBlockHeader> headers;
+    NodeId node;
+    int nRange;
+    BOOST_CHECK(sync.PopHeaders([&](const uint256& hash) { return setKnown.count(hash) > 0; }, headers, node, nRange));
+    BOOST_CHECK_EQUAL(sync.GetBufferedCount(), 0U);
+    BOOST_CHECK(sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(hashFrom == chain[3000 + MAX_HEADERS_RESULTS].GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(headers_range_sync_peer_buffer_limit)
+{
+    // So are the headers buffered from each peer
+    CHeadersRangeSync sync;
+    sync.Init(checkpoints, 100, MAX_HEADERS_RANGE_BUFFERED, MAX_HEADERS_RESULTS);
+    uint256 hashFrom, hashStop;
+    BOOST_CHECK(sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(sync.ProcessHeaders(1, Slice(chain, hashFrom, hashStop), consensusParams, 0, hashFrom, hashStop) == CHeadersRangeSync::Result::DONE);
+    BOOST_CHECK_EQUAL(sync.GetBufferedCount(), MAX_HEADERS_RESULTS);
+    BOOST_CHECK(!sync.AssignRange(1, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(sync.AssignRange(2, 10000, 100000, 0, hashFrom, hashStop));
+    BOOST_CHECK(hashFrom == chain[6000].GetHash());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
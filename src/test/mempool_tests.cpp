@@ -571,4 +571,198 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolChangeLogTest)
+{
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction tx[4];
+    for (int i = 0; i < 4; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.n = i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10000LL;
+    }
+
+    CTxMemPool pool;
+    std::vector<MempoolChangeEntry> changes;
+    BOOST_CHECK_EQUAL(pool.GetChangeSequence(), 0U);
+    BOOST_CHECK(pool.GetChangesSince(0, changes));
+    BOOST_CHECK(changes.empty());
+
+    pool.addUnchecked(tx[0].GetHash(), entry.FromTx(tx[0]));
+    pool.addUnchecked(tx[1].GetHash(), entry.FromTx(tx[1]));
+    pool.removeRecursive(tx[0], MemPoolRemovalReason::CONFLICT);
+    BOOST_CHECK_EQUAL(pool.GetChangeSequence(), 3U);
+
+    BOOST_CHECK(pool.GetChangesSince(0, changes));
+    BOOST_CHECK_EQUAL(changes.size(), 3U);
+    BOOST_CHECK(changes[0].fAdded && changes[0].txid == tx[0].GetHash());
+    BOOST_CHECK(changes[1].fAdded && changes[1].txid == tx[1].GetHash());
+    BOOST_CHECK(!changes[2].fAdded && changes[2].txid == tx[0].GetHash());
+    BOOST_CHECK(changes[2].reason == MemPoolRemovalReason::CONFLICT);
+    BOOST_CHECK_EQUAL(changes[2].nSequence, 3U);
+
+    changes.clear();
+    BOOST_CHECK(pool.GetChangesSince(2, changes));
+    BOOST_CHECK_EQUAL(changes.size(), 1U);
+    BOOST_CHECK_EQUAL(changes[0].nSequence, 3U);
+
+    // Sequence numbers from the future are not served
+    changes.clear();
+    BOOST_CHECK(!pool.GetChangesSince(4, changes));
+    BOOST_CHECK(changes.empty());
+
+    // Shrinking the log drops the oldest changes
+    pool.SetChangeLogLimit(2);
+    pool.addUnchecked(tx[2].GetHash(), entry.FromTx(tx[2]));
+    BOOST_CHECK(!pool.GetChangesSince(1, changes));
+    BOOST_CHECK(pool.GetChangesSince(2, changes));
+    BOOST_CHECK_EQUAL(changes.size(), 2U);
+    BOOST_CHECK(changes[1].fAdded && changes[1].txid == tx[2].GetHash());
+
+    // Clearing the pool invalidates all earlier sequence numbers
+    pool.clear();
+    changes.clear();
+    BOOST_CHECK(!pool.GetChangesSince(3, changes));
+    BOOST_CHECK(pool.GetChangesSince(4, changes));
+    BOOST_CHECK(changes.empty());
+    pool.addUnchecked(tx[3].GetHash(), entry.FromTx(tx[3]));
+    BOOST_CHECK(pool.GetChangesSince(4, changes));
+    BOOST_CHECK_EQUAL(changes.size(), 1U);
+    BOOST_CHECK_EQUAL(changes[0].nSequence, 5U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolFeeHistogramTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool;
+
+    std::vector<CMutableTransaction> txs(3);
+    for (size_t i = 0; i < txs.size(); i++) {
+        txs[i].vin.resize(1);
+        txs[i].vin[0].scriptSig = CScript() << OP_11;
+        txs[i].vin[0].prevout.n = i;
+        txs[i].vout.resize(1);
+        txs[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txs[i].vout[0].nValue = 10000LL;
+    }
+    const size_t nTxSize = GetVirtualTransactionSize(txs[0]);
+
+    auto histogramFor = [&pool](CAmount nFeeRate) {
+        std::vector<FeeHistogramBucket> histogram = pool.GetFeeHistogram();
+        for (size_t i = histogram.size(); i-- > 0; ) {
+            if (histogram[i].nMinFeeRate <= nFeeRate) return histogram[i];
+        }
+        return histogram[0];
+    };
+
+    // A low, a medium and a high fee rate transaction
+    pool.addUnchecked(txs[0].GetHash(), entry.Fee(CFeeRate(2000).GetFee(nTxSize)).FromTx(txs[0]));
+    pool.addUnchecked(txs[1].GetHash(), entry.Fee(CFeeRate(20000).GetFee(nTxSize)).FromTx(txs[1]));
+    pool.addUnchecked(txs[2].GetHash(), entry.Fee(CFeeRate(200000).GetFee(nTxSize)).FromTx(txs[2]));
+
+    uint64_t nCount = 0, nSize = 0;
+    for (const FeeHistogramBucket& bucket : pool.GetFeeHistogram()) {
+        nCount += bucket.nCount;
+        nSize += bucket.nVSize;
+    }
+    BOOST_CHECK_EQUAL(nCount, 3U);
+    BOOST_CHECK_EQUAL(nSize, pool.GetTotalTxSize());
+    BOOST_CHECK_EQUAL(histogramFor(2000).nCount, 1U);
+    BOOST_CHECK_EQUAL(histogramFor(2000).nVSize, nTxSize);
+    BOOST_CHECK_EQUAL(histogramFor(20000).nCount, 1U);
+    BOOST_CHECK_EQUAL(histogramFor(200000).nCount, 1U);
+    BOOST_CHECK_EQUAL(histogramFor(0).nCount, 0U);
+
+    // Queries from the top of the pool follow ancestor score order
+    std::vector<CFeeRate> feeRates = pool.GetTopFeeRates({nTxSize * 2, 0, nTxSize * 4, nTxSize});
+    BOOST_CHECK_EQUAL(feeRates[0].GetFeePerK(), CFeeRate(CFeeRate(20000).GetFee(nTxSize), nTxSize).GetFeePerK());
+    BOOST_CHECK_EQUAL(feeRates[1].GetFeePerK(), CFeeRate(CFeeRate(200000).GetFee(nTxSize), nTxSize).GetFeePerK());
+    BOOST_CHECK_EQUAL(feeRates[2].GetFeePerK(), 0);
+    BOOST_CHECK_EQUAL(feeRates[3].GetFeePerK(), feeRates[1].GetFeePerK());
+
+    // Prioritisation moves a transaction to another bucket
+    pool.PrioritiseTransaction(txs[0].GetHash(), CFeeRate(198000).GetFee(nTxSize));
+    BOOST_CHECK_EQUAL(histogramFor(2000).nCount, 0U);
+    BOOST_CHECK_EQUAL(histogramFor(200000).nCount, 2U);
+    pool.PrioritiseTransaction(txs[0].GetHash(), -CFeeRate(210000).GetFee(nTxSize));
+    BOOST_CHECK_EQUAL(histogramFor(0).nCount, 1U);
+
+    // And removal takes it out again
+    pool.removeRecursive(txs[0]);
+    pool.removeRecursive(txs[2]);
+    BOOST_CHECK_EQUAL(histogramFor(0).nCount, 0U);
+    BOOST_CHECK_EQUAL(histogramFor(200000).nCount, 0U);
+    BOOST_CHECK_EQUAL(histogramFor(20000).nCount, 1U);
+    BOOST_CHECK_EQUAL(histogramFor(20000).nFees, CFeeRate(20000).GetFee(nTxSize));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolLinksTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool;
+
+    // A parent with four children (more than the links store inline), and a
+    // grandchild spending two of them
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(4);
+    for (int i = 0; i < 4; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 10000LL;
+    }
+    pool.addUnchecked(txParent.GetHash(), entry.FromTx(txParent));
+    CMutableTransaction txChild[4];
+    for (int i = 0; i < 4; i++) {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout = COutPoint(txParent.GetHash(), i);
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 9000LL;
+        pool.addUnchecked(txChild[i].GetHash(), entry.FromTx(txChild[i]));
+    }
+    CMutableTransaction txGrandChild;
+    txGrandChild.vin.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txGrandChild.vin[i].scriptSig = CScript() << OP_11;
+        txGrandChild.vin[i].prevout = COutPoint(txChild[i].GetHash(), 0);
+    }
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txGrandChild.vout[0].nValue = 17000LL;
+    pool.addUnchecked(txGrandChild.GetHash(), entry.FromTx(txGrandChild));
+
+    LOCK(pool.cs);
+    CTxMemPool::txiter parentIt = pool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter child0It = pool.mapTx.find(txChild[0].GetHash());
+    CTxMemPool::txiter grandChildIt = pool.mapTx.find(txGrandChild.GetHash());
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(parentIt).size(), 0U);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(parentIt).size(), 4U);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(child0It).size(), 1U);
+    BOOST_CHECK(pool.GetIter(pool.GetMemPoolParents(child0It)[0]) == parentIt);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(grandChildIt).size(), 2U);
+    BOOST_CHECK(pool.GetIter(pool.GetMemPoolChildren(child0It)[0]) == grandChildIt);
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 6U);
+
+    // Removing a child unlinks it, and its descendant, from the remaining entries
+    pool.removeRecursive(txChild[1]);
+    BOOST_CHECK_EQUAL(pool.size(), 4U);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(parentIt).size(), 3U);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(child0It).size(), 0U);
+    for (const CTxMemPoolEntry* child : pool.GetMemPoolChildren(parentIt)) {
+        BOOST_CHECK(child->GetTx().GetHash() != txChild[1].GetHash());
+        BOOST_CHECK_EQUAL(pool.GetMemPoolParents(pool.GetIter(child)).size(), 1U);
+    }
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 4U);
+
+    // Once the parent is confirmed its children have no in-mempool parents left
+    pool.removeForBlock({MakeTransactionRef(txParent)}, 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3U);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(child0It).size(), 0U);
+    BOOST_CHECK_EQUAL(child0It->GetCountWithAncestors(), 1U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
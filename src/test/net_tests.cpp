@@ -10,7 +10,10 @@
 #include <streams.h>
 #include <net.h>
 #include <netbase.h>
+#include <netmessagemaker.h>
 #include <chainparams.h>
+#include <primitives/block.h>
+#include <script/script.h>
 #include <util.h>
 
 class CAddrManSerializationMock : public CAddrMan
@@ -71,6 +74,38 @@ CDataStream AddrmanToStream(CAddrManSerializationMock& _addrman)
     return CDataStream(vchData, SER_DISK, CLIENT_VERSION);
 }
 
+// Receive a message in chunks of nChunk bytes the way CNode::ReceiveMsgBytes
+// does once the handshake is done, and return the most bytes vRecv held.
+static size_t ReceiveInChunks(CNetMessage& msg, const CSharedNetMsg& shared, size_t nChunk)
+{
+    std::vector<unsigned char> vData(*shared.header);
+    if (shared.data) {
+        vData.insert(vData.end(), shared.data->begin(), shared.data->end());
+    }
+    size_t nMaxBuffered = 0;
+    size_t nPos = 0;
+    while (nPos < vData.size()) {
+        const unsigned int nBytes = std::min(nChunk, vData.size() - nPos);
+        int handled;
+        if (!msg.in_data) {
+            handled = msg.readHeader((const char*)&vData[nPos], nBytes);
+            if (msg.in_data)
+                msg.StartParse(PROTOCOL_VERSION);
+        } else {
+            handled = msg.readData((const char*)&vData[nPos], nBytes);
+            msg.Parse(MAX_RECV_PARSE_BYTES);
+        }
+        BOOST_REQUIRE(handled > 0);
+        nPos += handled;
+        nMaxBuffered = std::max(nMaxBuffered, msg.vRecv.size());
+    }
+    BOOST_CHECK(msg.complete());
+    if (shared.data) {
+        BOOST_CHECK(memcmp(msg.GetMessageHash().begin(), shared.header->data() + CMessageHeader::MESSAGE_START_SIZE + CMessageHeader::COMMAND_SIZE + 4, CMessageHeader::CHECKSUM_SIZE) == 0);
+    }
+    return nMaxBuffered;
+}
+
 BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(cnode_listen_port)
@@ -185,4 +220,202 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cnetmessage_incremental_parse)
+{
+    CBlock block;
+    block.nVersion = 1;
+    block.nTime = 1234;
+    block.nBits = 0x207fffff;
+    for (int i = 0; i < 50; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1 + i % 3);
+        for (CTxIn& txin : tx.vin) {
+            txin.prevout = COutPoint(InsecureRand256(), i);
+            txin.scriptSig = CScript() << std::vector<unsigned char>(i * 37, 0x42);
+        }
+        if (i % 2) {
+            tx.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(100 + i, 1));
+        }
+        tx.vout.resize(2);
+        tx.vout[0].nValue = i;
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+    }
+    size_t nMaxTxSize = 0;
+    for (const CTransactionRef& tx : block.vtx) {
+        nMaxTxSize = std::max(nMaxTxSize, ::GetSerializeSize(*tx, SER_NETWORK, PROTOCOL_VERSION));
+    }
+    std::vector<CBlock> vHeaders(100, block);
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        vHeaders[i].vtx.clear();
+        vHeaders[i].nNonce = i;
+    }
+
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    CSharedNetMsg msgBlock = CConnman::PrepareMessage(msgMaker.Make(NetMsgType::BLOCK, block));
+    CSharedNetMsg msgHeaders = CConnman::PrepareMessage(msgMaker.Make(NetMsgType::HEADERS, vHeaders));
+    for (size_t nChunk : {1, 13, 1000, 1000000}) {
+        // The block is ready when its last byte arrived and vRecv never
+        // held much more than the transaction being received.
+        CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+        size_t nMaxBuffered = ReceiveInChunks(msg, msgBlock, nChunk);
+        if (nChunk <= 1000) {
+            BOOST_CHECK(nMaxBuffered <= 2 * nMaxTxSize + nChunk);
+            BOOST_CHECK(nMaxBuffered < msgBlock.data->size() / 4);
+        }
+        std::shared_ptr<CBlock> pblock;
+        BOOST_CHECK(msg.TakeParsed(pblock));
+        BOOST_REQUIRE(pblock);
+        BOOST_CHECK(pblock->GetHash() == block.GetHash());
+        BOOST_REQUIRE_EQUAL(pblock->vtx.size(), block.vtx.size());
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            BOOST_CHECK(pblock->vtx[i]->GetWitnessHash() == block.vtx[i]->GetWitnessHash());
+        }
+
+        CNetMessage msg2(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+        ReceiveInChunks(msg2, msgHeaders, nChunk);
+        std::vector<CBlockHeader> headers;
+        BOOST_CHECK(msg2.TakeParsed(headers));
+        BOOST_REQUIRE_EQUAL(headers.size(), vHeaders.size());
+        for (size_t i = 0; i < headers.size(); i++) {
+            BOOST_CHECK(headers[i].GetHash() == vHeaders[i].GetHash());
+        }
+    }
+
+    // A large block received at once is only partly deserialized on receipt,
+    // and finished when it is handed over
+    CBlock blockLarge(block);
+    while (::GetSerializeSize(blockLarge, SER_NETWORK, PROTOCOL_VERSION) < 2 * MAX_RECV_PARSE_BYTES) {
+        blockLarge.vtx.insert(blockLarge.vtx.end(), block.vtx.begin(), block.vtx.end());
+    }
+    CSharedNetMsg msgLarge = CConnman::PrepareMessage(msgMaker.Make(NetMsgType::BLOCK, blockLarge));
+    CNetMessage msgAtOnce(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    ReceiveInChunks(msgAtOnce, msgLarge, msgLarge.data->size());
+    BOOST_CHECK(!msgAtOnce.fParseDone);
+    BOOST_CHECK(msgAtOnce.nParsePos > 0);
+    BOOST_CHECK(msgAtOnce.nParsePos <= MAX_RECV_PARSE_BYTES);
+    BOOST_CHECK_EQUAL(msgAtOnce.vRecv.size(), msgLarge.data->size() - msgAtOnce.nParsePos);
+    std::shared_ptr<CBlock> pblockLarge;
+    BOOST_CHECK(msgAtOnce.TakeParsed(pblockLarge));
+    BOOST_REQUIRE(pblockLarge);
+    BOOST_CHECK(pblockLarge->GetHash() == blockLarge.GetHash());
+    BOOST_CHECK_EQUAL(pblockLarge->vtx.size(), blockLarge.vtx.size());
+
+    // A truncated block fails like deserializing it from vRecv would
+    CSerializedNetMsg truncated = msgMaker.Make(NetMsgType::BLOCK, block);
+    truncated.data.resize(truncated.data.size() - 10);
+    CNetMessage msgTruncated(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    ReceiveInChunks(msgTruncated, CConnman::PrepareMessage(std::move(truncated)), 100);
+    std::shared_ptr<CBlock> pblock;
+    BOOST_CHECK_EXCEPTION(msgTruncated.TakeParsed(pblock), std::ios_base::failure, [](const std::ios_base::failure& e) { return strstr(e.what(), "end of data") != nullptr; });
+
+    // Other messages are left in vRecv
+    CSharedNetMsg msgTx = CConnman::PrepareMessage(msgMaker.Make(NetMsgType::TX, *block.vtx[1]));
+    CNetMessage msgOther(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    ReceiveInChunks(msgOther, msgTx, 7);
+    BOOST_CHECK(!msgOther.TakeParsed(pblock));
+    BOOST_CHECK(msgOther.vRecv.size() == msgTx.data->size());
+    BOOST_CHECK(std::equal(msgOther.vRecv.begin(), msgOther.vRecv.end(), (const char*)msgTx.data->data()));
+}
+
+BOOST_AUTO_TEST_CASE(shared_net_msg_cache)
+{
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    std::vector<CSharedNetMsg> vMsg;
+    for (int i = 0; i < 4; i++) {
+        vMsg.push_back(CConnman::PrepareMessage(msgMaker.Make(NetMsgType::PING, std::vector<unsigned char>(1000, i))));
+    }
+    const size_t nMsgSize = vMsg[0].GetSize();
+    BOOST_CHECK_EQUAL(nMsgSize, CMessageHeader::HEADER_SIZE + 1003U);
+
+    CSharedNetMsgCache cache(3 * nMsgSize);
+    const uint256 hash = InsecureRand256();
+    BOOST_CHECK(cache.Find(CInv(MSG_TX, hash)).IsNull());
+    cache.Insert(CInv(MSG_TX, hash), vMsg[0]);
+    cache.Insert(CInv(MSG_WITNESS_TX, hash), vMsg[1]);
+    cache.Insert(CInv(MSG_TX, InsecureRand256()), vMsg[2]);
+    BOOST_CHECK_EQUAL(cache.GetCount(), 3U);
+    BOOST_CHECK_EQUAL(cache.GetSize(), 3 * nMsgSize);
+    BOOST_CHECK(cache.Find(CInv(MSG_TX, hash)).data == vMsg[0].data);
+    BOOST_CHECK(cache.Find(CInv(MSG_WITNESS_TX, hash)).data == vMsg[1].data);
+
+    // An entry that is already cached is kept as it is
+    cache.Insert(CInv(MSG_TX, hash), vMsg[3]);
+    BOOST_CHECK(cache.Find(CInv(MSG_TX, hash)).data == vMsg[0].data);
+
+    // The least recently used entry makes room for a new one
+    cache.Insert(CInv(MSG_BLOCK, hash), vMsg[3]);
+    BOOST_CHECK_EQUAL(cache.GetCount(), 3U);
+    BOOST_CHECK_EQUAL(cache.GetSize(), 3 * nMsgSize);
+    BOOST_CHECK(!cache.Find(CInv(MSG_TX, hash)).IsNull());
+    BOOST_CHECK(!cache.Find(CInv(MSG_WITNESS_TX, hash)).IsNull());
+    BOOST_CHECK(!cache.Find(CInv(MSG_BLOCK, hash)).IsNull());
+
+    // Messages larger than the whole cache are not kept
+    CSharedNetMsg msgLarge = CConnman::PrepareMessage(msgMaker.Make(NetMsgType::PING, std::vector<unsigned char>(4000)));
+    cache.Insert(CInv(MSG_WITNESS_BLOCK, hash), msgLarge);
+    BOOST_CHECK(cache.Find(CInv(MSG_WITNESS_BLOCK, hash)).IsNull());
+    BOOST_CHECK_EQUAL(cache.GetCount(), 3U);
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.GetCount(), 0U);
+    BOOST_CHECK_EQUAL(cache.GetSize(), 0U);
+    BOOST_CHECK(cache.Find(CInv(MSG_BLOCK, hash)).IsNull());
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(cnode_send_queue)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    CConnman connman(0x1337, 0x1337);
+    CAddress addr = CAddress(CService(CNetAddr(), 7777), NODE_NETWORK);
+    CNode node(0, NODE_NETWORK, 0, fds[0], addr, 0, 0, CAddress(), "", false);
+
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    std::vector<unsigned char> vPayload(2 * 1000 * 1000);
+    for (size_t i = 0; i < vPayload.size(); i++) {
+        vPayload[i] = i * 7;
+    }
+    CSharedNetMsg msgPing = CConnman::PrepareMessage(msgMaker.Make(NetMsgType::PING, (uint64_t)42));
+    CSharedNetMsg msgBlock = CConnman::PrepareMessage(msgMaker.Make(NetMsgType::BLOCK, vPayload));
+    CSharedNetMsg msgVerack = CConnman::PrepareMessage(msgMaker.Make(NetMsgType::VERACK));
+    BOOST_CHECK(!msgVerack.data);
+    std::vector<unsigned char> vExpected;
+    for (const CSharedNetMsg* msg : {&msgPing, &msgBlock, &msgBlock, &msgVerack}) {
+        vExpected.insert(vExpected.end(), msg->header->begin(), msg->header->end());
+        if (msg->data) {
+            vExpected.insert(vExpected.end(), msg->data->begin(), msg->data->end());
+        }
+    }
+
+    // The payload is larger than the socket buffer, so the optimistic send
+    // leaves both queued copies of it behind, sharing one buffer.
+    connman.PushMessage(&node, msgMaker.Make(NetMsgType::PING, (uint64_t)42));
+    connman.PushMessage(&node, msgBlock);
+    connman.PushMessage(&node, msgBlock);
+    connman.PushMessage(&node, msgVerack);
+    BOOST_CHECK_EQUAL(msgBlock.data.use_count(), 3);
+
+    // Everything arrives in order across partial sends.
+    std::vector<unsigned char> vReceived;
+    unsigned char buf[65536];
+    while (vReceived.size() < vExpected.size()) {
+        CConnmanTest::SocketSendData(connman, node);
+        ssize_t nBytes = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+        if (nBytes > 0) {
+            vReceived.insert(vReceived.end(), buf, buf + nBytes);
+        } else {
+            BOOST_REQUIRE(nBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+        }
+    }
+    BOOST_CHECK(vReceived == vExpected);
+    BOOST_CHECK(node.vSendMsg.empty());
+    BOOST_CHECK_EQUAL(node.nSendSize, 0U);
+    BOOST_CHECK_EQUAL(msgBlock.data.use_count(), 1);
+    close(fds[1]);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -177,6 +177,24 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     for (int i = 2; i < 9; i++) { // At 9, the original estimate was already at the bottom (b/c scale = 2)
         BOOST_CHECK(feeEst.estimateFee(i).GetFeePerK() < origFeeEst[i-1] - deltaFee);
     }
+
+    // Smart fee estimates are answered from a table computed once per block
+    FeeCalculation feeCalc;
+    CFeeRate smartFee = feeEst.estimateSmartFee(4, &feeCalc, false);
+    BOOST_CHECK(smartFee.GetFeePerK() > 0);
+    BOOST_CHECK_EQUAL(feeCalc.desiredTarget, 4);
+    BOOST_CHECK_EQUAL(feeCalc.returnedTarget, 4);
+    BOOST_CHECK(feeEst.estimateSmartFee(1, &feeCalc, false) == feeEst.estimateSmartFee(2, nullptr, false));
+    BOOST_CHECK_EQUAL(feeCalc.desiredTarget, 1);
+    BOOST_CHECK_EQUAL(feeCalc.returnedTarget, 2);
+    BOOST_CHECK(feeEst.estimateSmartFee(4, nullptr, true) >= smartFee);
+    BOOST_CHECK(feeEst.estimateSmartFee(1009, nullptr, false) == CFeeRate(0));
+    // Transactions entering the mempool since the last block don't change the answers
+    for (int i = 0; i < 100; i++) {
+        tx.vin[0].prevout.n = 10000*blocknum+i;
+        mpool.addUnchecked(tx.GetHash(), entry.Fee(feeV[0]).Time(GetTime()).Height(blocknum).FromTx(tx));
+    }
+    BOOST_CHECK(feeEst.estimateSmartFee(4, nullptr, false) == smartFee);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -61,6 +61,29 @@ BOOST_AUTO_TEST_CASE(get_next_work_upper_limit_actual)
     BOOST_CHECK_EQUAL(CalculateNextWorkRequired(&pindexLast, nLastRetargetTime, chainParams->GetConsensus()), 0x1b054c60);
 }
 
+/* Test the difficulty transitions allowed between headers */
+BOOST_AUTO_TEST_CASE(permitted_difficulty_transition)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+    // The target only changes at retargets
+    BOOST_CHECK(PermittedDifficultyTransition(params, 578591, 0x1b075cf1, 0x1b075cf1));
+    BOOST_CHECK(!PermittedDifficultyTransition(params, 578591, 0x1b075cf1, 0x1b075cf0));
+    // And then within the limits of the timespan, see the tests above
+    BOOST_CHECK(PermittedDifficultyTransition(params, 578592, 0x1b075cf1, 0x1b075cf1));
+    BOOST_CHECK(PermittedDifficultyTransition(params, 578592, 0x1b075cf1, 0x1b01d73c));
+    BOOST_CHECK(!PermittedDifficultyTransition(params, 578592, 0x1b075cf1, 0x1b01d73b));
+    BOOST_CHECK(PermittedDifficultyTransition(params, 1001952, 0x1b015318, 0x1b054c60));
+    BOOST_CHECK(!PermittedDifficultyTransition(params, 1001952, 0x1b015318, 0x1b054c61));
+    // Up to the proof of work limit
+    BOOST_CHECK(PermittedDifficultyTransition(params, 2016, 0x1e0ffff0, 0x1e0fffff));
+    BOOST_CHECK(!PermittedDifficultyTransition(params, 2016, 0x1e0ffff0, 0x1e100000));
+
+    // Anything goes where minimum difficulty blocks are allowed
+    const auto testnetParams = CreateChainParams(CBaseChainParams::TESTNET);
+    BOOST_CHECK(PermittedDifficultyTransition(testnetParams->GetConsensus(), 578591, 0x1b075cf1, 0x1e0fffff));
+}
+
 BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
 {
     const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
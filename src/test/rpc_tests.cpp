@@ -4,6 +4,7 @@
 
 #include <rpc/server.h>
 #include <rpc/client.h>
+#include <script/sigcache.h>
 
 #include <base58.h>
 #include <core_io.h>
@@ -11,6 +12,8 @@
 
 #include <test/test_bitcoin.h>
 
+#include <thread>
+
 #include <boost/algorithm/string.hpp>
 #include <boost/test/unit_test.hpp>
 
@@ -322,6 +325,69 @@ BOOST_AUTO_TEST_CASE(rpc_ban)
     BOOST_CHECK_EQUAL(adr.get_str(), "2001:4d48:ac57:400:cacf:e9ff:fe1d:9c63/128");
 }
 
+BOOST_AUTO_TEST_CASE(rpc_sigcache)
+{
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getsigcacheinfo"));
+    UniValue sigs = find_value(r.get_obj(), "signatures");
+    BOOST_CHECK_EQUAL(find_value(sigs.get_obj(), "shards").get_int(), DEFAULT_SIG_CACHE_SHARDS);
+    BOOST_CHECK(find_value(sigs.get_obj(), "elements").get_int64() > 0);
+    BOOST_CHECK(find_value(r.get_obj(), "scripts").isObject());
+
+    BOOST_CHECK_THROW(CallRPC("setsigcachesize"), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("setsigcachesize -1"), std::runtime_error);
+    BOOST_CHECK_NO_THROW(r = CallRPC("setsigcachesize 4"));
+    for (const char* name : {"signatures", "scripts"}) {
+        UniValue cache = find_value(r.get_obj(), name);
+        BOOST_CHECK_EQUAL(find_value(cache.get_obj(), "bytes").get_int64(), 2 << 20);
+        BOOST_CHECK_EQUAL(find_value(cache.get_obj(), "hits").get_int64(), 0);
+        BOOST_CHECK_EQUAL(find_value(cache.get_obj(), "inserts").get_int64(), 0);
+    }
+    BOOST_CHECK_EQUAL(find_value(find_value(r.get_obj(), "signatures").get_obj(), "shards").get_int(), DEFAULT_SIG_CACHE_SHARDS);
+
+    // Concurrent resizes leave both caches with the size of the same one
+    std::vector<std::thread> threads;
+    for (int nSize : {4, 8}) {
+        threads.emplace_back([nSize] {
+            for (int i = 0; i < 10; i++)
+                CallRPC(strprintf("setsigcachesize %d", nSize));
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    BOOST_CHECK_NO_THROW(r = CallRPC("getsigcacheinfo"));
+    int64_t nBytes = find_value(find_value(r.get_obj(), "signatures").get_obj(), "bytes").get_int64();
+    BOOST_CHECK(nBytes == 2 << 20 || nBytes == 4 << 20);
+    BOOST_CHECK_EQUAL(find_value(find_value(r.get_obj(), "scripts").get_obj(), "bytes").get_int64(), nBytes);
+    BOOST_CHECK_NO_THROW(CallRPC(strprintf("setsigcachesize %d", DEFAULT_MAX_SIG_CACHE_SIZE)));
+
+    // The shards are picked by a mask
+    BOOST_CHECK(IsValidSigCacheShardCount(1));
+    BOOST_CHECK(IsValidSigCacheShardCount(DEFAULT_SIG_CACHE_SHARDS));
+    BOOST_CHECK(IsValidSigCacheShardCount(MAX_SIG_CACHE_SHARDS));
+    BOOST_CHECK(!IsValidSigCacheShardCount(0));
+    BOOST_CHECK(!IsValidSigCacheShardCount(6));
+    BOOST_CHECK(!IsValidSigCacheShardCount(2 * MAX_SIG_CACHE_SHARDS));
+}
+
+BOOST_AUTO_TEST_CASE(rpc_blockconnectstats)
+{
+    // The genesis block was connected by the test setup
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getblockconnectstats"));
+    BOOST_CHECK(find_value(r.get_obj(), "blocks").get_int64() > 0);
+    UniValue total = find_value(find_value(r.get_obj(), "phases").get_obj(), "total");
+    BOOST_CHECK(find_value(total.get_obj(), "count").get_int64() > 0);
+    BOOST_CHECK(!find_value(total.get_obj(), "buckets").empty());
+    UniValue recent = find_value(r.get_obj(), "recent");
+    BOOST_CHECK(!recent.empty());
+    BOOST_CHECK(find_value(recent[recent.size() - 1].get_obj(), "phases").exists("total"));
+
+    BOOST_CHECK_NO_THROW(r = CallRPC("getblockconnectstats 0"));
+    BOOST_CHECK(find_value(r.get_obj(), "recent").empty());
+    BOOST_CHECK_THROW(CallRPC("getblockconnectstats -1"), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
 {
     UniValue result;
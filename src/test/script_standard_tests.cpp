@@ -2,13 +2,16 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <crypto/sha256.h>
 #include <key.h>
 #include <keystore.h>
+#include <policy/policy.h>
 #include <script/ismine.h>
 #include <script/script.h>
 #include <script/script_error.h>
 #include <script/standard.h>
 #include <test/test_bitcoin.h>
+#include <utilstrencodings.h>
 
 #include <boost/test/unit_test.hpp>
 
@@ -733,4 +736,186 @@ BOOST_AUTO_TEST_CASE(script_standard_IsMine)
     }
 }
 
+
+namespace {
+
+struct StandardSpend
+{
+    CScript scriptPubKey;
+    CScript scriptSig;
+    CScriptWitness witness;
+    //! Whether VerifyStandardScript() handles the spend unchanged, with the standard flags
+    bool fHandled;
+};
+
+std::vector<unsigned char> SignInput(const CKey& key, const CScript& scriptCode, const CMutableTransaction& tx, const CAmount& amount, SigVersion sigversion)
+{
+    uint256 hash = SignatureHash(scriptCode, tx, 0, SIGHASH_ALL, amount, sigversion);
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    return vchSig;
+}
+
+void FlipBit(std::vector<unsigned char>& vch)
+{
+    if (!vch.empty())
+        vch[InsecureRandRange(vch.size())] ^= 1 << InsecureRandBits(3);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(script_standard_VerifyStandardScript)
+{
+    // Check that VerifyStandardScript() agrees with VerifyScript() on valid
+    // spends of the standard templates, and on random corruptions of them.
+    const CAmount amount = 1 * COIN;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = amount;
+    MutableTransactionSignatureChecker checker(&tx, 0, amount);
+
+    CKey keys[3], keyUncompressed;
+    for (int i = 0; i < 3; i++)
+        keys[i].MakeNewKey(true);
+    keyUncompressed.MakeNewKey(false);
+
+    std::vector<StandardSpend> spends;
+    for (const CKey& key : {keys[0], keyUncompressed}) {
+        CPubKey pubkey = key.GetPubKey();
+        CScript scriptKeyHash = GetScriptForDestination(pubkey.GetID());
+        std::vector<unsigned char> vchSigBase = SignInput(key, scriptKeyHash, tx, amount, SIGVERSION_BASE);
+        std::vector<unsigned char> vchSigWitness = SignInput(key, scriptKeyHash, tx, amount, SIGVERSION_WITNESS_V0);
+
+        StandardSpend spend;
+        spend.scriptPubKey = scriptKeyHash;
+        spend.scriptSig << vchSigBase << ToByteVector(pubkey);
+        spend.fHandled = true;
+        spends.push_back(spend);
+
+        CScript scriptWitnessKeyHash = GetScriptForDestination(WitnessV0KeyHash(pubkey.GetID()));
+        spend = StandardSpend();
+        spend.scriptPubKey = scriptWitnessKeyHash;
+        spend.witness.stack = {vchSigWitness, ToByteVector(pubkey)};
+        spend.fHandled = pubkey.IsCompressed();
+        spends.push_back(spend);
+        spend.scriptPubKey = GetScriptForDestination(CScriptID(scriptWitnessKeyHash));
+        spend.scriptSig << ToByteVector(scriptWitnessKeyHash);
+        spends.push_back(spend);
+    }
+    CScript witnessScript = GetScriptForMultisig(2, {keys[0].GetPubKey(), keys[1].GetPubKey(), keys[2].GetPubKey()});
+    uint256 hashWitnessScript;
+    CSHA256().Write(witnessScript.data(), witnessScript.size()).Finalize(hashWitnessScript.begin());
+    CScript scriptWitnessScriptHash = GetScriptForDestination(WitnessV0ScriptHash(hashWitnessScript));
+    StandardSpend spend;
+    spend.scriptPubKey = scriptWitnessScriptHash;
+    spend.witness.stack = {{}, SignInput(keys[0], witnessScript, tx, amount, SIGVERSION_WITNESS_V0),
+                           SignInput(keys[2], witnessScript, tx, amount, SIGVERSION_WITNESS_V0), ToByteVector(witnessScript)};
+    spend.fHandled = true;
+    spends.push_back(spend);
+    spend.scriptPubKey = GetScriptForDestination(CScriptID(scriptWitnessScriptHash));
+    spend.scriptSig << ToByteVector(scriptWitnessScriptHash);
+    spends.push_back(spend);
+
+    // A validly encoded signature of something else
+    std::vector<unsigned char> vchSigOther;
+    BOOST_CHECK(keys[1].Sign(InsecureRand256(), vchSigOther));
+    vchSigOther.push_back((unsigned char)SIGHASH_ALL);
+
+    const unsigned int flagsMask = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_LOW_S |
+                                   SCRIPT_VERIFY_NULLDUMMY | SCRIPT_VERIFY_SIGPUSHONLY | SCRIPT_VERIFY_MINIMALDATA |
+                                   SCRIPT_VERIFY_CLEANSTACK | SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_NULLFAIL |
+                                   SCRIPT_VERIFY_WITNESS_PUBKEYTYPE;
+    int nHandled = 0, nValid = 0, nInvalid = 0;
+    for (unsigned int i = 0; i < 3000; i++) {
+        const StandardSpend& base = spends[i % spends.size()];
+        CScript scriptSig = base.scriptSig;
+        CScriptWitness witness = base.witness;
+        unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS;
+        if (i >= spends.size()) {
+            flags = InsecureRand32() & flagsMask;
+            if (flags & SCRIPT_VERIFY_CLEANSTACK)
+                flags |= SCRIPT_VERIFY_WITNESS;
+            if (flags & SCRIPT_VERIFY_WITNESS)
+                flags |= SCRIPT_VERIFY_P2SH;
+            for (int nMutations = InsecureRandRange(3); nMutations > 0; nMutations--) {
+                std::vector<std::vector<unsigned char>>& items = witness.stack;
+                std::vector<unsigned char> vch(scriptSig.begin(), scriptSig.end());
+                switch (InsecureRandRange(6)) {
+                case 0:
+                    FlipBit(vch);
+                    scriptSig = CScript(vch.begin(), vch.end());
+                    break;
+                case 1:
+                    if (!items.empty())
+                        FlipBit(items[InsecureRandRange(items.size())]);
+                    break;
+                case 2:
+                    if (!items.empty())
+                        items[InsecureRandRange(items.size())].clear();
+                    break;
+                case 3:
+                    if (!items.empty())
+                        items[InsecureRandRange(items.size())] = vchSigOther;
+                    break;
+                case 4:
+                    if (!items.empty() && InsecureRandBool())
+                        items.erase(items.begin() + InsecureRandRange(items.size()));
+                    else
+                        items.insert(items.begin() + InsecureRandRange(items.size() + 1), vchSigOther);
+                    break;
+                case 5: {
+                    // Replace one of the pushes in the scriptSig
+                    std::vector<std::vector<unsigned char>> pushes;
+                    CScript::const_iterator pc = scriptSig.begin();
+                    opcodetype opcode;
+                    std::vector<unsigned char> data;
+                    while (scriptSig.GetOp(pc, opcode, data))
+                        pushes.push_back(data);
+                    if (pushes.empty())
+                        break;
+                    pushes[InsecureRandRange(pushes.size())] = InsecureRandBool() ? vchSigOther : std::vector<unsigned char>();
+                    scriptSig.clear();
+                    for (const auto& push : pushes)
+                        scriptSig << push;
+                    break;
+                }
+                }
+            }
+        }
+
+        bool fSuccess;
+        ScriptError err;
+        bool fHandled = VerifyStandardScript(scriptSig, base.scriptPubKey, &witness, flags, checker, fSuccess, &err);
+        if (i < spends.size()) {
+            BOOST_CHECK_EQUAL(fHandled, base.fHandled);
+            BOOST_CHECK(!fHandled || fSuccess);
+        }
+        if (!fHandled)
+            continue;
+        nHandled++;
+        (fSuccess ? nValid : nInvalid)++;
+
+        ScriptError errInterpreter;
+        bool fSuccessInterpreter = VerifyScript(scriptSig, base.scriptPubKey, &witness, flags, checker, &errInterpreter);
+        BOOST_CHECK_MESSAGE(fSuccess == fSuccessInterpreter && err == errInterpreter,
+                            strprintf("%s flags %x: %s, interpreter %s", HexStr(scriptSig), flags, ScriptErrorString(err), ScriptErrorString(errInterpreter)));
+
+        // Only the standard templates are handled
+        txnouttype whichType;
+        std::vector<std::vector<unsigned char>> solutions;
+        BOOST_CHECK(Solver(base.scriptPubKey, whichType, solutions));
+        BOOST_CHECK(whichType == TX_PUBKEYHASH || whichType == TX_SCRIPTHASH || whichType == TX_WITNESS_V0_KEYHASH || whichType == TX_WITNESS_V0_SCRIPTHASH);
+        if (witness.stack.size() > 2) {
+            BOOST_CHECK(Solver(CScript(witness.stack.back().begin(), witness.stack.back().end()), whichType, solutions));
+            BOOST_CHECK_EQUAL(whichType, TX_MULTISIG);
+        }
+    }
+    BOOST_CHECK(nValid > 0);
+    BOOST_CHECK(nInvalid > 0);
+    BOOST_TEST_MESSAGE(strprintf("%d of the spends handled", nHandled));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
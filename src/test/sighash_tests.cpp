@@ -155,12 +155,48 @@ BOOST_AUTO_TEST_CASE(sighash_test)
         std::cout << "\n";
         #endif
         BOOST_CHECK(sh == sho);
+        PrecomputedTransactionData txdata(txTo);
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, nIn, nHashType, 0, SIGVERSION_BASE, &txdata) == sho);
     }
     #if defined(PRINT_SIGHASH_JSON)
     std::cout << "]\n";
     #endif
 }
 
+BOOST_AUTO_TEST_CASE(sighash_legacy_cache)
+{
+    // Transactions with enough inputs for several midstates, and inputs with
+    // and without a witness
+    for (int i = 0; i < 100; i++) {
+        CMutableTransaction txTo;
+        RandomTransaction(txTo, false);
+        for (int nInputs = InsecureRandRange(100); nInputs > 0; nInputs--) {
+            txTo.vin.push_back(txTo.vin[InsecureRandRange(txTo.vin.size())]);
+            txTo.vin.back().prevout.hash = InsecureRand256();
+            if (InsecureRandBits(3) == 0)
+                txTo.vin.back().scriptWitness.stack.push_back(std::vector<unsigned char>(1));
+        }
+        CTransaction tx(txTo);
+        PrecomputedTransactionData txdata(tx);
+        size_t nLegacyInputs = 0;
+        for (const CTxIn& txin : tx.vin)
+            nLegacyInputs += txin.scriptWitness.IsNull();
+        BOOST_CHECK_EQUAL(txdata.legacyCacheable, nLegacyInputs > 1);
+        BOOST_CHECK(!txdata.HasLegacyCache());
+
+        bool fUsesCache = false;
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++) {
+            int nHashType = InsecureRandBool() ? (int)SIGHASH_ALL : (int)InsecureRand32();
+            CScript scriptCode;
+            RandomScript(scriptCode);
+            BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_BASE, &txdata) == SignatureHashOld(scriptCode, tx, nIn, nHashType));
+            fUsesCache |= !(nHashType & SIGHASH_ANYONECANPAY) && (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE;
+        }
+        // Built on the first signature hash that uses it
+        BOOST_CHECK_EQUAL(txdata.HasLegacyCache(), nLegacyInputs > 1 && fUsesCache);
+    }
+}
+
 // Goal: check that SignatureHash generates correct hash
 BOOST_AUTO_TEST_CASE(sighash_from_data)
 {
@@ -206,6 +242,9 @@ BOOST_AUTO_TEST_CASE(sighash_from_data)
 
         sh = SignatureHash(scriptCode, *tx, nIn, nHashType, 0, SIGVERSION_BASE);
         BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
+        PrecomputedTransactionData txdata(*tx);
+        sh = SignatureHash(scriptCode, *tx, nIn, nHashType, 0, SIGVERSION_BASE, &txdata);
+        BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
     }
 }
 BOOST_AUTO_TEST_SUITE_END()
@@ -53,6 +53,7 @@ class CNode;
 struct CConnmanTest {
     static void AddNode(CNode& node);
     static void ClearNodes();
+    static size_t SocketSendData(const CConnman& connman, CNode& node);
 };
 
 class PeerLogicValidation;
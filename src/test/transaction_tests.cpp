@@ -23,6 +23,7 @@
 
 #include <map>
 #include <string>
+#include <thread>
 
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
@@ -279,6 +280,60 @@ BOOST_AUTO_TEST_CASE(basic_transaction_tests)
     BOOST_CHECK_MESSAGE(!CheckTransaction(tx, state) || !state.IsValid(), "Transaction with duplicate txins should be invalid.");
 }
 
+BOOST_AUTO_TEST_CASE(transaction_hash_cache)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(2);
+    mtx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    mtx.vin[1].prevout = COutPoint(InsecureRand256(), 1);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = CENT;
+    const uint256 txid = SerializeHash(mtx, SER_GETHASH, SERIALIZE_TRANSACTION_NO_WITNESS);
+
+    // Without a witness, both hashes are the txid
+    CTransaction tx(mtx);
+    BOOST_CHECK(tx.GetWitnessHash() == txid);
+    BOOST_CHECK(tx.GetHash() == txid);
+
+    // With one, the witness hash covers it
+    mtx.vin[1].scriptWitness.stack.push_back(std::vector<unsigned char>(72, 1));
+    const uint256 wtxid = SerializeHash(mtx, SER_GETHASH, 0);
+    BOOST_CHECK(wtxid != txid);
+    CTransactionRef ptx = MakeTransactionRef(mtx);
+    BOOST_CHECK(ptx->GetWitnessHash() == wtxid);
+    BOOST_CHECK(ptx->GetHash() == txid);
+    BOOST_CHECK(&ptx->GetWitnessHash() == &ptx->GetWitnessHash());
+
+    // Copies keep the hashes, whether or not they were computed yet
+    CTransaction txCopy(*ptx);
+    BOOST_CHECK(txCopy.GetHash() == txid);
+    BOOST_CHECK(txCopy.GetWitnessHash() == wtxid);
+    BOOST_CHECK(CTransaction(CTransaction(mtx)).GetWitnessHash() == wtxid);
+    BOOST_CHECK(CTransaction().GetHash().IsNull());
+
+    // So do deserialized ones, with or without their witnesses
+    for (int nVersion : {PROTOCOL_VERSION, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS}) {
+        CDataStream ss(SER_NETWORK, nVersion);
+        ss << mtx;
+        CTransaction txRead(deserialize, ss);
+        BOOST_CHECK(txRead.GetWitnessHash() == (nVersion == PROTOCOL_VERSION ? wtxid : txid));
+        BOOST_CHECK(txRead.GetHash() == txid);
+    }
+
+    // Threads asking for the hashes at the same time all get them
+    ptx = MakeTransactionRef(mtx);
+    std::vector<std::thread> threads;
+    std::atomic<int> nGood{0};
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&] {
+            if (ptx->GetWitnessHash() == wtxid && ptx->GetHash() == txid) nGood++;
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    BOOST_CHECK_EQUAL(nGood.load(), 4);
+}
+
 //
 // Helper: create two dummy transactions, each with
 // two outputs.  The first has 11 and 50 CENT outputs
@@ -368,4 +368,64 @@ BOOST_FIXTURE_TEST_CASE(checkinputs_test, TestChain100Setup)
     }
 }
 
+
+BOOST_FIXTURE_TEST_CASE(legacy_sighash_cache_built_on_use, TestChain100Setup)
+{
+    // The legacy signature hash cache of a transaction is only built once a
+    // signature hash is computed: not when the scripts are skipped, as for
+    // blocks below the assumevalid block, nor on script execution cache hits
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction split_tx;
+    split_tx.nVersion = 1;
+    split_tx.vin.resize(1);
+    split_tx.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    split_tx.vout.resize(2);
+    split_tx.vout[0].nValue = 11*CENT;
+    split_tx.vout[0].scriptPubKey = scriptPubKey;
+    split_tx.vout[1].nValue = 11*CENT;
+    split_tx.vout[1].scriptPubKey = scriptPubKey;
+    {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, split_tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        split_tx.vin[0].scriptSig << vchSig;
+    }
+    CreateAndProcessBlock({split_tx}, scriptPubKey);
+
+    CMutableTransaction spend_tx;
+    spend_tx.nVersion = 1;
+    spend_tx.vin.resize(2);
+    spend_tx.vin[0].prevout = COutPoint(split_tx.GetHash(), 0);
+    spend_tx.vin[1].prevout = COutPoint(split_tx.GetHash(), 1);
+    spend_tx.vout.resize(1);
+    spend_tx.vout[0].nValue = 20*CENT;
+    spend_tx.vout[0].scriptPubKey = scriptPubKey;
+    for (unsigned int i = 0; i < 2; i++) {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, spend_tx, i, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spend_tx.vin[i].scriptSig << vchSig;
+    }
+    CTransaction tx(spend_tx);
+
+    LOCK(cs_main);
+    CValidationState state;
+    PrecomputedTransactionData txdata(tx);
+    BOOST_CHECK(txdata.legacyCacheable);
+    BOOST_CHECK(CheckInputs(tx, state, pcoinsTip.get(), false, SCRIPT_VERIFY_P2SH, false, false, txdata, nullptr));
+    BOOST_CHECK(!txdata.HasLegacyCache());
+
+    BOOST_CHECK(CheckInputs(tx, state, pcoinsTip.get(), true, SCRIPT_VERIFY_P2SH, false, true, txdata, nullptr));
+    BOOST_CHECK(txdata.HasLegacyCache());
+
+    PrecomputedTransactionData txdataCached(tx);
+    std::vector<CScriptCheck> scriptchecks;
+    BOOST_CHECK(CheckInputs(tx, state, pcoinsTip.get(), true, SCRIPT_VERIFY_P2SH, false, false, txdataCached, &scriptchecks));
+    BOOST_CHECK(scriptchecks.empty());
+    BOOST_CHECK(!txdataCached.HasLegacyCache());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
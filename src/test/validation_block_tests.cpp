@@ -0,0 +1,400 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/consensus.h>
+#include <consensus/merkle.h>
+#include <consensus/validation.h>
+#include <pow.h>
+#include <script/interpreter.h>
+#include <test/test_bitcoin.h>
+#include <validation.h>
+#include <validationinterface.h>
+#include <validationstats.h>
+
+#include <atomic>
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(validation_block_tests, TestChain100Setup)
+
+// Build a run of blocks on top of the tip, each spending one of the mature
+// coinbases. The spend in block nBadSig, if any, has an invalid signature.
+static std::vector<std::shared_ptr<CBlock>> BuildBlocks(TestChain100Setup& setup, int nBlocks, int nBadSig)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(setup.coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlockIndex* pindexPrev;
+    {
+        LOCK(cs_main);
+        pindexPrev = chainActive.Tip();
+    }
+    uint256 hashPrev = pindexPrev->GetBlockHash();
+    std::vector<std::shared_ptr<CBlock>> blocks;
+    for (int i = 0; i < nBlocks; i++) {
+        int nHeight = pindexPrev->nHeight + 1 + i;
+        auto pblock = std::make_shared<CBlock>();
+        pblock->nVersion = pindexPrev->nVersion;
+        pblock->hashPrevBlock = hashPrev;
+        pblock->nTime = pindexPrev->nTime + 1 + i;
+        pblock->nBits = pindexPrev->nBits;
+
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << nHeight << OP_0;
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+        coinbase.vout[0].scriptPubKey = scriptPubKey;
+        pblock->vtx.push_back(MakeTransactionRef(coinbase));
+
+        CMutableTransaction spend;
+        spend.nVersion = 1;
+        spend.vin.resize(1);
+        spend.vin[0].prevout = COutPoint(setup.coinbaseTxns[i].GetHash(), 0);
+        spend.vout.resize(1);
+        spend.vout[0].nValue = 11 * CENT;
+        spend.vout[0].scriptPubKey = scriptPubKey;
+        uint256 hash = i == nBadSig ? uint256() : SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(setup.coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spend.vin[0].scriptSig << vchSig;
+        pblock->vtx.push_back(MakeTransactionRef(spend));
+
+        pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+        while (!CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits, chainparams.GetConsensus())) ++pblock->nNonce;
+        hashPrev = pblock->GetHash();
+        blocks.push_back(pblock);
+    }
+    return blocks;
+}
+
+// Process the blocks last to first, so that they are all connected at once
+// when the first one arrives.
+static void ProcessBlocks(const std::vector<std::shared_ptr<CBlock>>& blocks)
+{
+    std::vector<CBlockHeader> headers;
+    for (const auto& pblock : blocks)
+        headers.push_back(pblock->GetBlockHeader());
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlockHeaders(headers, state, Params()));
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it)
+        BOOST_CHECK(ProcessNewBlock(Params(), *it, true, nullptr));
+}
+
+BOOST_AUTO_TEST_CASE(connect_blocks_at_once)
+{
+    BOOST_CHECK(nScriptCheckThreads > 0);
+    int nHeight;
+    {
+        LOCK(cs_main);
+        nHeight = chainActive.Height();
+    }
+    std::vector<std::shared_ptr<CBlock>> blocks = BuildBlocks(*this, MAX_BLOCKS_TO_CONNECT_AT_ONCE + 2, -1);
+    ProcessBlocks(blocks);
+
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeight + (int)blocks.size());
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == blocks.back()->GetHash());
+    for (const auto& pblock : blocks) {
+        BOOST_CHECK(mapBlockIndex[pblock->GetHash()]->IsValid(BLOCK_VALID_SCRIPTS));
+        BOOST_CHECK(!pcoinsTip->HaveCoin(pblock->vtx[1]->vin[0].prevout));
+        BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(pblock->vtx[1]->GetHash(), 0)));
+    }
+
+    // The undo data written for the run disconnects it again
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, Params(), mapBlockIndex[blocks[0]->GetHash()]));
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeight);
+    for (const auto& pblock : blocks) {
+        BOOST_CHECK(pcoinsTip->HaveCoin(pblock->vtx[1]->vin[0].prevout));
+        BOOST_CHECK(!pcoinsTip->HaveCoin(COutPoint(pblock->vtx[1]->GetHash(), 0)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(connect_blocks_at_once_invalid)
+{
+    // A script failure in the middle of the run leaves the chain at the
+    // block before it, and marks the failing block invalid
+    int nHeight;
+    {
+        LOCK(cs_main);
+        nHeight = chainActive.Height();
+    }
+    std::vector<std::shared_ptr<CBlock>> blocks = BuildBlocks(*this, 6, 3);
+    ProcessBlocks(blocks);
+
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeight + 3);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == blocks[2]->GetHash());
+    BOOST_CHECK(mapBlockIndex[blocks[3]->GetHash()]->nStatus & BLOCK_FAILED_VALID);
+    BOOST_CHECK(mapBlockIndex[blocks[5]->GetHash()]->nStatus & BLOCK_FAILED_MASK);
+    BOOST_CHECK(!pcoinsTip->HaveCoin(blocks[2]->vtx[1]->vin[0].prevout));
+    BOOST_CHECK(pcoinsTip->HaveCoin(blocks[3]->vtx[1]->vin[0].prevout));
+    BOOST_CHECK(!pcoinsTip->HaveCoin(COutPoint(blocks[4]->vtx[1]->GetHash(), 0)));
+}
+
+// A block of nTxs transactions that pass CheckTransaction, each with one
+// legacy sigop
+static CBlock BuildLargeBlock(unsigned int nTxs)
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 0;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    for (unsigned int i = 1; i < nTxs; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = CENT;
+        tx.vout[0].scriptPubKey = CScript() << OP_CHECKSIG;
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(check_block_txs_in_parallel)
+{
+    // Large blocks are checked on the block checking threads, with the same
+    // outcome as when they are checked in order
+    BOOST_CHECK(nScriptCheckThreads > 0);
+    const unsigned int nTxs = MIN_BLOCK_TXS_TO_CHECK_IN_PARALLEL * 4;
+    CBlock block = BuildLargeBlock(nTxs);
+    CValidationState state;
+    BOOST_CHECK(CheckBlock(block, state, Params().GetConsensus(), false, false));
+    BOOST_CHECK(state.IsValid());
+
+    // The first invalid transaction is the one reported
+    CMutableTransaction tx(*block.vtx[nTxs - 10]);
+    tx.vout.clear();
+    block.vtx[nTxs - 10] = MakeTransactionRef(tx);
+    tx = CMutableTransaction(*block.vtx[10]);
+    tx.vout[0].nValue = MAX_MONEY + 1;
+    block.vtx[10] = MakeTransactionRef(tx);
+    BOOST_CHECK(!CheckBlock(block, state, Params().GetConsensus(), false, false));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-vout-toolarge");
+
+    // The checks of the block structure come first
+    block.vtx[20] = block.vtx[0];
+    state = CValidationState();
+    BOOST_CHECK(!CheckBlock(block, state, Params().GetConsensus(), false, false));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-cb-multiple");
+
+    // Sigops are counted over all transactions
+    block = BuildLargeBlock(nTxs);
+    tx = CMutableTransaction(*block.vtx[1]);
+    tx.vout[0].scriptPubKey = CScript();
+    for (unsigned int i = 0; i < MAX_BLOCK_SIGOPS_COST / WITNESS_SCALE_FACTOR - (nTxs - 2); i++)
+        tx.vout[0].scriptPubKey << OP_CHECKSIG;
+    block.vtx[1] = MakeTransactionRef(tx);
+    state = CValidationState();
+    BOOST_CHECK(CheckBlock(block, state, Params().GetConsensus(), false, false));
+    tx.vout[0].scriptPubKey << OP_CHECKSIG;
+    block.vtx[1] = MakeTransactionRef(tx);
+    BOOST_CHECK(!CheckBlock(block, state, Params().GetConsensus(), false, false));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-blk-sigops");
+}
+
+// A chain of nBlocks blocks with only a coinbase on top of pindexPrev,
+// tagged so that chains built with different tags compete. The coinbase of
+// block nBadBlock, if any, claims more than the subsidy.
+static std::vector<std::shared_ptr<const CBlock>> BuildFork(const CBlockIndex* pindexPrev, int nBlocks, int nTag, int nBadBlock)
+{
+    const CChainParams& chainparams = Params();
+    std::vector<std::shared_ptr<const CBlock>> blocks;
+    uint256 hashPrev = pindexPrev->GetBlockHash();
+    for (int i = 0; i < nBlocks; i++) {
+        int nHeight = pindexPrev->nHeight + 1 + i;
+        auto pblock = std::make_shared<CBlock>();
+        pblock->nVersion = pindexPrev->nVersion;
+        pblock->hashPrevBlock = hashPrev;
+        pblock->nTime = pindexPrev->nTime + 1 + i;
+        pblock->nBits = pindexPrev->nBits;
+
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << nHeight << nTag << OP_0;
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = i == nBadBlock ? GetBlockSubsidy(nHeight, chainparams.GetConsensus()) + 1 : 0;
+        coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        pblock->vtx.push_back(MakeTransactionRef(coinbase));
+
+        pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+        while (!CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits, chainparams.GetConsensus())) ++pblock->nNonce;
+        hashPrev = pblock->GetHash();
+        blocks.push_back(pblock);
+    }
+    return blocks;
+}
+
+// Follows the tip through the block connected and disconnected
+// notifications, and notes when one doesn't continue from the last
+struct TipTracker : public CValidationInterface
+{
+    uint256 hashTip;
+    bool fConsistent = true;
+
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted) override
+    {
+        fConsistent &= block->hashPrevBlock == hashTip;
+        hashTip = block->GetHash();
+    }
+
+    void BlockDisconnected(const std::shared_ptr<const CBlock>& block) override
+    {
+        fConsistent &= block->GetHash() == hashTip;
+        hashTip = block->hashPrevBlock;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(competing_blocks_from_several_threads)
+{
+    // With several message handler threads, peers in different shards hand
+    // blocks to ProcessNewBlock at the same time. Submit competing forks
+    // from two threads: the chain state and the notifications must stay
+    // consistent, and the fork with the most work must win.
+    TipTracker tracker;
+    {
+        LOCK(cs_main);
+        tracker.hashTip = chainActive.Tip()->GetBlockHash();
+    }
+    RegisterValidationInterface(&tracker);
+
+    for (int nRound = 0; nRound < 10; nRound++) {
+        const CBlockIndex* pindexTip;
+        {
+            LOCK(cs_main);
+            pindexTip = chainActive.Tip();
+        }
+        int nShort = 2 + InsecureRandRange(6);
+        std::vector<std::shared_ptr<const CBlock>> forks[2];
+        bool fFirstLonger = InsecureRandBool();
+        forks[0] = BuildFork(pindexTip, fFirstLonger ? nShort + 1 : nShort, 2 * nRound, -1);
+        forks[1] = BuildFork(pindexTip, fFirstLonger ? nShort : nShort + 1, 2 * nRound + 1, -1);
+
+        std::atomic<bool> fAllProcessed(true);
+        std::vector<std::thread> threads;
+        for (const auto& fork : forks) {
+            threads.emplace_back([&fork, &fAllProcessed] {
+                for (const auto& pblock : fork) {
+                    if (!ProcessNewBlock(Params(), pblock, true, nullptr))
+                        fAllProcessed = false;
+                }
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+        BOOST_CHECK(fAllProcessed);
+
+        const auto& longer = fFirstLonger ? forks[0] : forks[1];
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == longer.back()->GetHash());
+    }
+
+    SyncWithValidationInterfaceQueue();
+    UnregisterValidationInterface(&tracker);
+    BOOST_CHECK(tracker.fConsistent);
+    LOCK(cs_main);
+    BOOST_CHECK(tracker.hashTip == chainActive.Tip()->GetBlockHash());
+}
+
+// Number of blocks the best header must be ahead of a block for it to be
+// assumed valid, with nAssumedValidBuriedTime set to that many blocks
+static const int ASSUMED_VALID_BLOCKS_BEHIND = 20;
+
+// Build a fork of nBlocks blocks on top of the tip and accept all of their
+// headers, with the clock set far enough ahead for the last of them
+static std::vector<std::shared_ptr<const CBlock>> BuildAssumedValidFork(int nBlocks, int nBadBlock)
+{
+    const CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+    SetMockTime(pindexTip->GetBlockTime() + nBlocks + 2 * 60 * 60);
+    std::vector<std::shared_ptr<const CBlock>> blocks = BuildFork(pindexTip, nBlocks, 0, nBadBlock);
+    std::vector<CBlockHeader> headers;
+    for (const auto& pblock : blocks)
+        headers.push_back(pblock->GetBlockHeader());
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlockHeaders(headers, state, Params()));
+    return blocks;
+}
+
+// Process blocks [nBegin, nEnd) of the fork last to first, and return the
+// size of the run each of them was connected in
+static std::vector<unsigned int> ProcessForkBlocks(const std::vector<std::shared_ptr<const CBlock>>& blocks, int nBegin, int nEnd)
+{
+    for (int i = nEnd - 1; i >= nBegin; i--)
+        BOOST_CHECK(ProcessNewBlock(Params(), blocks[i], true, nullptr));
+    std::vector<unsigned int> vRunSizes;
+    std::vector<BlockConnectRecord> records = g_block_connect_stats.GetRecords(nEnd - nBegin);
+    for (const BlockConnectRecord& record : records)
+        vRunSizes.push_back(record.nRunSize);
+    return vRunSizes;
+}
+
+BOOST_AUTO_TEST_CASE(connect_assumed_valid_blocks)
+{
+    uint256 hashAssumeValidOld = hashAssumeValid;
+    int64_t nAssumedValidBuriedTimeOld = nAssumedValidBuriedTime;
+    int nScriptCheckThreadsOld = nScriptCheckThreads;
+    size_t nCoinCacheUsageOld = nCoinCacheUsage;
+    nAssumedValidBuriedTime = (ASSUMED_VALID_BLOCKS_BEHIND - 1) * Params().GetConsensus().nPowTargetSpacing;
+    std::vector<std::shared_ptr<const CBlock>> blocks = BuildAssumedValidFork(260 + ASSUMED_VALID_BLOCKS_BEHIND, 200);
+
+    // Blocks up to the assumed-valid one are connected in runs of up to
+    // MAX_ASSUMED_VALID_BLOCKS_TO_CONNECT_AT_ONCE, which end there, even
+    // without script check threads
+    BOOST_CHECK_EQUAL(MAX_ASSUMED_VALID_BLOCKS_TO_CONNECT_AT_ONCE, 64U);
+    hashAssumeValid = blocks[100]->GetHash();
+    std::vector<unsigned int> vRunSizes = ProcessForkBlocks(blocks, 0, 110);
+    std::vector<unsigned int> vExpected(64, 64);
+    vExpected.insert(vExpected.end(), 37, 37);
+    vExpected.insert(vExpected.end(), MAX_BLOCKS_TO_CONNECT_AT_ONCE, MAX_BLOCKS_TO_CONNECT_AT_ONCE);
+    vExpected.push_back(1);
+    BOOST_CHECK_EQUAL_COLLECTIONS(vRunSizes.begin(), vRunSizes.end(), vExpected.begin(), vExpected.end());
+
+    nScriptCheckThreads = 0;
+    hashAssumeValid = blocks[150]->GetHash();
+    vRunSizes = ProcessForkBlocks(blocks, 110, 160);
+    vExpected.assign(41, 41);
+    vExpected.insert(vExpected.end(), 9, 1);
+    BOOST_CHECK_EQUAL_COLLECTIONS(vRunSizes.begin(), vRunSizes.end(), vExpected.begin(), vExpected.end());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == blocks[159]->GetHash());
+    }
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+
+    // Runs are cut short when the coins cache is full
+    hashAssumeValid = blocks[259]->GetHash();
+    nCoinCacheUsage = 0;
+    vRunSizes = ProcessForkBlocks(blocks, 160, 170);
+    vExpected.assign(10, 1);
+    BOOST_CHECK_EQUAL_COLLECTIONS(vRunSizes.begin(), vRunSizes.end(), vExpected.begin(), vExpected.end());
+    nCoinCacheUsage = nCoinCacheUsageOld;
+
+    // A failure in a run connects its blocks one at a time up to the
+    // invalid block, which is marked as such
+    for (int i = 259; i >= 170; i--)
+        ProcessNewBlock(Params(), blocks[i], true, nullptr);
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == blocks[199]->GetHash());
+    BOOST_CHECK(mapBlockIndex[blocks[200]->GetHash()]->nStatus & BLOCK_FAILED_VALID);
+    BOOST_CHECK(mapBlockIndex[blocks[259]->GetHash()]->nStatus & BLOCK_FAILED_MASK);
+    std::vector<BlockConnectRecord> records = g_block_connect_stats.GetRecords(30);
+    for (const BlockConnectRecord& record : records)
+        BOOST_CHECK_EQUAL(record.nRunSize, 1U);
+    nAssumedValidBuriedTime = nAssumedValidBuriedTimeOld;
+    hashAssumeValid = hashAssumeValidOld;
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
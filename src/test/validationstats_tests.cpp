@@ -0,0 +1,95 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <validation.h>
+#include <validationstats.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(validationstats_tests, BasicTestingSetup)
+
+static BlockConnectRecord CreateRecord(int nHeight, int64_t nCheck, int64_t nTotal)
+{
+    BlockConnectRecord record;
+    record.hash = InsecureRand256();
+    record.nHeight = nHeight;
+    record.nTx = 1;
+    record.vPhaseMicros[BLOCK_PHASE_CHECK] = nCheck;
+    record.vPhaseMicros[BLOCK_PHASE_TOTAL] = nTotal;
+    return record;
+}
+
+BOOST_AUTO_TEST_CASE(histograms_and_records)
+{
+    CBlockConnectStats stats(3);
+    stats.AddRecord(CreateRecord(1, 50, 1000));
+    stats.AddRecord(CreateRecord(2, 100, 20000000));
+    stats.AddRecord(CreateRecord(3, 101, -1));
+    stats.AddRecord(CreateRecord(4, 0, 1000));
+    BOOST_CHECK_EQUAL(stats.GetBlockCount(), 4U);
+
+    // Buckets include their upper bound; phases not recorded are left out
+    std::array<BlockPhaseHistogram, NUM_BLOCK_PHASES> histograms = stats.GetHistograms();
+    const BlockPhaseHistogram& check = histograms[BLOCK_PHASE_CHECK];
+    BOOST_CHECK_EQUAL(check.nCount, 4U);
+    BOOST_CHECK_EQUAL(check.nTotalMicros, 251);
+    BOOST_CHECK_EQUAL(check.vCounts[0], 3U);
+    BOOST_CHECK_EQUAL(check.vCounts[1], 1U);
+    const BlockPhaseHistogram& total = histograms[BLOCK_PHASE_TOTAL];
+    BOOST_CHECK_EQUAL(total.nCount, 3U);
+    BOOST_CHECK_EQUAL(total.vCounts[3], 2U);
+    BOOST_CHECK_EQUAL(total.vCounts.back(), 1U);
+    BOOST_CHECK_EQUAL(histograms[BLOCK_PHASE_LOAD].nCount, 0U);
+
+    // Only the last records are kept
+    std::vector<BlockConnectRecord> records = stats.GetRecords(10);
+    BOOST_CHECK_EQUAL(records.size(), 3U);
+    BOOST_CHECK_EQUAL(records.front().nHeight, 2);
+    BOOST_CHECK_EQUAL(records.back().nHeight, 4);
+    records = stats.GetRecords(1);
+    BOOST_CHECK_EQUAL(records.size(), 1U);
+    BOOST_CHECK_EQUAL(records[0].nHeight, 4);
+    BOOST_CHECK(stats.GetRecords(0).empty());
+}
+
+BOOST_AUTO_TEST_CASE(prometheus_text)
+{
+    CBlockConnectStats stats;
+    stats.AddRecord(CreateRecord(7, 300, 1000));
+    stats.AddRecord(CreateRecord(8, 3000000, 20000000));
+    std::string str = stats.ToPrometheusText();
+    BOOST_CHECK(str.find("litecoin_blocks_connected_total 2\n") != std::string::npos);
+    BOOST_CHECK(str.find("# TYPE litecoin_block_connect_phase_seconds histogram\n") != std::string::npos);
+    // Bucket counts are cumulative
+    BOOST_CHECK(str.find("litecoin_block_connect_phase_seconds_bucket{phase=\"check\",le=\"0.00025\"} 0\n") != std::string::npos);
+    BOOST_CHECK(str.find("litecoin_block_connect_phase_seconds_bucket{phase=\"check\",le=\"0.0005\"} 1\n") != std::string::npos);
+    BOOST_CHECK(str.find("litecoin_block_connect_phase_seconds_bucket{phase=\"check\",le=\"5\"} 2\n") != std::string::npos);
+    BOOST_CHECK(str.find("litecoin_block_connect_phase_seconds_bucket{phase=\"total\",le=\"10\"} 1\n") != std::string::npos);
+    BOOST_CHECK(str.find("litecoin_block_connect_phase_seconds_bucket{phase=\"total\",le=\"+Inf\"} 2\n") != std::string::npos);
+    BOOST_CHECK(str.find("litecoin_block_connect_phase_seconds_sum{phase=\"check\"} 3.000300\n") != std::string::npos);
+    BOOST_CHECK(str.find("litecoin_block_connect_phase_seconds_count{phase=\"load\"} 0\n") != std::string::npos);
+    BOOST_CHECK(str.find("litecoin_last_block_connected_height 8\n") != std::string::npos);
+}
+
+BOOST_FIXTURE_TEST_CASE(connected_blocks_are_recorded, TestChain100Setup)
+{
+    uint64_t nBlocks = g_block_connect_stats.GetBlockCount();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlock block = CreateAndProcessBlock({}, scriptPubKey);
+    BOOST_CHECK_EQUAL(g_block_connect_stats.GetBlockCount(), nBlocks + 1);
+
+    std::vector<BlockConnectRecord> records = g_block_connect_stats.GetRecords(1);
+    BOOST_CHECK_EQUAL(records.size(), 1U);
+    const BlockConnectRecord& record = records[0];
+    BOOST_CHECK(record.hash == block.GetHash());
+    BOOST_CHECK_EQUAL(record.nHeight, 101);
+    BOOST_CHECK_EQUAL(record.nTx, 1U);
+    BOOST_CHECK_EQUAL(record.nRunSize, 1U);
+    for (int i = 0; i < NUM_BLOCK_PHASES; i++)
+        BOOST_CHECK(record.vPhaseMicros[i] >= 0);
+    BOOST_CHECK(record.vPhaseMicros[BLOCK_PHASE_TOTAL] >= record.vPhaseMicros[BLOCK_PHASE_CONNECT]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <deque>
 #include <memory>
 #include <set>
 #include <map>
@@ -17,6 +18,7 @@
 #include <coins.h>
 #include <indirectmap.h>
 #include <policy/feerate.h>
+#include <prevector.h>
 #include <primitives/transaction.h>
 #include <sync.h>
 #include <random.h>
@@ -32,6 +34,9 @@ class CBlockIndex;
 /** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const uint32_t MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
+/** Default for -mempoolchangelog, the number of add/remove events kept for getmempoolchanges */
+static const unsigned int DEFAULT_MEMPOOL_CHANGELOG_SIZE = 100000;
+
 struct LockPoints
 {
     // Will be set to the blockchain height and median time past
@@ -128,6 +133,13 @@ public:
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+
+    /** In-mempool direct parents or children of an entry. Ancestor and
+     *  descendant limits keep these short, so they are stored inline in the
+     *  entry instead of in per-entry sets. */
+    typedef prevector<2, const CTxMemPoolEntry*> Links;
+    mutable Links vMemPoolParents;  //!< Maintained by CTxMemPool::UpdateParent
+    mutable Links vMemPoolChildren; //!< Maintained by CTxMemPool::UpdateChild
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -348,6 +360,32 @@ enum class MemPoolRemovalReason {
     REPLACED     //! Removed for replacement
 };
 
+std::string RemovalReasonToString(MemPoolRemovalReason r);
+
+/** Totals of the mempool transactions whose modified fee rate falls into one
+ *  bucket of the fee rate histogram, see CTxMemPool::GetFeeHistogram(). */
+struct FeeHistogramBucket
+{
+    CAmount nMinFeeRate; //!< Lower bound of the bucket (inclusive), in satoshis per 1000 virtual bytes
+    uint64_t nCount;     //!< Number of transactions
+    uint64_t nVSize;     //!< Sum of virtual sizes
+    CAmount nFees;       //!< Sum of modified fees
+
+    explicit FeeHistogramBucket(CAmount nMinFeeRateIn) : nMinFeeRate(nMinFeeRateIn), nCount(0), nVSize(0), nFees(0) {}
+};
+
+/** A single addition or removal recorded in the mempool change log. */
+struct MempoolChangeEntry
+{
+    uint64_t nSequence;           //!< Position of this change in the log, strictly increasing
+    uint256 txid;
+    bool fAdded;                  //!< True for an addition, false for a removal
+    MemPoolRemovalReason reason;  //!< Why the transaction was removed (only meaningful for removals)
+
+    MempoolChangeEntry(uint64_t nSequenceIn, const uint256& txidIn, bool fAddedIn, MemPoolRemovalReason reasonIn) :
+        nSequence(nSequenceIn), txid(txidIn), fAdded(fAddedIn), reason(reasonIn) {}
+};
+
 class SaltedTxidHasher
 {
 private:
@@ -388,18 +426,18 @@ public:
  *
  * In order for the feerate sort to remain correct, we must update transactions
  * in the mempool when new descendants arrive.  To facilitate this, we track
- * the set of in-mempool direct parents and direct children in mapLinks.  Within
+ * the in-mempool direct parents and direct children of each entry.  Within
  * each CTxMemPoolEntry, we track the size and fees of all descendants.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
  * children (because any such children would be an orphan).  So in
  * addUnchecked(), we:
- * - update a new entry's setMemPoolParents to include all in-mempool parents
+ * - update a new entry's vMemPoolParents to include all in-mempool parents
  * - update the new entry's direct parents to include the new tx as a child
  * - update all ancestors of the transaction to include the new tx's size/fee
  *
  * When a transaction is removed from the mempool, we must:
- * - update all in-mempool parents to not track the tx in setMemPoolChildren
+ * - update all in-mempool parents to not track the tx in vMemPoolChildren
  * - update all ancestors to not include the tx's size/fees in descendant state
  * - update all in-mempool children to not include it as a parent
  *
@@ -421,7 +459,7 @@ public:
  * state, to account for in-mempool, out-of-block descendants for all the
  * in-block transactions by calling UpdateTransactionsFromBlock().  Note that
  * until this is called, the mempool state is not consistent, and in particular
- * mapLinks may not be correct (and therefore functions like
+ * the parent/child links may not be correct (and therefore functions like
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely
  * on them to walk the mempool are not generally safe to use).
  *
@@ -447,7 +485,17 @@ private:
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
+    uint64_t nChangeSequence;      //!< Sequence number of the most recent add/remove
+    uint64_t nChangeSequenceFloor; //!< Changes with a sequence number <= this are no longer in changeLog
+    size_t nChangeLogLimit;        //!< Maximum number of entries kept in changeLog
+    std::deque<MempoolChangeEntry> changeLog;
+
+    std::vector<FeeHistogramBucket> feeHistogram; //!< Modified fee rate distribution of all entries, by virtual size
+
     void trackPackageRemoved(const CFeeRate& rate);
+    void LogChange(const uint256& txid, bool fAdded, MemPoolRemovalReason reason);
+    /** Add entry to or remove it from feeHistogram, based on its current modified fee */
+    void UpdateFeeHistogram(const CTxMemPoolEntry& entry, bool add);
 
 public:
 
@@ -492,21 +540,16 @@ public:
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
+    const CTxMemPoolEntry::Links & GetMemPoolParents(txiter entry) const;
+    const CTxMemPoolEntry::Links & GetMemPoolChildren(txiter entry) const;
+    /** Map an entry referenced from a Links vector back to its mapTx iterator */
+    txiter GetIter(const CTxMemPoolEntry* entry) const { return mapTx.iterator_to(*entry); }
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
-    struct TxLinks {
-        setEntries parents;
-        setEntries children;
-    };
-
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
-    txlinksMap mapLinks;
-
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
+    void UpdateLinks(CTxMemPoolEntry::Links& links, txiter link, bool add);
 
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
 
@@ -560,6 +603,26 @@ public:
     void ApplyDelta(const uint256 hash, CAmount &nFeeDelta) const;
     void ClearPrioritisation(const uint256 hash);
 
+    /** Sequence number of the most recent addition or removal. */
+    uint64_t GetChangeSequence() const;
+    /** Set the number of additions/removals kept for GetChangesSince(). */
+    void SetChangeLogLimit(size_t nLimit);
+    /** Append all additions and removals with a sequence number greater than
+     *  nSequence to changes, oldest first. Returns false if some of those
+     *  changes are no longer available (they were pushed out of the log, or
+     *  the pool was cleared), in which case the caller has to start over
+     *  from a full snapshot of the pool. */
+    bool GetChangesSince(uint64_t nSequence, std::vector<MempoolChangeEntry>& changes) const;
+
+    /** Return the histogram of the modified fee rates of all transactions in
+     *  the pool, lowest fee rate bucket first. */
+    std::vector<FeeHistogramBucket> GetFeeHistogram() const;
+    /** For each of the given sizes, return the lowest fee rate at which a
+     *  transaction is ranked within that many virtual bytes of the pool, when
+     *  walking it in ancestor score order (the order CreateNewBlock considers
+     *  packages in). Sizes larger than the pool get a fee rate of zero. */
+    std::vector<CFeeRate> GetTopFeeRates(const std::vector<uint64_t>& vTopSizes) const;
+
 public:
     /** Remove a set of transactions from the mempool.
      *  If a transaction is in this set, then all in-mempool descendants must
@@ -589,7 +652,7 @@ public:
      *  limitDescendantSize = max size of descendants any ancestor can have
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
-     *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *    look up parents from the entry's links. Must be true for entries not in the mempool
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
@@ -676,7 +739,7 @@ private:
     /** Before calling removeUnchecked for a given transaction,
      *  UpdateForRemoveFromMempool must be called on the entire (dependent) set
      *  of transactions being removed at the same time.  We use each
-     *  CTxMemPoolEntry's setMemPoolParents in order to walk ancestors of a
+     *  CTxMemPoolEntry's vMemPoolParents in order to walk ancestors of a
      *  given transaction that is removed, so we can't remove intermediate
      *  transactions in a chain before we've updated all the state for the
      *  removal.
@@ -38,8 +38,10 @@
 #include <utilmoneystr.h>
 #include <utilstrencodings.h>
 #include <validationinterface.h>
+#include <validationstats.h>
 #include <warnings.h>
 
+#include <functional>
 #include <future>
 #include <sstream>
 
@@ -89,6 +91,26 @@ enum DisconnectResult
 
 class ConnectTrace;
 
+/**
+ * What is left to do to connect a block after its transactions were applied
+ * to a view, once the script checks queued for it have completed.
+ */
+struct BlockConnectData
+{
+    //! Whether the block's transactions were applied, which the genesis block's aren't
+    bool fApplied = false;
+    CBlockUndo blockundo;
+    //! blockundo serialized for writing, and the checksum written after it, if done in advance
+    std::vector<unsigned char> vchUndo;
+    uint256 hashUndoChecksum;
+    //! Referenced by the block's script checks
+    std::vector<PrecomputedTransactionData> txdata;
+    int nInputs = 0;
+    int64_t nTimeStart = 0;
+    //! The block's own phase timings
+    BlockConnectRecord record;
+};
+
 /**
  * CChainState stores and provides an API to update our local knowledge of the
  * current best chain and header tree.
@@ -144,6 +166,14 @@ private:
       */
     std::set<CBlockIndex*> g_failed_blocks;
 
+    /**
+     * Held across ActivateBestChain(), which releases cs_main between its
+     * steps: with several message handler threads, blocks from peers in
+     * different shards are processed at the same time, and the steps and
+     * callbacks of one call must not interleave with those of another.
+     */
+    CCriticalSection m_cs_chainstate;
+
 public:
     CChain chainActive;
     BlockMap mapBlockIndex;
@@ -154,13 +184,16 @@ public:
 
     bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock);
 
-    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex);
+    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW = true);
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock);
 
     // Block (dis)connection on a given view:
     DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false);
+                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, BlockConnectRecord* pRecord = nullptr);
+    bool ApplyBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams,
+                    bool fJustCheck, CCheckQueueControl<CScriptCheck>& control, BlockConnectData& data);
+    bool FinishConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, const CChainParams& chainparams, BlockConnectData& data);
 
     // Block disconnection on our pcoinsTip:
     bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool);
@@ -181,6 +214,7 @@ public:
 private:
     bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace);
     bool ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool);
+    bool ConnectTips(CValidationState& state, const CChainParams& chainparams, const std::vector<CBlockIndex*>& vpindexNew, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool, bool& fInvalid);
 
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block);
     /** Create a new block index entry for a given block hash */
@@ -220,6 +254,7 @@ int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
 
 uint256 hashAssumeValid;
+int64_t nAssumedValidBuriedTime = DEFAULT_ASSUMED_VALID_BURIED_TIME;
 arith_uint256 nMinimumChainWork;
 
 CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
@@ -1310,7 +1345,11 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     const CScriptWitness *witness = &ptxTo->vin[nIn].scriptWitness;
-    return VerifyScript(scriptSig, m_tx_out.scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, m_tx_out.nValue, cacheStore, *txdata), &error);
+    CachingTransactionSignatureChecker checker(ptxTo, nIn, m_tx_out.nValue, cacheStore, *txdata);
+    bool fSuccess;
+    if (VerifyStandardScript(scriptSig, m_tx_out.scriptPubKey, witness, nFlags, checker, fSuccess, &error))
+        return fSuccess;
+    return VerifyScript(scriptSig, m_tx_out.scriptPubKey, witness, nFlags, checker, &error);
 }
 
 int GetSpendHeight(const CCoinsViewCache& inputs)
@@ -1321,16 +1360,30 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 }
 
 
-static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+// Both protected by cs_main
+static std::unique_ptr<CuckooCache::cache<uint256, SignatureCacheHasher>> scriptExecutionCache;
+static SigCacheStats scriptExecutionCacheStats;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
 
 void InitScriptExecutionCache() {
-    // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
-    // setup_bytes creates the minimum possible cache (2 elements).
-    size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-    size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    ResizeScriptExecutionCache(GetSigCacheBytes(gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)));
+}
+
+void ResizeScriptExecutionCache(size_t nMaxCacheSize) {
+    auto cache = MakeUnique<CuckooCache::cache<uint256, SignatureCacheHasher>>();
+    size_t nElems = cache->setup_bytes(nMaxCacheSize);
     LogPrintf("Using %zu MiB out of %zu/2 requested for script execution cache, able to store %zu elements\n",
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
+    LOCK(cs_main);
+    scriptExecutionCache = std::move(cache);
+    scriptExecutionCacheStats = SigCacheStats();
+    scriptExecutionCacheStats.nElements = nElems;
+    scriptExecutionCacheStats.nBytes = nElems * sizeof(uint256);
+}
+
+SigCacheStats GetScriptExecutionCacheStats() {
+    LOCK(cs_main);
+    return scriptExecutionCacheStats;
 }
 
 /**
@@ -1375,9 +1428,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
             CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
             AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
-            if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
+            if (scriptExecutionCache->contains(hashCacheEntry, !cacheFullScriptStore)) {
+                scriptExecutionCacheStats.nHits++;
                 return true;
             }
+            scriptExecutionCacheStats.nMisses++;
 
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
@@ -1422,7 +1477,9 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             if (cacheFullScriptStore && !pvChecks) {
                 // We executed all of the provided scripts, and were told to
                 // cache the result. Do so now.
-                scriptExecutionCache.insert(hashCacheEntry);
+                if (!scriptExecutionCache->insert(hashCacheEntry))
+                    scriptExecutionCacheStats.nEvictions++;
+                scriptExecutionCacheStats.nInserts++;
             }
         }
     }
@@ -1432,7 +1489,19 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
 
 namespace {
 
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+/** Serialize undo data as it is written to disk, and compute the checksum written after it */
+static void SerializeBlockUndo(const CBlockUndo& blockundo, const uint256& hashBlock, std::vector<unsigned char>& vchUndo, uint256& hashChecksum)
+{
+    vchUndo.clear();
+    CVectorWriter(SER_DISK, CLIENT_VERSION, vchUndo, 0) << blockundo;
+
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << hashBlock;
+    hasher.write((const char*)vchUndo.data(), vchUndo.size());
+    hashChecksum = hasher.GetHash();
+}
+
+static bool UndoWriteToDisk(const std::vector<unsigned char>& vchUndo, const uint256& hashChecksum, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
@@ -1440,7 +1509,7 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
         return error("%s: OpenUndoFile failed", __func__);
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, blockundo);
+    unsigned int nSize = vchUndo.size();
     fileout << FLATDATA(messageStart) << nSize;
 
     // Write undo data
@@ -1448,13 +1517,10 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     if (fileOutPos < 0)
         return error("%s: ftell failed", __func__);
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    fileout.write((const char*)vchUndo.data(), vchUndo.size());
 
-    // calculate & write checksum
-    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-    hasher << hashBlock;
-    hasher << blockundo;
-    fileout << hasher.GetHash();
+    // write checksum
+    fileout << hashChecksum;
 
     return true;
 }
@@ -1628,14 +1694,17 @@ void static FlushBlockFile(bool fFinalize = false)
 
 static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState& state, CBlockIndex* pindex, const CChainParams& chainparams)
+static bool WriteUndoDataForBlock(BlockConnectData& data, CValidationState& state, CBlockIndex* pindex, const CChainParams& chainparams)
 {
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull()) {
+        // Serialized undo data is never empty, this means it wasn't done in advance
+        if (data.vchUndo.empty())
+            SerializeBlockUndo(data.blockundo, pindex->pprev->GetBlockHash(), data.vchUndo, data.hashUndoChecksum);
         CDiskBlockPos _pos;
-        if (!FindUndoPos(state, pindex->nFile, _pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
+        if (!FindUndoPos(state, pindex->nFile, _pos, data.vchUndo.size() + 40))
             return error("ConnectBlock(): FindUndoPos failed");
-        if (!UndoWriteToDisk(blockundo, _pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+        if (!UndoWriteToDisk(data.vchUndo, data.hashUndoChecksum, _pos, chainparams.MessageStart()))
             return AbortNode(state, "Failed to write undo data");
 
         // update nUndoPos in block index
@@ -1674,6 +1743,15 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+// For the other work on blocks that is spread over threads. Separate from
+// scriptcheckqueue, as ConnectBlock calls CheckBlock while it holds that one.
+static CCheckQueue<std::function<bool()>> blockcheckqueue(16);
+
+void ThreadBlockCheck() {
+    RenameThread("litecoin-blockch");
+    blockcheckqueue.Thread();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1764,11 +1842,76 @@ static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 static int64_t nBlocksTotal = 0;
 
+/** Whether the scripts of a block can be skipped, as it is buried deep enough in the chain of the -assumevalid block */
+static bool IsAssumedValid(const CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    if (hashAssumeValid.IsNull())
+        return false;
+    // We've been configured with the hash of a block which has been externally verified to have a valid history.
+    // A suitable default value is included with the software and updated from time to time.  Because validity
+    //  relative to a piece of software is an objective fact these defaults can be easily reviewed.
+    // This setting doesn't force the selection of any particular chain but makes validating some faster by
+    //  effectively caching the result of part of the verification.
+    BlockMap::const_iterator  it = mapBlockIndex.find(hashAssumeValid);
+    if (it == mapBlockIndex.end())
+        return false;
+    if (it->second->GetAncestor(pindex->nHeight) == pindex &&
+        pindexBestHeader->GetAncestor(pindex->nHeight) == pindex &&
+        pindexBestHeader->nChainWork >= nMinimumChainWork) {
+        // This block is a member of the assumed verified chain and an ancestor of the best header.
+        // The equivalent time check discourages hash power from extorting the network via DOS attack
+        //  into accepting an invalid block through telling users they must manually set assumevalid.
+        //  Requiring a software change or burying the invalid block, regardless of the setting, makes
+        //  it hard to hide the implication of the demand.  This also avoids having release candidates
+        //  that are hardly doing any signature verification at all in testing without having to
+        //  artificially set the default assumed verified block further back.
+        // The test against nMinimumChainWork prevents the skipping when denied access to any chain at
+        //  least as good as the expected chain.
+        return GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) > nAssumedValidBuriedTime;
+    }
+    return false;
+}
+
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
  *  can fail if those validity checks fail (among other reasons). */
 bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, BlockConnectRecord* pRecord)
+{
+    BlockConnectData data;
+    CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    if (!ApplyBlock(block, state, pindex, view, chainparams, fJustCheck, control, data))
+        return false;
+    if (!data.fApplied) {
+        if (pRecord)
+            *pRecord = data.record;
+        return true;
+    }
+
+    if (!control.Wait())
+        return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
+    int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - data.nTimeStart;
+    data.record.vPhaseMicros[BLOCK_PHASE_VERIFY] = nTime4 - data.nTimeStart - data.record.vPhaseMicros[BLOCK_PHASE_CONNECT];
+    LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", data.nInputs - 1, MILLI * (nTime4 - data.nTimeStart), data.nInputs <= 1 ? 0 : MILLI * (nTime4 - data.nTimeStart) / (data.nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
+
+    if (fJustCheck)
+        return true;
+
+    if (!FinishConnectBlock(block, state, pindex, chainparams, data))
+        return false;
+    if (pRecord)
+        *pRecord = data.record;
+    return true;
+}
+
+/**
+ * The part of ConnectBlock() up to waiting for the script checks: apply the
+ * block to the view, doing the validity checks that depend on the UTXO set,
+ * and add the block's script checks to control.
+ */
+bool CChainState::ApplyBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams,
+                             bool fJustCheck, CCheckQueueControl<CScriptCheck>& control, BlockConnectData& data)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -1793,6 +1936,10 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck))
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
 
+    data.record.hash = block.GetHash();
+    data.record.nHeight = pindex->nHeight;
+    data.record.nTx = block.vtx.size();
+
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == nullptr ? uint256() : pindex->pprev->GetBlockHash();
     assert(hashPrevBlock == view.GetBestBlock());
@@ -1807,33 +1954,10 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 
     nBlocksTotal++;
 
-    bool fScriptChecks = true;
-    if (!hashAssumeValid.IsNull()) {
-        // We've been configured with the hash of a block which has been externally verified to have a valid history.
-        // A suitable default value is included with the software and updated from time to time.  Because validity
-        //  relative to a piece of software is an objective fact these defaults can be easily reviewed.
-        // This setting doesn't force the selection of any particular chain but makes validating some faster by
-        //  effectively caching the result of part of the verification.
-        BlockMap::const_iterator  it = mapBlockIndex.find(hashAssumeValid);
-        if (it != mapBlockIndex.end()) {
-            if (it->second->GetAncestor(pindex->nHeight) == pindex &&
-                pindexBestHeader->GetAncestor(pindex->nHeight) == pindex &&
-                pindexBestHeader->nChainWork >= nMinimumChainWork) {
-                // This block is a member of the assumed verified chain and an ancestor of the best header.
-                // The equivalent time check discourages hash power from extorting the network via DOS attack
-                //  into accepting an invalid block through telling users they must manually set assumevalid.
-                //  Requiring a software change or burying the invalid block, regardless of the setting, makes
-                //  it hard to hide the implication of the demand.  This also avoids having release candidates
-                //  that are hardly doing any signature verification at all in testing without having to
-                //  artificially set the default assumed verified block further back.
-                // The test against nMinimumChainWork prevents the skipping when denied access to any chain at
-                //  least as good as the expected chain.
-                fScriptChecks = (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= 60 * 60 * 24 * 7 * 2);
-            }
-        }
-    }
+    bool fScriptChecks = !IsAssumedValid(pindex, chainparams);
 
     int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
+    data.record.vPhaseMicros[BLOCK_PHASE_CHECK] = nTime1 - nTimeStart;
     LogPrint(BCLog::BENCH, "    - Sanity checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime1 - nTimeStart), nTimeCheck * MICRO, nTimeCheck * MILLI / nBlocksTotal);
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
@@ -1885,18 +2009,19 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     unsigned int flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
 
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
+    data.record.vPhaseMicros[BLOCK_PHASE_FORKS] = nTime2 - nTime1;
     LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2 - nTime1), nTimeForks * MICRO, nTimeForks * MILLI / nBlocksTotal);
 
-    CBlockUndo blockundo;
-
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    CBlockUndo& blockundo = data.blockundo;
+    data.nTimeStart = nTime2;
+    data.fApplied = true;
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
-    int nInputs = 0;
+    int& nInputs = data.nInputs;
     int64_t nSigOpsCost = 0;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<PrecomputedTransactionData> txdata;
+    std::vector<PrecomputedTransactionData>& txdata = data.txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
@@ -1957,6 +2082,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
+    data.record.vPhaseMicros[BLOCK_PHASE_CONNECT] = nTime3 - nTime2;
+    data.record.nInputs = nInputs;
     LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
@@ -1966,15 +2093,24 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                                block.vtx[0]->GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
-    if (!control.Wait())
-        return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
-    int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
-    LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
+    if (!fJustCheck) {
+        assert(pindex->phashBlock);
+        // add this block to the view's block chain
+        view.SetBestBlock(pindex->GetBlockHash());
+    }
 
-    if (fJustCheck)
-        return true;
+    return true;
+}
+
+/**
+ * The part of ConnectBlock() after the block's script checks have passed:
+ * write its undo and index data.
+ */
+bool CChainState::FinishConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, const CChainParams& chainparams, BlockConnectData& data)
+{
+    int64_t nTime4 = GetTimeMicros();
 
-    if (!WriteUndoDataForBlock(blockundo, state, pindex, chainparams))
+    if (!WriteUndoDataForBlock(data, state, pindex, chainparams))
         return false;
 
     if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
@@ -1985,14 +2121,12 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!WriteTxIndexDataForBlock(block, state, pindex))
         return false;
 
-    assert(pindex->phashBlock);
-    // add this block to the view's block chain
-    view.SetBestBlock(pindex->GetBlockHash());
-
     int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
+    data.record.vPhaseMicros[BLOCK_PHASE_INDEX] = nTime5 - nTime4;
     LogPrint(BCLog::BENCH, "    - Index writing: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime5 - nTime4), nTimeIndex * MICRO, nTimeIndex * MILLI / nBlocksTotal);
 
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
+    data.record.vPhaseMicros[BLOCK_PHASE_CALLBACKS] = nTime6 - nTime5;
     LogPrint(BCLog::BENCH, "    - Callbacks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime6 - nTime5), nTimeCallbacks * MICRO, nTimeCallbacks * MILLI / nBlocksTotal);
 
     return true;
@@ -2339,9 +2473,10 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    BlockConnectRecord record;
     {
         CCoinsViewCache view(pcoinsTip.get());
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams, false, &record);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2371,10 +2506,135 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime5) * MILLI, nTimePostConnect * MICRO, nTimePostConnect * MILLI / nBlocksTotal);
     LogPrint(BCLog::BENCH, "- Connect block: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime1) * MILLI, nTimeTotal * MICRO, nTimeTotal * MILLI / nBlocksTotal);
 
+    record.nTime = GetTime();
+    record.vPhaseMicros[BLOCK_PHASE_LOAD] = nTime2 - nTime1;
+    record.vPhaseMicros[BLOCK_PHASE_FLUSH] = nTime4 - nTime3;
+    record.vPhaseMicros[BLOCK_PHASE_CHAINSTATE] = nTime5 - nTime4;
+    record.vPhaseMicros[BLOCK_PHASE_POSTCONNECT] = nTime6 - nTime5;
+    record.vPhaseMicros[BLOCK_PHASE_TOTAL] = nTime6 - nTime1;
+    g_block_connect_stats.AddRecord(record);
+
     connectTrace.BlockConnected(pindexNew, std::move(pthisBlock));
     return true;
 }
 
+/**
+ * Connect a run of blocks to chainActive, like ConnectTip() one after the
+ * other, but apply each block to the view while the script checks of the
+ * ones before it are still running, so that the script check threads don't
+ * go idle at every block boundary. Nothing is committed until all of the
+ * blocks passed: if any of them is invalid, the view they were applied to is
+ * discarded and fInvalid is set, for the caller to connect them one at a
+ * time to find out which one it is. The run is cut short once the coins it
+ * created and spent would no longer fit in the coins cache.
+ */
+bool CChainState::ConnectTips(CValidationState& state, const CChainParams& chainparams, const std::vector<CBlockIndex*>& vpindexNew, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool, bool& fInvalid)
+{
+    assert(!vpindexNew.empty() && vpindexNew.front()->pprev == chainActive.Tip());
+    int64_t nTime1 = GetTimeMicros();
+    std::vector<std::shared_ptr<const CBlock>> vBlocks;
+    vBlocks.reserve(vpindexNew.size());
+    for (CBlockIndex* pindex : vpindexNew) {
+        if (pindex == pindexMostWork && pblock) {
+            vBlocks.push_back(pblock);
+            continue;
+        }
+        std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockNew, pindex, chainparams.GetConsensus()))
+            return AbortNode(state, "Failed to read block");
+        vBlocks.push_back(std::move(pblockNew));
+    }
+    int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
+    LogPrint(BCLog::BENCH, "  - Load %u blocks from disk: %.2fms [%.2fs]\n", (unsigned)vBlocks.size(), (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    // The scripts of the run are waited for at once, so the time is only known for the whole run
+    int64_t nTimeRunVerify = 0;
+    int64_t nTime3, nTime4;
+    std::vector<BlockConnectRecord> vRecords;
+    vRecords.reserve(vBlocks.size());
+    {
+        CCoinsViewCache view(pcoinsTip.get());
+        // Must outlive control, as the script checks refer to them
+        std::vector<BlockConnectData> vData(vBlocks.size());
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            if (!ApplyBlock(*vBlocks[i], state, vpindexNew[i], view, chainparams, false, control, vData[i])) {
+                fInvalid = state.IsInvalid();
+                return fInvalid ? false : error("ConnectTips(): ApplyBlock %s failed", vpindexNew[i]->GetBlockHash().ToString());
+            }
+            if (i + 1 < vBlocks.size() && view.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) {
+                LogPrint(BCLog::BENCH, "  - Run cut short after %u blocks by the coins cache size\n", (unsigned)(i + 1));
+                vBlocks.resize(i + 1);
+            }
+        }
+        int64_t nTimeApplied = GetTimeMicros();
+        if (!control.Wait()) {
+            fInvalid = true;
+            return false;
+        }
+        nTimeRunVerify = GetTimeMicros() - nTimeApplied;
+        nTimeVerify += nTimeRunVerify;
+        // Serialize the undo data of all the blocks on the block checking threads
+        std::vector<std::function<bool()>> vUndoTasks;
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            if (!vData[i].fApplied || !vpindexNew[i]->GetUndoPos().IsNull())
+                continue;
+            BlockConnectData* pdata = &vData[i];
+            const uint256* phashPrev = vpindexNew[i]->pprev->phashBlock;
+            vUndoTasks.emplace_back([pdata, phashPrev] {
+                SerializeBlockUndo(pdata->blockundo, *phashPrev, pdata->vchUndo, pdata->hashUndoChecksum);
+                return true;
+            });
+        }
+        {
+            CCheckQueueControl<std::function<bool()>> undoControl(&blockcheckqueue);
+            undoControl.Add(vUndoTasks);
+            undoControl.Wait();
+        }
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            if (vData[i].fApplied && !FinishConnectBlock(*vBlocks[i], state, vpindexNew[i], chainparams, vData[i]))
+                return error("ConnectTips(): FinishConnectBlock %s failed", vpindexNew[i]->GetBlockHash().ToString());
+            GetMainSignals().BlockChecked(*vBlocks[i], state);
+            vRecords.push_back(vData[i].record);
+        }
+        nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
+        LogPrint(BCLog::BENCH, "  - Connect %u blocks: %.2fms [%.2fs (%.2fms/blk)]\n", (unsigned)vBlocks.size(), (nTime3 - nTime2) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
+        bool flushed = view.Flush();
+        assert(flushed);
+    }
+    nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        // Remove conflicting transactions from the mempool.
+        mempool.removeForBlock(vBlocks[i]->vtx, vpindexNew[i]->nHeight);
+        disconnectpool.removeForBlock(vBlocks[i]->vtx);
+        // Update chainActive & related variables.
+        chainActive.SetTip(vpindexNew[i]);
+        UpdateTip(vpindexNew[i], chainparams);
+        connectTrace.BlockConnected(vpindexNew[i], std::move(vBlocks[i]));
+    }
+    int64_t nTime5 = GetTimeMicros(); nTimePostConnect += nTime5 - nTime4;
+    // Write the chain state to disk, if necessary.
+    if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_IF_NEEDED))
+        return false;
+    int64_t nTime6 = GetTimeMicros(); nTimeChainState += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
+    LogPrint(BCLog::BENCH, "- Connect %u blocks: %.2fms [%.2fs (%.2fms/blk)]\n", (unsigned)vBlocks.size(), (nTime6 - nTime1) * MILLI, nTimeTotal * MICRO, nTimeTotal * MILLI / nBlocksTotal);
+
+    int64_t nNow = GetTime();
+    for (BlockConnectRecord& record : vRecords) {
+        record.nTime = nNow;
+        record.nRunSize = vRecords.size();
+    }
+    BlockConnectRecord& last = vRecords.back();
+    last.vPhaseMicros[BLOCK_PHASE_LOAD] = nTime2 - nTime1;
+    last.vPhaseMicros[BLOCK_PHASE_VERIFY] = nTimeRunVerify;
+    last.vPhaseMicros[BLOCK_PHASE_FLUSH] = nTime4 - nTime3;
+    last.vPhaseMicros[BLOCK_PHASE_POSTCONNECT] = nTime5 - nTime4;
+    last.vPhaseMicros[BLOCK_PHASE_CHAINSTATE] = nTime6 - nTime5;
+    last.vPhaseMicros[BLOCK_PHASE_TOTAL] = nTime6 - nTime1;
+    for (const BlockConnectRecord& record : vRecords)
+        g_block_connect_stats.AddRecord(record);
+    return true;
+}
+
 /**
  * Return the tip of the chain with the most work in it, that isn't
  * known to be invalid (it's however far from certain to be valid).
@@ -2474,8 +2734,26 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
     int nHeight = pindexFork ? pindexFork->nHeight : -1;
     while (fContinue && nHeight != pindexMostWork->nHeight) {
         // Don't iterate the entire list of potential improvements toward the best tip, as we likely only need
-        // a few blocks along the way.
+        // a few blocks along the way. In the part of the chain whose scripts are assumed valid, which is at
+        // least two weeks of work behind the best header, take larger steps, up to the last assumed-valid
+        // block, and connect the blocks in larger runs: the coins they create and spend among themselves
+        // never reach pcoinsTip, and flushes are fewer.
         int nTargetHeight = std::min(nHeight + 32, pindexMostWork->nHeight);
+        bool fAssumedValidRun = IsAssumedValid(pindexMostWork->GetAncestor(nHeight + 1), chainparams);
+        if (fAssumedValidRun) {
+            // The ancestors of an assumed-valid block are assumed valid too
+            int nLow = nHeight + 1;
+            int nHigh = std::min(nHeight + (int)MAX_ASSUMED_VALID_BLOCKS_TO_CONNECT_AT_ONCE, pindexMostWork->nHeight);
+            while (nLow < nHigh) {
+                int nMid = nLow + (nHigh - nLow + 1) / 2;
+                if (IsAssumedValid(pindexMostWork->GetAncestor(nMid), chainparams))
+                    nLow = nMid;
+                else
+                    nHigh = nMid - 1;
+            }
+            nTargetHeight = nLow;
+        }
+        size_t nMaxRun = fAssumedValidRun ? MAX_ASSUMED_VALID_BLOCKS_TO_CONNECT_AT_ONCE : MAX_BLOCKS_TO_CONNECT_AT_ONCE;
         vpindexToConnect.clear();
         vpindexToConnect.reserve(nTargetHeight - nHeight);
         CBlockIndex *pindexIter = pindexMostWork->GetAncestor(nTargetHeight);
@@ -2485,6 +2763,30 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
         }
         nHeight = nTargetHeight;
 
+        bool fRunInvalid = false;
+        if ((nScriptCheckThreads || fAssumedValidRun) && vpindexToConnect.size() > 1) {
+            // Connect a run of blocks at once, verifying the scripts of each while the next is applied.
+            std::vector<CBlockIndex*> vpindexRun(vpindexToConnect.rbegin(), vpindexToConnect.rbegin() + std::min(vpindexToConnect.size(), nMaxRun));
+            if (ConnectTips(state, chainparams, vpindexRun, pindexMostWork, pblock, connectTrace, disconnectpool, fRunInvalid)) {
+                PruneBlockIndexCandidates();
+                if (!pindexOldTip || chainActive.Tip()->nChainWork > pindexOldTip->nChainWork) {
+                    // We're in a better position than we were. Return temporarily to release the lock.
+                    fContinue = false;
+                }
+                // Continue from the new tip
+                nHeight = chainActive.Tip()->nHeight;
+                continue;
+            }
+            if (!fRunInvalid) {
+                // A system error occurred, see below.
+                UpdateMempoolForReorg(disconnectpool, false);
+                return false;
+            }
+            // One of the blocks is invalid, connect them one at a time to find out which,
+            // without returning in between.
+            state = CValidationState();
+        }
+
         // Connect new blocks.
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
             if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
@@ -2505,7 +2807,7 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
                 }
             } else {
                 PruneBlockIndexCandidates();
-                if (!pindexOldTip || chainActive.Tip()->nChainWork > pindexOldTip->nChainWork) {
+                if (!fRunInvalid && (!pindexOldTip || chainActive.Tip()->nChainWork > pindexOldTip->nChainWork)) {
                     // We're in a better position than we were. Return temporarily to release the lock.
                     fContinue = false;
                     break;
@@ -2563,6 +2865,8 @@ bool CChainState::ActivateBestChain(CValidationState &state, const CChainParams&
     // sanely for performance or correctness!
     AssertLockNotHeld(cs_main);
 
+    LOCK(m_cs_chainstate);
+
     CBlockIndex *pindexMostWork = nullptr;
     CBlockIndex *pindexNewTip = nullptr;
     int nStopAtHeight = gArgs.GetArg("-stopatheight", DEFAULT_STOPATHEIGHT);
@@ -2955,6 +3259,36 @@ static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
     return true;
 }
 
+namespace {
+
+/**
+ * Closure representing the context-free checks of one transaction in a
+ * block, adding its legacy sigops to a total shared with the others. It
+ * also computes the transaction's witness hash, which is cached for the
+ * witness commitment check in ContextualCheckBlock.
+ */
+class CBlockTxCheck
+{
+private:
+    const CTransaction *ptx;
+    std::atomic<unsigned int> *pnSigOps;
+
+public:
+    CBlockTxCheck(const CTransaction& tx, std::atomic<unsigned int>& nSigOps) : ptx(&tx), pnSigOps(&nSigOps) {}
+
+    bool operator()() {
+        ptx->GetWitnessHash();
+        CValidationState state;
+        if (!CheckTransaction(*ptx, state, false))
+            return false;
+        pnSigOps->fetch_add(GetLegacySigOpCount(*ptx), std::memory_order_relaxed);
+        return true;
+    }
+
+};
+
+} // namespace
+
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
@@ -2967,8 +3301,24 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
         return false;
 
-    // Check the merkle root.
+    // Check the merkle root. The txids of large blocks are computed on the
+    // block checking threads first, and are cached for BlockMerkleRoot.
     if (fCheckMerkleRoot) {
+        if (nScriptCheckThreads && block.vtx.size() >= MIN_BLOCK_TXS_TO_CHECK_IN_PARALLEL) {
+            std::vector<std::function<bool()>> vHashes;
+            vHashes.reserve(block.vtx.size());
+            for (const auto& tx : block.vtx) {
+                const CTransaction* ptx = tx.get();
+                vHashes.emplace_back([ptx] {
+                    ptx->GetHash();
+                    return true;
+                });
+            }
+            CCheckQueueControl<std::function<bool()>> control(&blockcheckqueue);
+            control.Add(vHashes);
+            control.Wait();
+        }
+
         bool mutated;
         uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
@@ -2998,16 +3348,33 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
         if (block.vtx[i]->IsCoinBase())
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
-    // Check transactions
-    for (const auto& tx : block.vtx)
-        if (!CheckTransaction(*tx, state, false))
-            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
-
+    // Check transactions. Those of large blocks are checked on the block
+    // checking threads; should that fail, they are checked again in order, to
+    // report the first failing transaction as usual.
     unsigned int nSigOps = 0;
-    for (const auto& tx : block.vtx)
-    {
-        nSigOps += GetLegacySigOpCount(*tx);
+    bool fTxsChecked = false;
+    if (nScriptCheckThreads && block.vtx.size() >= MIN_BLOCK_TXS_TO_CHECK_IN_PARALLEL) {
+        std::atomic<unsigned int> nSigOpsParallel{0};
+        std::vector<std::function<bool()>> vChecks;
+        vChecks.reserve(block.vtx.size());
+        for (const auto& tx : block.vtx)
+            vChecks.emplace_back(CBlockTxCheck(*tx, nSigOpsParallel));
+        CCheckQueueControl<std::function<bool()>> control(&blockcheckqueue);
+        control.Add(vChecks);
+        fTxsChecked = control.Wait();
+        nSigOps = nSigOpsParallel.load();
+    }
+    if (!fTxsChecked) {
+        for (const auto& tx : block.vtx)
+            if (!CheckTransaction(*tx, state, false))
+                return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
+
+        nSigOps = 0;
+        for (const auto& tx : block.vtx)
+        {
+            nSigOps += GetLegacySigOpCount(*tx);
+        }
     }
     if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
@@ -3219,7 +3586,7 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3238,7 +3605,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3282,11 +3649,36 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
+
+    // Check the proof of work of the headers we don't have yet before taking
+    // cs_main for the rest of the validation: it is by far the most
+    // expensive part and needs no chain state, so peers sending headers
+    // don't serialize on cs_main while hashing. Headers that fail are checked
+    // again below, so errors are still reported in order.
+    std::vector<uint256> vHashes;
+    vHashes.reserve(headers.size());
+    for (const CBlockHeader& header : headers) {
+        vHashes.push_back(header.GetHash());
+    }
+    std::vector<bool> vCheckPOW(headers.size(), true);
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < headers.size(); i++) {
+            vCheckPOW[i] = !mapBlockIndex.count(vHashes[i]);
+        }
+    }
+    for (size_t i = 0; i < headers.size(); i++) {
+        if (vCheckPOW[i] && CheckProofOfWork(headers[i].GetPoWHash(), headers[i].nBits, chainparams.GetConsensus())) {
+            vCheckPOW[i] = false;
+        }
+    }
+
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex, vCheckPOW[i])) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
@@ -44,6 +44,7 @@ struct ChainTxData;
 
 struct PrecomputedTransactionData;
 struct LockPoints;
+struct SigCacheStats;
 
 /** Default for -whitelistrelay. */
 static const bool DEFAULT_WHITELISTRELAY = true;
@@ -77,16 +78,30 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
 /** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+static const int MAX_SCRIPTCHECK_THREADS = 64;
+/** Maximum number of blocks connected at once, to verify the scripts of one while the next is applied */
+static const unsigned int MAX_BLOCKS_TO_CONNECT_AT_ONCE = 8;
+/** Maximum number of blocks connected at once in the assumed-valid part of the chain during initial block download */
+static const unsigned int MAX_ASSUMED_VALID_BLOCKS_TO_CONNECT_AT_ONCE = 64;
+/** Minimum number of transactions in a block for CheckBlock to hash and check them on the block-checking threads */
+static const unsigned int MIN_BLOCK_TXS_TO_CHECK_IN_PARALLEL = 64;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Number of blocks that can be requested at any given time from a single peer,
+ *  until its block download rate is known. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds on the number of blocks in flight from a peer whose download rate is known. */
+static const int MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** How long (in microseconds) a peer should take to deliver the blocks in flight from it,
+ *  on top of its round trip time. Sizes the per-peer window once the peer's rate is known. */
+static const int64_t BLOCK_DOWNLOAD_QUEUE_TIME = 2 * 1000000;
+/** An in-flight block is moved to another peer if that peer is expected to deliver it
+ *  this many times sooner, and at least BLOCK_REASSIGN_MIN_GAIN microseconds sooner. */
+static const int BLOCK_REASSIGN_SPEEDUP = 2;
+static const int64_t BLOCK_REASSIGN_MIN_GAIN = 1000000;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
-/** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
- *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
-static const unsigned int MAX_HEADERS_RESULTS = 2000;
 /** Maximum depth of blocks we're willing to serve as compact blocks to peers
  *  when requested. For older blocks, a regular BLOCK response will be sent. */
 static const int MAX_CMPCTBLOCK_DEPTH = 5;
@@ -123,6 +138,8 @@ static const int64_t BLOCK_DOWNLOAD_TIMEOUT_BASE = 1000000;
 static const int64_t BLOCK_DOWNLOAD_TIMEOUT_PER_PEER = 500000;
 
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
+/** Default for nAssumedValidBuriedTime: two weeks */
+static const int64_t DEFAULT_ASSUMED_VALID_BURIED_TIME = 60 * 60 * 24 * 7 * 2;
 /** Maximum age of our tip in seconds for us to be considered current for fee estimation */
 static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 
@@ -185,6 +202,9 @@ extern bool fEnableReplacement;
 /** Block hash whose ancestors we will assume to have valid scripts without checking them. */
 extern uint256 hashAssumeValid;
 
+/** Equivalent time (in seconds) of the work a block must be buried under in the best header chain for its scripts to be assumed valid. */
+extern int64_t nAssumedValidBuriedTime;
+
 /** Minimum work we will assume exists on some valid chain. */
 extern arith_uint256 nMinimumChainWork;
 
@@ -272,6 +292,8 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the block checking thread */
+void ThreadBlockCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -391,6 +413,10 @@ public:
 
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
+/** Replaces the script-execution cache with an empty one of nBytes */
+void ResizeScriptExecutionCache(size_t nBytes);
+/** Returns the usage counters of the script-execution cache */
+SigCacheStats GetScriptExecutionCacheStats();
 
 
 /** Functions for disk access for blocks */
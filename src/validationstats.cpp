@@ -0,0 +1,111 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <validationstats.h>
+
+#include <tinyformat.h>
+
+#include <algorithm>
+
+CBlockConnectStats g_block_connect_stats;
+
+const char* GetBlockPhaseName(BlockConnectPhase phase)
+{
+    switch (phase) {
+    case BLOCK_PHASE_LOAD: return "load";
+    case BLOCK_PHASE_CHECK: return "check";
+    case BLOCK_PHASE_FORKS: return "forks";
+    case BLOCK_PHASE_CONNECT: return "connect";
+    case BLOCK_PHASE_VERIFY: return "verify";
+    case BLOCK_PHASE_INDEX: return "index";
+    case BLOCK_PHASE_CALLBACKS: return "callbacks";
+    case BLOCK_PHASE_FLUSH: return "flush";
+    case BLOCK_PHASE_CHAINSTATE: return "chainstate";
+    case BLOCK_PHASE_POSTCONNECT: return "postconnect";
+    case BLOCK_PHASE_TOTAL: return "total";
+    case NUM_BLOCK_PHASES: break;
+    }
+    return "";
+}
+
+CBlockConnectStats::CBlockConnectStats(size_t nMaxRecordsIn) : nMaxRecords(nMaxRecordsIn), nBlocks(0)
+{
+    for (BlockPhaseHistogram& histogram : histograms)
+        histogram.vCounts.assign(BLOCK_PHASE_BUCKET_BOUNDS.size() + 1, 0);
+}
+
+void CBlockConnectStats::AddRecord(const BlockConnectRecord& record)
+{
+    LOCK(cs);
+    for (int i = 0; i < NUM_BLOCK_PHASES; i++) {
+        int64_t nMicros = record.vPhaseMicros[i];
+        if (nMicros < 0)
+            continue;
+        BlockPhaseHistogram& histogram = histograms[i];
+        size_t nBucket = std::lower_bound(BLOCK_PHASE_BUCKET_BOUNDS.begin(), BLOCK_PHASE_BUCKET_BOUNDS.end(), nMicros) - BLOCK_PHASE_BUCKET_BOUNDS.begin();
+        histogram.vCounts[nBucket]++;
+        histogram.nCount++;
+        histogram.nTotalMicros += nMicros;
+    }
+    nBlocks++;
+    if (nMaxRecords == 0)
+        return;
+    if (records.size() == nMaxRecords)
+        records.pop_front();
+    records.push_back(record);
+}
+
+std::vector<BlockConnectRecord> CBlockConnectStats::GetRecords(size_t nRecords) const
+{
+    LOCK(cs);
+    nRecords = std::min(nRecords, records.size());
+    return std::vector<BlockConnectRecord>(records.end() - nRecords, records.end());
+}
+
+std::array<BlockPhaseHistogram, NUM_BLOCK_PHASES> CBlockConnectStats::GetHistograms() const
+{
+    LOCK(cs);
+    return histograms;
+}
+
+uint64_t CBlockConnectStats::GetBlockCount() const
+{
+    LOCK(cs);
+    return nBlocks;
+}
+
+std::string CBlockConnectStats::ToPrometheusText() const
+{
+    LOCK(cs);
+    std::string str;
+    str += "# HELP litecoin_blocks_connected_total Blocks connected to the chain since startup\n";
+    str += "# TYPE litecoin_blocks_connected_total counter\n";
+    str += strprintf("litecoin_blocks_connected_total %u\n", nBlocks);
+
+    str += "# HELP litecoin_block_connect_phase_seconds Time spent in each phase of connecting blocks to the chain\n";
+    str += "# TYPE litecoin_block_connect_phase_seconds histogram\n";
+    for (int i = 0; i < NUM_BLOCK_PHASES; i++) {
+        const BlockPhaseHistogram& histogram = histograms[i];
+        const char* name = GetBlockPhaseName((BlockConnectPhase)i);
+        uint64_t nCumulative = 0;
+        for (size_t j = 0; j < BLOCK_PHASE_BUCKET_BOUNDS.size(); j++) {
+            nCumulative += histogram.vCounts[j];
+            str += strprintf("litecoin_block_connect_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %u\n", name, BLOCK_PHASE_BUCKET_BOUNDS[j] * 1e-6, nCumulative);
+        }
+        str += strprintf("litecoin_block_connect_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %u\n", name, histogram.nCount);
+        str += strprintf("litecoin_block_connect_phase_seconds_sum{phase=\"%s\"} %.6f\n", name, histogram.nTotalMicros * 1e-6);
+        str += strprintf("litecoin_block_connect_phase_seconds_count{phase=\"%s\"} %u\n", name, histogram.nCount);
+    }
+
+    if (!records.empty()) {
+        const BlockConnectRecord& last = records.back();
+        str += "# HELP litecoin_last_block_connected_height Height of the block connected last\n";
+        str += "# TYPE litecoin_last_block_connected_height gauge\n";
+        str += strprintf("litecoin_last_block_connected_height %d\n", last.nHeight);
+        str += "# HELP litecoin_last_block_connected_transactions Transactions in the block connected last\n";
+        str += "# TYPE litecoin_last_block_connected_transactions gauge\n";
+        str += strprintf("litecoin_last_block_connected_transactions %u\n", last.nTx);
+    }
+    return str;
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_VALIDATIONSTATS_H
+#define BITCOIN_VALIDATIONSTATS_H
+
+#include <sync.h>
+#include <uint256.h>
+
+#include <array>
+#include <deque>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** The phases of connecting a block to the chain that are timed */
+enum BlockConnectPhase {
+    BLOCK_PHASE_LOAD,           //!< Reading the block from disk
+    BLOCK_PHASE_CHECK,          //!< Context-free checks of the block
+    BLOCK_PHASE_FORKS,          //!< Checks of the soft fork rules in force
+    BLOCK_PHASE_CONNECT,        //!< Applying the transactions to the coins view
+    BLOCK_PHASE_VERIFY,         //!< Waiting for the script checks to finish
+    BLOCK_PHASE_INDEX,          //!< Writing the undo and transaction index data
+    BLOCK_PHASE_CALLBACKS,      //!< Callbacks after the block is connected
+    BLOCK_PHASE_FLUSH,          //!< Flushing the coins view to the coins tip
+    BLOCK_PHASE_CHAINSTATE,     //!< Writing the chain state to disk, if needed
+    BLOCK_PHASE_POSTCONNECT,    //!< Mempool and chain tip updates
+    BLOCK_PHASE_TOTAL,          //!< All of the above
+    NUM_BLOCK_PHASES
+};
+
+/** The name a phase is reported under */
+const char* GetBlockPhaseName(BlockConnectPhase phase);
+
+/**
+ * Timings of connecting one block. Blocks connected in a run share the
+ * load, flush, chainstate, postconnect and total phases, which are only
+ * recorded for the last block of the run.
+ */
+struct BlockConnectRecord
+{
+    uint256 hash;
+    int nHeight = 0;
+    //! When the block was connected, in seconds since the epoch
+    int64_t nTime = 0;
+    unsigned int nTx = 0;
+    unsigned int nInputs = 0;
+    //! Number of blocks connected together with this one, including itself
+    unsigned int nRunSize = 1;
+    //! Microseconds spent in each phase, -1 if not recorded for this block
+    std::array<int64_t, NUM_BLOCK_PHASES> vPhaseMicros;
+
+    BlockConnectRecord() { vPhaseMicros.fill(-1); }
+};
+
+/** Distribution of the time spent in one phase */
+struct BlockPhaseHistogram
+{
+    //! Non-cumulative count of the observations below each of BLOCK_PHASE_BUCKET_BOUNDS, and above the last
+    std::vector<uint64_t> vCounts;
+    uint64_t nCount = 0;
+    int64_t nTotalMicros = 0;
+};
+
+/** Upper bounds of the histogram buckets, in microseconds */
+static const std::array<int64_t, 16> BLOCK_PHASE_BUCKET_BOUNDS = {{
+    100, 250, 500,
+    1000, 2500, 5000,
+    10000, 25000, 50000,
+    100000, 250000, 500000,
+    1000000, 2500000, 5000000,
+    10000000,
+}};
+
+/** Number of the most recent block records kept */
+static const size_t MAX_BLOCK_CONNECT_RECORDS = 1000;
+
+/**
+ * Keeps a histogram of the time spent in each phase of connecting blocks
+ * since startup, and the records of the most recently connected blocks.
+ * Thread safe.
+ */
+class CBlockConnectStats
+{
+public:
+    explicit CBlockConnectStats(size_t nMaxRecordsIn = MAX_BLOCK_CONNECT_RECORDS);
+
+    void AddRecord(const BlockConnectRecord& record);
+
+    //! The last nRecords records, oldest first
+    std::vector<BlockConnectRecord> GetRecords(size_t nRecords) const;
+    std::array<BlockPhaseHistogram, NUM_BLOCK_PHASES> GetHistograms() const;
+    uint64_t GetBlockCount() const;
+
+    //! All of the above but the records, in the Prometheus text exposition format
+    std::string ToPrometheusText() const;
+
+private:
+    mutable CCriticalSection cs;
+    const size_t nMaxRecords;
+    std::deque<BlockConnectRecord> records;
+    std::array<BlockPhaseHistogram, NUM_BLOCK_PHASES> histograms;
+    uint64_t nBlocks;
+};
+
+extern CBlockConnectStats g_block_connect_stats;
+
+#endif // BITCOIN_VALIDATIONSTATS_H